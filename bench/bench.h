@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Every benchmark is sampled BENCH_SAMPLES times, each sample running enough
+// iterations to take at least BENCH_MIN_SAMPLE_NS
+#define BENCH_SAMPLES 15
+#define BENCH_MIN_SAMPLE_NS 20000000
+
+namespace darena {
+
+inline int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Keeps the compiler from optimizing away a value the benchmark computed
+template <typename T>
+inline void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchResult {
+  std::string name;
+  int64_t param;
+  uint64_t iterations;
+  double min_ns;
+  double median_ns;
+  double mean_ns;
+};
+
+// Runs the registered benchmarks and collects their results. Only benchmarks
+// whose name contains the filter are run.
+class BenchRunner {
+ private:
+  std::string filter;
+  std::vector<darena::BenchResult> results;
+
+ public:
+  explicit BenchRunner(std::string filter) : filter(filter) {}
+
+  // Calibrates and samples a benchmark. sample(n) runs n iterations and
+  // returns the nanoseconds they took.
+  template <typename Sample>
+  void measure(const char* name, int64_t param, Sample&& sample) {
+    std::string full_name = std::string(name) + "/" + std::to_string(param);
+    if (full_name.find(filter) == std::string::npos) {
+      return;
+    }
+
+    // Double the iterations until a sample takes at least BENCH_MIN_SAMPLE_NS
+    uint64_t iterations = 1;
+    while (sample(iterations) < BENCH_MIN_SAMPLE_NS &&
+           iterations < (1ull << 30)) {
+      iterations *= 2;
+    }
+
+    std::vector<double> samples;
+    for (int s = 0; s < BENCH_SAMPLES; s++) {
+      samples.push_back((double)sample(iterations) / iterations);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (double value : samples) {
+      sum += value;
+    }
+
+    results.push_back({full_name, param, iterations, samples.front(),
+                       samples[samples.size() / 2], sum / samples.size()});
+    std::fprintf(stderr, "%-48s %12.1f ns\n", full_name.c_str(),
+                 samples[samples.size() / 2]);
+  }
+
+  // Runs body() back to back
+  template <typename Body>
+  void run(const char* name, int64_t param, Body&& body) {
+    measure(name, param, [&body](uint64_t iterations) {
+      int64_t start = now_ns();
+      for (uint64_t i = 0; i < iterations; i++) {
+        body();
+      }
+      return now_ns() - start;
+    });
+  }
+
+  // Like run(), but calls setup() before every iteration to reset the state
+  // body() consumes. Only body() is timed, so keep it well above the cost of
+  // reading the clock.
+  template <typename Setup, typename Body>
+  void run(const char* name, int64_t param, Setup&& setup, Body&& body) {
+    measure(name, param, [&setup, &body](uint64_t iterations) {
+      int64_t elapsed = 0;
+      for (uint64_t i = 0; i < iterations; i++) {
+        setup();
+        int64_t start = now_ns();
+        body();
+        elapsed += now_ns() - start;
+      }
+      return elapsed;
+    });
+  }
+
+  const std::vector<darena::BenchResult>& get_results() const {
+    return results;
+  }
+
+  // Writes the results as JSON, in the same shape as Google Benchmark's
+  // --benchmark_format=json so existing comparison tools can read it
+  void write_json(FILE* out) const {
+    std::fprintf(out, "{\n  \"context\": {\n");
+    std::fprintf(out, "    \"samples\": %d,\n", BENCH_SAMPLES);
+    std::fprintf(out, "    \"min_sample_ns\": %d\n  },\n", BENCH_MIN_SAMPLE_NS);
+    std::fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+      const BenchResult& r = results[i];
+      std::fprintf(out,
+                   "    {\"name\": \"%s\", \"param\": %lld, \"iterations\": "
+                   "%llu, \"real_time\": %.2f, \"min_time\": %.2f, "
+                   "\"mean_time\": %.2f, \"time_unit\": \"ns\"}%s\n",
+                   r.name.c_str(), (long long)r.param,
+                   (unsigned long long)r.iterations, r.median_ns, r.min_ns,
+                   r.mean_ns, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+  }
+};
+
+}  // namespace darena
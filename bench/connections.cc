@@ -0,0 +1,397 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "codec.h"
+#include "common.h"
+#include "fixtures.h"
+#include "transport.h"
+
+// Server connection layer with many connections over loopback.
+//
+// Usage: DuelArenaConnectionBench [n_of_connections] [backend...]
+// Backends are "sdl_net" (listen_tcp()), "uring" (listen_uring()) and
+// "epoll", a plain level-triggered epoll loop kept here as the reference,
+// all of them by default. For each backend n_of_connections clients connect
+// while the server accepts them, then the server fans a turn out to every
+// client and receives one from every client, CONNECTION_BENCH_ROUNDS times.
+// Only the server side is timed, the clients are blocking sockets. Writes the
+// results as JSON to stdout, a table goes to stderr.
+//
+// Every connection is two file descriptors in this process, raise the limit
+// with ulimit -n for 10k connections.
+
+#define CONNECTION_BENCH_DEFAULT_CONNECTIONS 10000
+#define CONNECTION_BENCH_ROUNDS 10
+#define CONNECTION_BENCH_TURN_FRAMES 600
+
+namespace {
+
+// Server side of one backend
+class BenchServer {
+ public:
+  virtual ~BenchServer() = default;
+  virtual bool accept_all(int n_of_connections) = 0;
+  // Sends frame to every connection
+  virtual bool fan_out(const std::vector<uint8_t>& frame) = 0;
+  // Receives one message of size bytes from every connection
+  virtual bool receive_all(size_t size) = 0;
+};
+
+// Any backend behind darena::Listener. Fan-out queues every send before
+// flushing, which io_uring submits in one batch. SDL_net waits with select(),
+// which can't watch descriptors past FD_SETSIZE, so receives go through the
+// connections in order, every client has sent by then.
+class TransportServer : public BenchServer {
+ private:
+  std::unique_ptr<darena::Listener> listener;
+  std::vector<std::unique_ptr<darena::Connection>> connections;
+  std::vector<char> message;
+
+ public:
+  explicit TransportServer(std::unique_ptr<darena::Listener> listener)
+      : listener(std::move(listener)) {}
+
+  bool accept_all(int n_of_connections) override {
+    while ((int)connections.size() < n_of_connections) {
+      std::unique_ptr<darena::Connection> connection =
+          listener->accept(DARENA_CONNECTION_AWAIT);
+      if (!connection) {
+        return false;
+      }
+      connections.push_back(std::move(connection));
+    }
+    return true;
+  }
+
+  bool fan_out(const std::vector<uint8_t>& frame) override {
+    const char* data = reinterpret_cast<const char*>(frame.data());
+    for (auto& connection : connections) {
+      if (!connection->queue_send(data, frame.size())) {
+        return false;
+      }
+    }
+    for (auto& connection : connections) {
+      if (!connection->flush()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool receive_all(size_t size) override {
+    for (auto& connection : connections) {
+      if (!connection->receive(message) || message.size() != size) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+bool send_frame(int fd, const char* data, size_t size) {
+  uint32_t header = htonl(size);
+  iovec parts[2] = {{&header, sizeof(header)}, {(void*)data, size}};
+  ssize_t len = writev(fd, parts, 2);
+  return len == (ssize_t)(sizeof(header) + size);
+}
+
+bool receive_frame(int fd, std::vector<char>& message) {
+  uint32_t header;
+  if (recv(fd, &header, sizeof(header), MSG_WAITALL) != sizeof(header)) {
+    return false;
+  }
+  message.resize(ntohl(header));
+  return recv(fd, message.data(), message.size(), MSG_WAITALL) ==
+         (ssize_t)message.size();
+}
+
+class EpollServer : public BenchServer {
+ private:
+  int listen_fd = -1;
+  int epoll_fd = -1;
+  std::vector<int> connections;
+  std::vector<char> message;
+  std::vector<epoll_event> events;
+
+ public:
+  ~EpollServer() override {
+    for (int fd : connections) {
+      close(fd);
+    }
+    if (epoll_fd >= 0) {
+      close(epoll_fd);
+    }
+    if (listen_fd >= 0) {
+      close(listen_fd);
+    }
+  }
+
+  bool initialize() {
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(DARENA_PORT);
+    if (bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listen_fd, SOMAXCONN) < 0) {
+      std::fprintf(stderr, "epoll bind error: %s\n", std::strerror(errno));
+      return false;
+    }
+    epoll_fd = epoll_create1(0);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    events.resize(1024);
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == 0;
+  }
+
+  bool accept_all(int n_of_connections) override {
+    while ((int)connections.size() < n_of_connections) {
+      if (epoll_wait(epoll_fd, events.data(), 1, DARENA_CONNECTION_AWAIT) <=
+          0) {
+        return false;
+      }
+      int fd;
+      while ((fd = accept4(listen_fd, nullptr, nullptr, 0)) >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        connections.push_back(fd);
+      }
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+    for (int fd : connections) {
+      epoll_event event;
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+    return true;
+  }
+
+  bool fan_out(const std::vector<uint8_t>& frame) override {
+    const char* data = reinterpret_cast<const char*>(frame.data());
+    for (int fd : connections) {
+      if (!send_frame(fd, data, frame.size())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool receive_all(size_t size) override {
+    size_t n_of_received = 0;
+    while (n_of_received < connections.size()) {
+      int n_of_events =
+          epoll_wait(epoll_fd, events.data(), events.size(),
+                     DARENA_CONNECTION_AWAIT);
+      if (n_of_events <= 0) {
+        return false;
+      }
+      for (int i = 0; i < n_of_events; i++) {
+        if (!receive_frame(events[i].data.fd, message) ||
+            message.size() != size) {
+          return false;
+        }
+      }
+      n_of_received += n_of_events;
+    }
+    return true;
+  }
+};
+
+std::unique_ptr<BenchServer> make_server(const std::string& backend) {
+  if (backend == "epoll") {
+    auto server = std::make_unique<EpollServer>();
+    if (!server->initialize()) {
+      return nullptr;
+    }
+    return server;
+  }
+  std::unique_ptr<darena::Listener> listener =
+      backend == "uring" ? darena::listen_uring() : darena::listen_tcp();
+  if (!listener) {
+    return nullptr;
+  }
+  return std::make_unique<TransportServer>(std::move(listener));
+}
+
+int connect_client() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(DARENA_PORT);
+  if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+    std::fprintf(stderr, "Connect error: %s\n", std::strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+struct BackendResult {
+  std::string backend;
+  double accept_ms;
+  double fan_out_ms;
+  double receive_ms;
+};
+
+bool run_backend(const std::string& backend, int n_of_connections,
+                 const std::vector<uint8_t>& frame, BackendResult& result) {
+  std::unique_ptr<BenchServer> server = make_server(backend);
+  if (!server) {
+    std::fprintf(stderr, "Could not start %s\n", backend.c_str());
+    return false;
+  }
+
+  // Clients connect while the server accepts, the listen backlog is shorter
+  // than the connection count
+  bool accepted = false;
+  int64_t accept_started_at = darena::now_ns();
+  int64_t accept_ns = 0;
+  std::thread accept_thread([&]() {
+    accepted = server->accept_all(n_of_connections);
+    accept_ns = darena::now_ns() - accept_started_at;
+  });
+  std::vector<int> clients;
+  for (int i = 0; i < n_of_connections; i++) {
+    int fd = connect_client();
+    if (fd < 0) {
+      break;
+    }
+    clients.push_back(fd);
+  }
+  accept_thread.join();
+
+  bool noerr = accepted && (int)clients.size() == n_of_connections;
+  int64_t fan_out_ns = 0;
+  int64_t receive_ns = 0;
+  std::vector<char> message;
+  const char* data = reinterpret_cast<const char*>(frame.data());
+  for (int round = 0; noerr && round < CONNECTION_BENCH_ROUNDS; round++) {
+    int64_t started_at = darena::now_ns();
+    noerr = server->fan_out(frame);
+    fan_out_ns += darena::now_ns() - started_at;
+    for (int fd : clients) {
+      noerr = noerr && receive_frame(fd, message) &&
+              message.size() == frame.size();
+    }
+
+    for (int fd : clients) {
+      noerr = noerr && send_frame(fd, data, frame.size());
+    }
+    started_at = darena::now_ns();
+    noerr = noerr && server->receive_all(frame.size());
+    receive_ns += darena::now_ns() - started_at;
+  }
+
+  // The server closes first, so the clients' ports are not left in TIME_WAIT
+  // for the next backend
+  server.reset();
+  for (int fd : clients) {
+    close(fd);
+  }
+  if (!noerr) {
+    std::fprintf(stderr, "%s failed\n", backend.c_str());
+    return false;
+  }
+
+  result.backend = backend;
+  result.accept_ms = accept_ns / 1e6;
+  result.fan_out_ms = fan_out_ns / 1e6 / CONNECTION_BENCH_ROUNDS;
+  result.receive_ms = receive_ns / 1e6 / CONNECTION_BENCH_ROUNDS;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int n_of_connections =
+      argc > 1 ? std::atoi(argv[1]) : CONNECTION_BENCH_DEFAULT_CONNECTIONS;
+  if (n_of_connections <= 0) {
+    std::fprintf(stderr, "Usage: %s [n_of_connections] [backend...]\n",
+                 argv[0]);
+    return 1;
+  }
+  std::vector<std::string> backends;
+  for (int i = 2; i < argc; i++) {
+    backends.push_back(argv[i]);
+  }
+  if (backends.empty()) {
+    backends = {"sdl_net", "epoll", "uring"};
+  }
+
+  rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur < (rlim_t)n_of_connections * 2 + 64) {
+    std::fprintf(stderr,
+                 "%d connections need %d descriptors, the limit is %d\n",
+                 n_of_connections, n_of_connections * 2 + 64,
+                 (int)limit.rlim_cur);
+    return 1;
+  }
+
+  std::cout.setstate(std::ios::badbit);
+  std::vector<uint8_t> frame;
+  darena::encode_message(darena::make_bench_turn(CONNECTION_BENCH_TURN_FRAMES),
+                         frame);
+
+  std::vector<BackendResult> results;
+  for (const std::string& backend : backends) {
+    BackendResult result;
+    if (!run_backend(backend, n_of_connections, frame, result)) {
+      return 1;
+    }
+    results.push_back(result);
+  }
+
+  std::fprintf(stderr, "%d connections, %zu byte turns\n", n_of_connections,
+               frame.size());
+  std::fprintf(stderr, "%-10s %12s %12s %12s %14s\n", "backend", "accept ms",
+               "fan-out ms", "receive ms", "fan-out us/conn");
+  std::printf("{\n  \"connections\": %d,\n  \"turn_bytes\": %zu,\n",
+              n_of_connections, frame.size());
+  std::printf("  \"backends\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const BackendResult& result = results[i];
+    std::fprintf(stderr, "%-10s %12.1f %12.2f %12.2f %14.3f\n",
+                 result.backend.c_str(), result.accept_ms, result.fan_out_ms,
+                 result.receive_ms,
+                 result.fan_out_ms * 1000 / n_of_connections);
+    std::printf(
+        "    {\"backend\": \"%s\", \"accept_ms\": %.1f, "
+        "\"fan_out_ms\": %.2f, \"receive_ms\": %.2f}%s\n",
+        result.backend.c_str(), result.accept_ms, result.fan_out_ms,
+        result.receive_ms, i + 1 < results.size() ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+  return 0;
+}
@@ -0,0 +1,40 @@
+#include "fixtures.h"
+
+#include "game_master.h"
+#include "state_hash.h"
+
+#define BENCH_SEED 50325
+
+namespace darena {
+
+std::vector<darena::IslandPoint> make_bench_heightmap(
+    const darena::Vec2& starting_position, int n_of_points) {
+  darena::GameMaster game_master{};
+  game_master.seed(BENCH_SEED);
+  return game_master.generate_heightmap(starting_position, n_of_points);
+}
+
+darena::ClientTurn make_bench_turn(int n_of_frames) {
+  darena::ClientTurn turn;
+  turn.id = 0;
+  for (int i = 0; i < n_of_frames; i++) {
+    int phase = i % 120;
+    turn.movements.push_back(phase < 40 ? 1 : (phase < 60 ? 0 : -1));
+    if (i % 3 == 0) {
+      turn.angle_changes.push_back(phase < 60 ? 1 : -1);
+    }
+  }
+  turn.shot_angle = 0.7f;
+  turn.shot_power = 64.0f;
+  turn.final_position = {180.0f, 340.0f};
+  // Digests are random 64-bit values, the worst case for the varints
+  for (int part = 0; part < STATE_DIGEST_PARTS; part++) {
+    turn.start_digest.parts[part] = darena::hash_combine(0, (uint64_t)part);
+    turn.end_digest.parts[part] = darena::hash_combine(1, (uint64_t)part);
+  }
+  turn.start_digest.turn = 4;
+  turn.end_digest.turn = 5;
+  return turn;
+}
+
+}  // namespace darena
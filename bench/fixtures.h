@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+
+#include "common.h"
+
+namespace darena {
+
+// Heightmaps are generated from a fixed seed so runs are comparable
+std::vector<darena::IslandPoint> make_bench_heightmap(
+    const darena::Vec2& starting_position, int n_of_points);
+
+// Turn of a player walking, stopping and walking back for n_of_frames
+darena::ClientTurn make_bench_turn(int n_of_frames);
+
+}  // namespace darena
@@ -0,0 +1,317 @@
+#include <iostream>
+#include <string>
+
+#include "bench.h"
+#include "codec.h"
+#include "common.h"
+#include "fixtures.h"
+#include "game.h"
+#include "game_master.h"
+#include "island.h"
+#include "keyframe.h"
+#include "player.h"
+#include "projectile.h"
+#include "rollback.h"
+#include "server_lib.h"
+#include "terrain_delta.h"
+
+// Microbenchmarks for the per-frame and per-turn hot paths.
+//
+// Usage: DuelArenaBench [filter]
+// Runs every benchmark whose name contains filter and writes the results as
+// JSON to stdout, progress goes to stderr.
+
+namespace {
+
+// Heightmap sizes, the first one is what the game uses today
+const int terrain_resolutions[] = {(int)ISLAND_NUM_OF_POINTS, 96, 384, 1536};
+
+// Turn lengths in frames, 1 s, 10 s and 60 s at TARGET_FPS
+const int turn_lengths[] = {60, 600, 3600};
+
+std::vector<darena::IslandPoint> make_heightmap(int n_of_points) {
+  return darena::make_bench_heightmap(darena::left_island_starting_position,
+                                      n_of_points);
+}
+
+void bench_generate_heightmap(darena::BenchRunner& runner) {
+  for (int points : terrain_resolutions) {
+    darena::GameMaster game_master{};
+    runner.run("generate_heightmap", points, [&]() {
+      auto heightmap = game_master.generate_heightmap(
+          darena::left_island_starting_position, points);
+      darena::do_not_optimize(heightmap.data());
+    });
+  }
+}
+
+void bench_rebuild_island_mesh(darena::BenchRunner& runner) {
+  for (int points : terrain_resolutions) {
+    darena::Island island(darena::left_island_starting_position,
+                          make_heightmap(points));
+    runner.run("rebuild_island_mesh", points,
+               [&]() { island.rebuild_island_mesh(); });
+  }
+}
+
+// Points a crater of Projectile::island_hit_poll() changes
+const int crater_points = 9;
+
+void bench_remesh_crater(darena::BenchRunner& runner) {
+  for (int points : terrain_resolutions) {
+    darena::Island island(darena::left_island_starting_position,
+                          make_heightmap(points));
+    island.rebuild_island_mesh();
+    size_t first = (points - crater_points) / 2;
+    runner.run("remesh_crater", points,
+               [&]() { island.remesh(first, first + crater_points); });
+  }
+}
+
+void bench_terrain_delta(darena::BenchRunner& runner) {
+  for (int points : terrain_resolutions) {
+    std::vector<darena::IslandPoint> heightmap = make_heightmap(points);
+    size_t first = (points - crater_points) / 2;
+    darena::TerrainDelta delta;
+    std::vector<uint8_t> buffer;
+    runner.run("terrain_delta_encode", points, [&]() {
+      darena::encode_terrain_delta(heightmap, 0, first, first + crater_points,
+                                   delta);
+      darena::encode_message(delta, buffer);
+      darena::do_not_optimize(buffer.data());
+    });
+    std::fprintf(stderr, "%-48s %12zu bytes\n",
+                 ("terrain_delta_size/" + std::to_string(points)).c_str(),
+                 buffer.size());
+
+    darena::TerrainDelta decoded_delta;
+    runner.run("terrain_delta_apply", points, [&]() {
+      darena::decode_message((const char*)buffer.data(), buffer.size(),
+                             decoded_delta);
+      darena::apply_terrain_delta(decoded_delta, heightmap);
+      darena::do_not_optimize(heightmap.data());
+    });
+  }
+}
+
+void bench_island_hit_poll(darena::BenchRunner& runner) {
+  for (int points : terrain_resolutions) {
+    darena::Game game;
+    game.my_turn = false;
+    darena::Island island(darena::left_island_starting_position,
+                          make_heightmap(points));
+    const std::vector<darena::IslandPoint>& heightmap = island.heightmap;
+    darena::Projectile projectile(0, 0, 0.7f, 50.0f, 1);
+
+    // One frame of a projectile flying over the island, it checks every point
+    float nose_x = heightmap[heightmap.size() / 2].position.x;
+    float nose_y = ISLAND_Y_OFFSET - 20;
+    runner.run("island_hit_poll", points, [&]() {
+      int hits = 0;
+      for (size_t i = 0; i < heightmap.size(); ++i) {
+        hits += projectile.island_hit_poll(&game, island, i, nose_x, nose_y);
+      }
+      darena::do_not_optimize(hits);
+    });
+  }
+}
+
+void bench_player_update(darena::BenchRunner& runner) {
+  for (int points : terrain_resolutions) {
+    darena::Game game;
+    game.my_turn = false;
+    std::vector<darena::IslandPoint> heightmap = make_heightmap(points);
+    float start_x = heightmap.front().position.x;
+    float span = heightmap.back().position.x - start_x;
+
+    darena::Player player(start_x, ISLAND_Y_OFFSET, 25, 25);
+    player.heightmap = &heightmap;
+
+    // Terrain following only, the player walks across the whole island
+    int step = 0;
+    runner.run("player_update", points, [&]() {
+      player.position = {start_x + (step++ % (int)span),
+                         (float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT)};
+      player.falling = false;
+      player.update(&game, FIXED_TIMESTEP);
+      darena::do_not_optimize(player.position);
+    });
+  }
+}
+
+void bench_trim_turn_data(darena::BenchRunner& runner) {
+  for (int frames : turn_lengths) {
+    darena::TCPServer server;
+    darena::ClientTurn turn = darena::make_bench_turn(frames);
+    server.turn_data = std::make_unique<darena::ClientTurn>();
+    runner.run(
+        "trim_turn_data", frames, [&]() { *server.turn_data = turn; },
+        [&]() { server.trim_turn_data(); });
+  }
+}
+
+// What the server does per turn with the binary codec: parse the received
+// bytes in place and write the trimmed message to forward
+void bench_trim_turn_view(darena::BenchRunner& runner) {
+  for (int frames : turn_lengths) {
+    darena::TCPServer server;
+    std::vector<uint8_t> encoded;
+    darena::Encoder encoder(encoded);
+    encoder.write(darena::make_bench_turn(frames));
+    server.message.assign(encoded.begin(), encoded.end());
+    runner.run("trim_turn_view", frames, [&]() {
+      server.turn_view.parse(server.message.data(), server.message.size());
+      server.trim_turn_view();
+      darena::do_not_optimize(server.send_buffer.data());
+    });
+  }
+}
+
+void bench_msgpack_client_turn(darena::BenchRunner& runner) {
+  for (int frames : turn_lengths) {
+    darena::ClientTurn turn = darena::make_bench_turn(frames);
+    runner.run("msgpack_pack_client_turn", frames, [&]() {
+      msgpack::sbuffer buffer;
+      msgpack::pack(buffer, turn);
+      darena::do_not_optimize(buffer.data());
+    });
+
+    msgpack::sbuffer packed;
+    msgpack::pack(packed, turn);
+    runner.run("msgpack_unpack_client_turn", frames, [&]() {
+      msgpack::unpacked result;
+      msgpack::unpack(result, packed.data(), packed.size());
+      darena::ClientTurn unpacked_turn;
+      result.get().convert(unpacked_turn);
+      darena::do_not_optimize(unpacked_turn.movements.data());
+    });
+  }
+}
+
+void bench_msgpack_heightmaps(darena::BenchRunner& runner) {
+  for (int points : terrain_resolutions) {
+    darena::ServerIDHeightmapsResponse response;
+    response.client_id = 0;
+    response.resume_token = 0;
+    response.keyframe = darena::initial_keyframe(
+        {make_heightmap(points), make_heightmap(points)});
+
+    runner.run("msgpack_pack_heightmaps", points, [&]() {
+      msgpack::sbuffer buffer;
+      msgpack::pack(buffer, response);
+      darena::do_not_optimize(buffer.data());
+    });
+
+    msgpack::sbuffer packed;
+    msgpack::pack(packed, response);
+    runner.run("msgpack_unpack_heightmaps", points, [&]() {
+      msgpack::unpacked result;
+      msgpack::unpack(result, packed.data(), packed.size());
+      darena::ServerIDHeightmapsResponse unpacked_response;
+      result.get().convert(unpacked_response);
+      darena::do_not_optimize(
+          unpacked_response.keyframe.heightmaps[0].data());
+    });
+  }
+}
+
+// One frame of the real-time mode with a misprediction found rollback_frames
+// back: restore the snapshot, simulate those frames again, then the new one.
+// Has to stay far below the 16 ms frame budget at ROLLBACK_MAX_FRAMES.
+void bench_rollback(darena::BenchRunner& runner) {
+  std::vector<darena::IslandPoint> left =
+      make_heightmap((int)ISLAND_NUM_OF_POINTS);
+  std::vector<darena::IslandPoint> right = darena::make_bench_heightmap(
+      darena::right_island_starting_position, (int)ISLAND_NUM_OF_POINTS);
+  darena::SimTerrain terrain = {&left, &right};
+
+  const int rollback_lengths[] = {1, 8, ROLLBACK_MAX_FRAMES - 1};
+  for (int rollback_frames : rollback_lengths) {
+    darena::RollbackSession session;
+    runner.run(
+        "rollback_resimulate", rollback_frames,
+        [&]() {
+          session.start(0, darena::initial_sim_state());
+          for (int i = 0; i < rollback_frames; i++) {
+            session.advance(REALTIME_INPUT_RIGHT, terrain);
+          }
+          // The other player had been moving left all along
+          session.add_remote_input(0, REALTIME_INPUT_LEFT);
+        },
+        [&]() {
+          session.advance(REALTIME_INPUT_RIGHT, terrain);
+          darena::do_not_optimize(session.state.tanks[1].position);
+        });
+  }
+}
+
+// Same messages through the binary codec. Buffers and structs are reused
+// across iterations, the way the client and server use them.
+void bench_codec_client_turn(darena::BenchRunner& runner) {
+  for (int frames : turn_lengths) {
+    darena::ClientTurn turn = darena::make_bench_turn(frames);
+    std::vector<uint8_t> buffer;
+    runner.run("codec_encode_client_turn", frames, [&]() {
+      darena::encode_message(turn, buffer);
+      darena::do_not_optimize(buffer.data());
+    });
+
+    darena::ClientTurn decoded_turn;
+    runner.run("codec_decode_client_turn", frames, [&]() {
+      darena::decode_message((const char*)buffer.data(), buffer.size(),
+                             decoded_turn);
+      darena::do_not_optimize(decoded_turn.movements.data());
+    });
+  }
+}
+
+void bench_codec_heightmaps(darena::BenchRunner& runner) {
+  for (int points : terrain_resolutions) {
+    darena::ServerIDHeightmapsResponse response;
+    response.client_id = 0;
+    response.resume_token = 0;
+    response.keyframe = darena::initial_keyframe(
+        {make_heightmap(points), make_heightmap(points)});
+
+    std::vector<uint8_t> buffer;
+    runner.run("codec_encode_heightmaps", points, [&]() {
+      darena::encode_message(response, buffer);
+      darena::do_not_optimize(buffer.data());
+    });
+
+    darena::ServerIDHeightmapsResponse decoded_response;
+    runner.run("codec_decode_heightmaps", points, [&]() {
+      darena::decode_message((const char*)buffer.data(), buffer.size(),
+                             decoded_response);
+      darena::do_not_optimize(decoded_response.keyframe.heightmaps[0].data());
+    });
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string filter = argc > 1 ? argv[1] : "";
+
+  // The game logs through std::cout, keep it out of the results and the
+  // timings. Results are written with stdio.
+  std::cout.setstate(std::ios::badbit);
+
+  darena::BenchRunner runner(filter);
+  bench_generate_heightmap(runner);
+  bench_rebuild_island_mesh(runner);
+  bench_remesh_crater(runner);
+  bench_terrain_delta(runner);
+  bench_island_hit_poll(runner);
+  bench_player_update(runner);
+  bench_trim_turn_data(runner);
+  bench_trim_turn_view(runner);
+  bench_rollback(runner);
+  bench_msgpack_client_turn(runner);
+  bench_msgpack_heightmaps(runner);
+  bench_codec_client_turn(runner);
+  bench_codec_heightmaps(runner);
+
+  runner.write_json(stdout);
+  return 0;
+}
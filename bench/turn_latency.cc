@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "fixtures.h"
+#include "game.h"
+#include "server_lib.h"
+
+// End-to-end turn latency over loopback.
+//
+// Usage: DuelArenaTurnLatency [n_of_turns] [turn_frames] [address]
+//                             [--pass-through]
+// Runs the real server relay on a thread and two clients on the main thread,
+// connected through address (see darena::listen()), TCP on 127.0.0.1 by
+// default. "inproc:bench" measures everything but the network stack.
+// --pass-through measures the server forwarding turns undecoded, its trim and
+// repack stages are then zero. Every
+// turn is timed from the moment the shooting client calls
+// Game::send_turn_data() until the other client has the ClientTurn that
+// Game::simulate_turn() hands to the enemy. Writes the latency distribution of
+// every stage as JSON to stdout, a table goes to stderr.
+
+#define LATENCY_DEFAULT_TURNS 2000
+#define LATENCY_DEFAULT_TURN_FRAMES 600
+// Turns played before measuring, while connections and allocators warm up
+#define LATENCY_WARMUP_TURNS 20
+
+namespace {
+
+enum Stage {
+  SERIALIZE,
+  SEND,
+  SERVER_DECODE,
+  SERVER_TRIM,
+  SERVER_REPACK,
+  SERVER_FORWARD,
+  DELIVER,
+  CLIENT_UNPACK,
+  TOTAL,
+  N_OF_STAGES
+};
+
+const char* stage_names[N_OF_STAGES] = {
+    "serialize",     "send",           "server_decode",
+    "server_trim",   "server_repack",  "server_forward",
+    "deliver",       "client_unpack",  "total"};
+
+// Client side timestamps of one turn, SDL_GetPerformanceCounter() ticks
+struct ClientTimings {
+  uint64_t triggered_at;
+  uint64_t packed_at;
+  uint64_t received_at;
+  uint64_t unpacked_at;
+};
+
+struct LatencySummary {
+  double min_us;
+  double p50_us;
+  double p90_us;
+  double p99_us;
+  double max_us;
+  double mean_us;
+};
+
+LatencySummary summarize(std::vector<double>& samples) {
+  std::sort(samples.begin(), samples.end());
+  double sum = 0;
+  for (double sample : samples) {
+    sum += sample;
+  }
+  auto percentile = [&samples](double p) {
+    size_t i = (size_t)(p * (samples.size() - 1) + 0.5);
+    return samples[i];
+  };
+  return {samples.front(), percentile(0.5),  percentile(0.9),
+          percentile(0.99), samples.back(), sum / samples.size()};
+}
+
+bool connect_client(darena::Game& game, const char* address,
+                    const char* username) {
+  game.server_ip = address;
+  game.username = username;
+  return game.connect_to_server();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int n_of_turns = argc > 1 ? std::atoi(argv[1]) : LATENCY_DEFAULT_TURNS;
+  int turn_frames =
+      argc > 2 ? std::atoi(argv[2]) : LATENCY_DEFAULT_TURN_FRAMES;
+  if (n_of_turns <= 0 || turn_frames <= 0) {
+    std::fprintf(stderr,
+                 "Usage: %s [n_of_turns] [turn_frames] [address] "
+                 "[--pass-through]\n",
+                 argv[0]);
+    return 1;
+  }
+  const char* address = argc > 3 ? argv[3] : "127.0.0.1";
+  int total_turns = n_of_turns + LATENCY_WARMUP_TURNS;
+
+  // Both sides log every turn through std::cout, that formatting is part of
+  // the measured latency but the output itself is not wanted here
+  std::cout.setstate(std::ios::badbit);
+
+  darena::TCPServer server{};
+  server.pass_through = argc > 4 && std::string(argv[4]) == "--pass-through";
+  if (!server.initialize(address)) {
+    std::fprintf(stderr, "Could not start the server on %s\n", address);
+    return 1;
+  }
+
+  std::array<std::vector<darena::IslandPoint>, MAX_CLIENTS> heightmaps = {
+      darena::make_bench_heightmap(darena::left_island_starting_position,
+                                   ISLAND_NUM_OF_POINTS),
+      darena::make_bench_heightmap(darena::right_island_starting_position,
+                                   ISLAND_NUM_OF_POINTS)};
+
+  // Written only by the server thread, read after it is joined
+  std::vector<darena::RelayTimings> relay_timings(total_turns);
+  bool server_ok = true;
+  std::thread server_thread([&]() {
+    if (!server.accept_players(heightmaps)) {
+      server_ok = false;
+      return;
+    }
+    for (int turn = 0; turn < total_turns; turn++) {
+      int id_playing = turn % 2;
+      if (!server.relay_turn(id_playing, 1 - id_playing,
+                             &relay_timings[turn])) {
+        server_ok = false;
+        return;
+      }
+    }
+  });
+
+  std::array<darena::Game, MAX_CLIENTS> games;
+  bool clients_ok = connect_client(games[0], address, "bench0") &&
+                    connect_client(games[1], address, "bench1") &&
+                    games[0].get_island_data() && games[1].get_island_data();
+
+  darena::ClientTurn turn = darena::make_bench_turn(turn_frames);
+  std::vector<ClientTimings> client_timings(total_turns);
+  for (int turn_i = 0; clients_ok && turn_i < total_turns; turn_i++) {
+    darena::Game& shooting = games[turn_i % 2];
+    darena::Game& waiting = games[1 - turn_i % 2];
+    ClientTimings& timings = client_timings[turn_i];
+
+    *shooting.turn_data = turn;
+    shooting.turn_data->id = shooting.id;
+
+    timings.triggered_at = SDL_GetPerformanceCounter();
+    shooting.send_turn_data();
+    timings.packed_at = shooting.client.last_packed_at;
+
+    clients_ok = waiting.get_turn_data();
+    timings.unpacked_at = SDL_GetPerformanceCounter();
+    timings.received_at = waiting.client.last_received_at;
+  }
+
+  server_thread.join();
+  for (auto& game : games) {
+    game.client.cleanup();
+  }
+  server.cleanup();
+
+  if (!clients_ok || !server_ok) {
+    std::fprintf(stderr, "Turn relay failed\n");
+    return 1;
+  }
+
+  // Every stage runs from the end of the previous one. send covers the socket
+  // writes, loopback and the server reading the message, deliver the same on
+  // the way back.
+  double us_per_tick = 1e6 / SDL_GetPerformanceFrequency();
+  std::array<std::vector<double>, N_OF_STAGES> samples;
+  for (int turn_i = LATENCY_WARMUP_TURNS; turn_i < total_turns; turn_i++) {
+    const ClientTimings& c = client_timings[turn_i];
+    const darena::RelayTimings& s = relay_timings[turn_i];
+    uint64_t points[N_OF_STAGES] = {
+        c.triggered_at, c.packed_at,   s.read_at,
+        s.received_at,  s.trimmed_at,  s.packed_at,
+        s.forwarded_at, c.received_at, c.unpacked_at};
+    for (int stage = 0; stage < TOTAL; stage++) {
+      samples[stage].push_back((points[stage + 1] - points[stage]) *
+                               us_per_tick);
+    }
+    samples[TOTAL].push_back((c.unpacked_at - c.triggered_at) * us_per_tick);
+  }
+
+  std::fprintf(stderr, "%d turns of %d frames over %s%s\n", n_of_turns,
+               turn_frames, address,
+               server.pass_through ? ", pass-through" : "");
+  std::fprintf(stderr, "%-16s %10s %10s %10s %10s %10s %10s\n", "stage (us)",
+               "min", "p50", "p90", "p99", "max", "mean");
+  std::printf("{\n  \"turns\": %d,\n  \"turn_frames\": %d,\n", n_of_turns,
+              turn_frames);
+  std::printf("  \"address\": \"%s\",\n", address);
+  std::printf("  \"pass_through\": %s,\n",
+              server.pass_through ? "true" : "false");
+  std::printf("  \"stages\": [\n");
+  for (int stage = 0; stage < N_OF_STAGES; stage++) {
+    LatencySummary s = summarize(samples[stage]);
+    std::fprintf(stderr, "%-16s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                 stage_names[stage], s.min_us, s.p50_us, s.p90_us, s.p99_us,
+                 s.max_us, s.mean_us);
+    std::printf(
+        "    {\"name\": \"%s\", \"min_us\": %.2f, \"p50_us\": %.2f, "
+        "\"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f, "
+        "\"mean_us\": %.2f}%s\n",
+        stage_names[stage], s.min_us, s.p50_us, s.p90_us, s.p99_us, s.max_us,
+        s.mean_us, stage + 1 < N_OF_STAGES ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include "alloc_check.h"
+
+#include "alloc_tracker.h"
+#include "client_lib.h"
+#include "common.h"
+#include "game.h"
+#include "input_script.h"
+
+namespace darena {
+
+bool run_allocation_check(int warmup_frames, int frames) {
+  if (!allocation_tracking_enabled()) {
+    darena::log << "Allocation tracking is disabled, rebuild with "
+                   "-DDARENA_ALLOC_TRACKING=ON\n";
+    return false;
+  }
+
+  // Same setup as after the server handshake, with local heightmaps
+  Game game;
+  game.id = 0;
+  game.my_turn = true;
+  game.left_island = std::make_unique<darena::Island>(
+      left_island_starting_position,
+      game.generate(left_island_starting_position, ISLAND_NUM_OF_POINTS));
+  game.right_island = std::make_unique<darena::Island>(
+      right_island_starting_position,
+      game.generate(right_island_starting_position, ISLAND_NUM_OF_POINTS));
+  game.left_island->rebuild_island_mesh();
+  game.right_island->rebuild_island_mesh();
+
+  game.player = std::make_unique<darena::Player>(
+      left_island_starting_position.x + 40, 100, 25, 25);
+  game.player->heightmap = &game.left_island->heightmap;
+  game.enemy = std::make_unique<darena::Enemy>(
+      right_island_starting_position.x + ISLAND_WIDTH - 40, 100, 25, 25);
+  game.enemy->heightmap = &game.right_island->heightmap;
+  game.set_state(GameStateId::PLAY_TURN);
+  game.apply_pending_state();
+
+  int failed_frames = 0;
+  AllocationScope frame_allocations;
+  for (int frame = 0; frame < warmup_frames + frames; frame++) {
+    frame_allocations.restart();
+
+    play_input_script(game, walk_and_aim_script, frame);
+    game.update(FIXED_TIMESTEP);
+
+    uint64_t allocations = frame_allocations.allocations();
+    if (frame >= warmup_frames && allocations > 0) {
+      failed_frames++;
+      darena::log << "Frame " << frame << " allocated " << allocations
+                  << " times\n";
+    }
+  }
+
+  if (failed_frames) {
+    darena::log << "Allocation check failed, " << failed_frames << " of "
+                << frames << " steady state frames allocated\n";
+    return false;
+  }
+
+  darena::log << "Allocation check passed, " << frames
+              << " steady state frames without allocations\n";
+  return true;
+}
+
+}  // namespace darena
@@ -0,0 +1,17 @@
+#pragma once
+
+// Frames played before measuring, covers landing on the island and the first
+// pass over the input script
+#define ALLOC_CHECK_WARMUP_FRAMES 240
+#define ALLOC_CHECK_FRAMES 600
+
+namespace darena {
+
+// Plays a scripted turn on a local game without a window or a server and fails
+// if any frame after the warm up allocates on the heap. Needs a build with
+// DARENA_ALLOC_TRACKING, fails otherwise. Run with
+// `DuelArenaClient --alloc-check`.
+bool run_allocation_check(int warmup_frames = ALLOC_CHECK_WARMUP_FRAMES,
+                          int frames = ALLOC_CHECK_FRAMES);
+
+}  // namespace darena
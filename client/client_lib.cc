@@ -1,47 +1,18 @@
 #include "client_lib.h"
 
-#include <SDL_net.h>
-
 namespace darena {
 
 bool TCPClient::initialize() {
-  const char* server_ip_cc = server_ip_string.c_str();
-  if (SDLNet_ResolveHost(&server_ip, server_ip_cc, DARENA_PORT) == -1) {
-    darena::log << "SDLNet_ResolveHost Error: " << SDLNet_GetError() << "\n";
-    return false;
-  }
-
-  client_communication_socket = SDLNet_TCP_Open(&server_ip);
-  if (!client_communication_socket) {
-    darena::log << "SDLNet_TCP_Open Error: " << SDLNet_GetError() << "\n";
-    return false;
-  }
-
-  return true;
+  connection = darena::connect(server_ip_string);
+  return connection != nullptr;
 }
 
-bool TCPClient::send_connection_request() {
-  darena::ClientConnectionRequest message{username};
-  msgpack::sbuffer buffer;
-  msgpack::pack(buffer, message);
-
-  uint32_t message_size = htonl(buffer.size());
-  int result = SDLNet_TCP_Send(client_communication_socket, &message_size,
-                               sizeof(message_size));
-  if (result < sizeof(message_size)) {
-    darena::log << "SDLNet_TCP_Send Error, len=" << result
-                << "\nError: " << SDLNet_GetError() << "\n";
-    return false;
-  }
+bool TCPClient::send_connection_request(uint64_t resume_token) {
+  darena::ClientConnectionRequest request{username, resume_token};
+  darena::encode_message(request, send_buffer);
 
-  message_size = ntohl(message_size);
-  darena::log << "Sent message length (" << message_size << ") to server\n";
-
-  result = SDLNet_TCP_Send(client_communication_socket, buffer.data(),
-                           buffer.size());
-  if (result < buffer.size()) {
-    darena::log << "SDLNet_TCP_Send Error, len=" << result
-                << "\nError: " << SDLNet_GetError() << "\n";
+  if (!connection->send(send_buffer)) {
+    darena::log << "Send error to server\n";
     return false;
   }
   darena::log << "Sent message to server.\n";
@@ -49,105 +20,87 @@ bool TCPClient::send_connection_request() {
 }
 
 bool TCPClient::wait_for_message() {
-  bool socket_ready = false;
-  SDLNet_SocketSet socket_set = SDLNet_AllocSocketSet(1);
-  if (!socket_set) {
-    darena::log << "SDLNet_AllocSocketSet Error: " << SDLNet_GetError() << "\n";
-    return false;
-  }
-
-  SDLNet_TCP_AddSocket(socket_set, client_communication_socket);
-
-  while (!socket_ready) {
-    darena::log << "Waiting for message...\n";
-    if (!SDLNet_CheckSockets(socket_set, DARENA_CONNECTION_AWAIT)) {
-      // Wait for DARENA_CONNECTION_AWAIT ms before checking connection again
-      continue;
+  darena::log << "Waiting for message...\n";
+  // Sleeps until the server sends something or the connection breaks, a
+  // broken connection fails the receive that follows. Wakes up to ping and
+  // to check for a cancel.
+  while (!connection->wait_readable(CLIENT_WAIT_SLICE)) {
+    if (cancelled) {
+      darena::log << "Waiting for the server was cancelled\n";
+      return false;
     }
-
-    // Log the server IP and port
-    IPaddress* server_ip_address =
-        SDLNet_TCP_GetPeerAddress(client_communication_socket);
-    if (!server_ip_address) {
-      darena::log << "SDLNet_TCP_GetPeerAddress Error: " << SDLNet_GetError()
-                  << "\n";
+    if (!keep_alive()) {
       return false;
     }
-
-    darena::log << "Incoming message from "
-                << ipaddress_to_string(server_ip_address) << "\n";
-
-    socket_ready = true;
   }
+  keep_alive();
 
-  SDLNet_FreeSocketSet(socket_set);
+  darena::log << "Incoming message from " << connection->peer_name() << "\n";
   return true;
 }
 
-std::optional<msgpack::unpacked> TCPClient::get_response() {
-  // Read the message length first
-  uint32_t message_size;
-  int len = SDLNet_TCP_Recv(client_communication_socket, &message_size,
-                            sizeof(message_size));
-  if (!len) {
-    darena::log << "SDLNet_TCP_Recv Error, len=" << len
-                << "\nError: " << SDLNet_GetError() << "\n ";
-    return {};
+bool TCPClient::keep_alive() {
+  // A message that arrived is kept for the next receive
+  connection->wait_readable(0);
+  uint64_t now = SDL_GetTicks64();
+  if (now - last_ping_at >= DARENA_PING_INTERVAL) {
+    connection->send_ping();
+    last_ping_at = now;
   }
-  message_size = ntohl(message_size);
-  darena::log << "Next message size: " << message_size << "\n";
-
-  // Allocate buffer for the message
-  std::vector<char> message(message_size);
-  len = SDLNet_TCP_Recv(client_communication_socket, message.data(),
-                        message_size);
-  if (!len) {
-    darena::log << "SDLNet_TCP_Recv Error, len=" << len
-                << "\nError: " << SDLNet_GetError() << "\n ";
-    return {};
+  {
+    std::lock_guard lock(link_stats_mutex);
+    last_link_stats = connection->link_stats();
   }
-  darena::log << "Received a message from the server.\n";
-
-  try {
-    msgpack::unpacked result;
-    msgpack::unpack(result, message.data(), message_size);
-    return result;
-  } catch (const std::exception& e) {
-    darena::log << "Message unpack error: " << e.what() << "\n";
-    return {};
+
+  if (connection->is_broken()) {
+    darena::log << "The connection to the server broke\n";
+    return false;
   }
+  if (connection->silent_ms() > DARENA_PEER_TIMEOUT) {
+    darena::log << "The server went silent\n";
+    return false;
+  }
+  return true;
 }
 
-bool TCPClient::send_turn_data(std::unique_ptr<darena::ClientTurn> turn_data) {
-  msgpack::sbuffer buffer;
-  msgpack::pack(buffer, *turn_data);
-
-  uint32_t message_size = htonl(buffer.size());
-  int result = SDLNet_TCP_Send(client_communication_socket, &message_size,
-                               sizeof(message_size));
-  if (result < sizeof(message_size)) {
-    darena::log << "SDLNet_TCP_Send Error, len=" << result
-                << "\nError: " << SDLNet_GetError() << "\n";
-    return false;
+bool TCPClient::pause(int delay_ms) {
+  for (int waited = 0; waited < delay_ms; waited += CLIENT_WAIT_SLICE) {
+    if (cancelled) {
+      return false;
+    }
+    SDL_Delay(CLIENT_WAIT_SLICE);
   }
+  return !cancelled;
+}
 
-  message_size = ntohl(message_size);
-  darena::log << "Sent message length (" << message_size << ") to server\n";
+darena::LinkStats TCPClient::link_stats() const {
+  std::lock_guard lock(link_stats_mutex);
+  return last_link_stats;
+}
 
-  result = SDLNet_TCP_Send(client_communication_socket, buffer.data(),
-                           buffer.size());
-  if (result < buffer.size()) {
-    darena::log << "SDLNet_TCP_Send Error, len=" << result
-                << "\nError: " << SDLNet_GetError() << "\n";
+bool TCPClient::send_turn_data(std::unique_ptr<darena::ClientTurn> turn_data) {
+  darena::encode_message(*turn_data, send_buffer);
+  last_packed_at = SDL_GetPerformanceCounter();
+
+  if (!connection->send(send_buffer)) {
+    darena::log << "Send error to server\n";
     return false;
   }
   darena::log << "Sent message to server.\n";
   return true;
 }
 
-void TCPClient::cleanup() {
-  SDLNet_TCP_Close(client_communication_socket);
-  SDLNet_Quit();
+bool TCPClient::send_turn_batch(const darena::TurnInputBatch& batch) {
+  darena::encode_message(batch, send_buffer);
+  last_packed_at = SDL_GetPerformanceCounter();
+
+  if (!connection->send(send_buffer)) {
+    darena::log << "Send error to server\n";
+    return false;
+  }
+  return true;
 }
 
+void TCPClient::cleanup() { connection.reset(); }
+
 }  // namespace darena
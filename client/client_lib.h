@@ -1,13 +1,14 @@
 #pragma once
 
 #include <SDL_net.h>
-#include <msgpack/sbuffer.h>
 
-#include <optional>
+#include <atomic>
+#include <mutex>
 #include <vector>
 
+#include "codec.h"
 #include "common.h"
-#include "msgpack.hpp"
+#include "transport.h"
 
 #define FONT_SIZE 16
 
@@ -15,27 +16,68 @@
 
 #define FIXED_TIMESTEP 1.0f / (TARGET_FPS * 1.0f)
 
+// Longest wait_for_message() sleeps before checking TCPClient::cancelled, in ms
+#define CLIENT_WAIT_SLICE 100
+
+// Delay before connecting again after a failed attempt, doubling up to
+// CLIENT_RETRY_MAX_DELAY, in ms
+#define CLIENT_RETRY_DELAY 250
+#define CLIENT_RETRY_MAX_DELAY 4000
+
 namespace darena {
 
 // TODO: This should maybe be a class with the network stuff being private
+// Named after its original backend, server_ip_string is any address accepted
+// by darena::connect()
 struct TCPClient {
   std::string server_ip_string;  // TODO: This should be passed as an argument
                                  // in the functon
   std::string username;          // TODO: This too
-  IPaddress server_ip;           // TODO: This too
-  TCPsocket client_communication_socket;
+  std::unique_ptr<darena::Connection> connection;
+  // Reused for every incoming and outgoing message
+  std::vector<char> message;
+  std::vector<uint8_t> send_buffer;
+  // SDL_GetPerformanceCounter() when the last turn finished serializing and
+  // when the last response finished arriving, used to profile turn latency
+  uint64_t last_packed_at = 0;
+  uint64_t last_received_at = 0;
+  // SDL_GetTicks64() when the server was last pinged
+  uint64_t last_ping_at = 0;
+  // The connection's LinkStats as of the last keep_alive(), read by the debug
+  // overlay while a job thread may be using the connection
+  mutable std::mutex link_stats_mutex;
+  darena::LinkStats last_link_stats;
+  // Set by another thread to make wait_for_message() give up
+  std::atomic_bool cancelled{false};
 
   TCPClient(const std::string& server_ip_string, const std::string& username)
-      : server_ip_string(server_ip_string),
-        username(username),
-        server_ip(),
-        client_communication_socket(nullptr) {}
+      : server_ip_string(server_ip_string), username(username) {}
 
   bool initialize();
-  bool send_connection_request();
+  // A resume_token from an earlier ServerIDHeightmapsResponse asks for that
+  // seat back
+  bool send_connection_request(uint64_t resume_token = 0);
+  // Waits for the next message while keeping the connection alive. Returns
+  // false if the server went silent for DARENA_PEER_TIMEOUT or the wait was
+  // cancelled.
   bool wait_for_message();
-  std::optional<msgpack::unpacked> get_response();
+  // Answers the server's pings, reads its pongs and pings it every
+  // DARENA_PING_INTERVAL, never waiting. wait_for_message() does it while
+  // waiting, states using the connection on the main thread every frame.
+  // Returns false if the connection broke or the server went silent for
+  // DARENA_PEER_TIMEOUT.
+  bool keep_alive();
+  // Sleeps for delay_ms, false if cancelled meanwhile
+  bool pause(int delay_ms);
+  darena::LinkStats link_stats() const;
+  // Reads the next message and decodes it into out, see decode_message()
+  template <typename T>
+  bool receive_message(T& out);
   bool send_turn_data(std::unique_ptr<darena::ClientTurn> turn_data);
+  bool send_turn_batch(const darena::TurnInputBatch& batch);
+  // Encodes and sends any protocol message, see encode_message()
+  template <typename T>
+  bool send_message(const T& message);
   void cleanup();
 
   std::vector<darena::IslandPoint> convert_data_to_island_point();
@@ -43,4 +85,30 @@ struct TCPClient {
 
 std::vector<darena::IslandPoint> create_heightmap(int num_of_points);
 
+template <typename T>
+bool TCPClient::receive_message(T& out) {
+  if (!connection->receive(message)) {
+    darena::log << "Receive error from server\n";
+    return false;
+  }
+  last_received_at = SDL_GetPerformanceCounter();
+  darena::log << "Received a message from the server.\n";
+
+  if (!darena::decode_message(message.data(), message.size(), out)) {
+    darena::log << "Message decode error\n";
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+bool TCPClient::send_message(const T& message) {
+  darena::encode_message(message, send_buffer);
+  if (!connection->send(send_buffer)) {
+    darena::log << "Send error to server\n";
+    return false;
+  }
+  return true;
+}
+
 }  // namespace darena
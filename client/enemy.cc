@@ -2,6 +2,7 @@
 
 #include <SDL_opengl.h>
 
+#include <chrono>
 #include <mutex>
 #include <thread>
 
@@ -11,20 +12,51 @@ namespace darena {
 
 void Enemy::process_input(darena::Game* game, SDL_Event* e) {}
 
+bool Enemy::next_movement(int& movement) {
+  if (stream) {
+    return stream->wait_movement(movement_index, movement);
+  }
+  if (movement_index >= current_turn_data->movements.size()) {
+    return false;
+  }
+  movement = current_turn_data->movements[movement_index];
+  return true;
+}
+
+bool Enemy::wait_for_update(std::unique_lock<std::mutex>& lock) {
+  action_cv.wait(lock, [this] { return action_finished.load() || stopping; });
+  return !stopping;
+}
+
+void Enemy::stop() {
+  {
+    std::lock_guard lock(simulation_mutex);
+    stopping = true;
+  }
+  action_cv.notify_one();
+  if (simulation.joinable()) {
+    simulation.join();
+  }
+  stopping = false;
+}
+
 void Enemy::simulation_thread() {
-  if (!current_turn_data) {
+  if (!current_turn_data && !stream) {
     darena::log << "current_turn_data not set!\n";
     return;
   }
 
-  while (movement_index < current_turn_data->movements.size()) {
+  int movement;
+  while (next_movement(movement)) {
     {
       // Wait for update() to be ready
       std::unique_lock lock(simulation_mutex);
-      action_cv.wait(lock, [this] { return action_finished.load(); });
+      if (!wait_for_update(lock)) {
+        return;
+      }
 
       current_action = CurrentAction::MOVING;
-      move_x = current_turn_data->movements[movement_index];
+      move_x = movement;
 
       // Signal to update() that it has a new action
       action_finished = false;
@@ -32,22 +64,48 @@ void Enemy::simulation_thread() {
     {
       // Wait for update() to finish current action
       std::unique_lock lock(simulation_mutex);
-      action_cv.wait(lock, [this] { return action_finished.load(); });
+      if (!wait_for_update(lock)) {
+        return;
+      }
       movement_index++;
     }
   }
 
-  while (!are_equal(position.x, current_turn_data->final_position.x)) {
+  if (stream) {
+    current_turn_data = stream->take_turn();
+    stream = nullptr;
+  }
+  // The connection broke mid-turn. It stays simulating, the match is resumed
+  // and start_match() replaces the enemy.
+  if (!current_turn_data) {
+    darena::log << "The streamed turn broke off\n";
+    return;
+  }
+
+  // Float physics drifts from the original turn and is snapped back, fixed
+  // point replays it exactly
+  if (!DARENA_FIXED_POINT_PHYSICS) {
     position.x = current_turn_data->final_position.x;
+  } else if (position.x != current_turn_data->final_position.x) {
+    darena::log << "Replay ended at " << position.x << " instead of "
+                << current_turn_data->final_position.x << "\n";
   }
 
   // Wait 1 second
-  usleep(1000 * 1000);
+  {
+    std::unique_lock lock(simulation_mutex);
+    if (action_cv.wait_for(lock, std::chrono::seconds(1),
+                           [this] { return stopping; })) {
+      return;
+    }
+  }
 
   while (shot_angle_index < current_turn_data->angle_changes.size()) {
     {
       std::unique_lock lock(simulation_mutex);
-      action_cv.wait(lock, [this] { return action_finished.load(); });
+      if (!wait_for_update(lock)) {
+        return;
+      }
 
       current_action = CurrentAction::AIMING;
       move_y = current_turn_data->angle_changes[shot_angle_index];
@@ -56,7 +114,9 @@ void Enemy::simulation_thread() {
     }
     {
       std::unique_lock lock(simulation_mutex);
-      action_cv.wait(lock, [this] { return action_finished.load(); });
+      if (!wait_for_update(lock)) {
+        return;
+      }
       shot_angle_index++;
     }
   }
@@ -64,7 +124,9 @@ void Enemy::simulation_thread() {
   if (!shot_initiated) {
     {
       std::unique_lock lock(simulation_mutex);
-      action_cv.wait(lock, [this] { return action_finished.load(); });
+      if (!wait_for_update(lock)) {
+        return;
+      }
 
       current_action = CurrentAction::SHOOTING;
       shot_power = current_turn_data->shot_power;
@@ -74,7 +136,9 @@ void Enemy::simulation_thread() {
     }
     {
       std::unique_lock lock(simulation_mutex);
-      action_cv.wait(lock, [this] { return action_finished.load(); });
+      if (!wait_for_update(lock)) {
+        return;
+      }
       shot_initiated = true;
     }
   }
@@ -89,8 +153,10 @@ void Enemy::start_simulation(std::unique_ptr<darena::ClientTurn> turn_data) {
   if (is_simulating.load()) {
     darena::log << "Already simulating enemy movement!\n";
   }
+  stop();
 
   current_turn_data = std::move(turn_data);
+  stream = nullptr;
   current_action = CurrentAction::IDLE;
   movement_index = 0;
   shot_angle_index = 0;
@@ -98,7 +164,39 @@ void Enemy::start_simulation(std::unique_ptr<darena::ClientTurn> turn_data) {
   action_finished.store(true);
   is_simulating.store(true);
 
-  std::thread([this]() { this->simulation_thread(); }).detach();
+  simulation = std::thread([this]() { this->simulation_thread(); });
+}
+
+void Enemy::start_streamed_simulation(darena::TurnStream* turn_stream) {
+  if (is_simulating.load()) {
+    darena::log << "Already simulating enemy movement!\n";
+  }
+  stop();
+
+  current_turn_data.reset();
+  stream = turn_stream;
+  current_action = CurrentAction::IDLE;
+  movement_index = 0;
+  shot_angle_index = 0;
+  shot_initiated = false;
+  action_finished.store(true);
+  is_simulating.store(true);
+
+  simulation = std::thread([this]() { this->simulation_thread(); });
+}
+
+void Enemy::show_state(const darena::Vec2& new_position, float tilt,
+                       float new_shot_angle, float new_shot_power) {
+  position = new_position;
+  angle_rad = tilt;
+  shot_angle = new_shot_angle;
+  shot_power = new_shot_power;
+}
+
+void Enemy::set_shot(float new_shot_angle, float new_shot_power) {
+  shot_angle = new_shot_angle;
+  shot_angle_should_be = new_shot_angle;
+  shot_power = new_shot_power;
 }
 
 void Enemy::update(darena::Game* game, float delta_time) {
@@ -107,7 +205,7 @@ void Enemy::update(darena::Game* game, float delta_time) {
     if (current_y_speed >= max_y_speed) {
       current_y_speed = max_y_speed;
     }
-    position.y += current_y_speed;
+    position.y = darena::to_float(darena::Real(position.y) + current_y_speed);
     if (position.y >= WINDOW_HEIGHT && !game->my_turn) {
       shot_angle = 0;
       shot_power = -1;
@@ -117,50 +215,12 @@ void Enemy::update(darena::Game* game, float delta_time) {
     current_y_speed = 0;
   }
 
-  auto closest_it = heightmap->begin();
-  float closest_distance =
-      ISLAND_POINT_EVERY;  // If >= ISLAND_POINT_EVERY / 2 then the player is
-                           // off the island
-  for (auto it = heightmap->begin(); it != heightmap->end(); it++) {
-    Vec2 point = it->position;
-    float distance = point.x - position.x;
-    if (std::fabs(distance) < std::fabs(closest_distance)) {
-      closest_it = it;
-      closest_distance = distance;
-    }
-  }
-
-  Vec2 closest = closest_it->position;
-  Vec2 snd_closest = closest;
-  if (closest_distance < 0 && closest_it != heightmap->begin()) {
-    snd_closest = (*(--closest_it)).position;
-  } else if (closest_distance > 0 &&
-             std::next(closest_it) != heightmap->end()) {
-    snd_closest = (*(++closest_it)).position;
-  }
-  // Else closest_distance is 0 (exactly in the middle of a point), or player is
-  // falling
-
-  if (position.y + height / 2.0f < closest.y ||
-      closest_distance > ISLAND_POINT_EVERY / 2.0f ||
-      closest.y >= (float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT)) {
-    falling = true;
-  } else {
-    falling = false;
-  }
-
-  float slope = 0.0f;
-  if (!are_equal(closest.x, snd_closest.x) && !falling) {
-    slope = (snd_closest.y - closest.y) / (snd_closest.x - closest.x);
-    angle_rad = std::atan(slope) / 2.0f;
-  } else {
-    angle_rad = 0.0f;
-  }
-
-  if (!falling && !are_equal(slope, 0.0f)) {
-    float y_intercept = closest.y - slope * closest.x;
-    float y_point = slope * position.x + y_intercept;
-    position.y = std::round(y_point) - height / 2.0f + 5;
+  darena::GroundContact contact =
+      darena::ground_contact(*heightmap, position.x, position.y, height);
+  falling = contact.falling;
+  angle_rad = darena::to_float(contact.tilt);
+  if (contact.on_slope) {
+    position.y = darena::to_float(contact.y);
   }
 
   if (is_simulating.load() && !action_finished.load()) {
@@ -173,30 +233,21 @@ void Enemy::update(darena::Game* game, float delta_time) {
           current_x_speed = move_x * move_speed;
           zero_movement_counter = 0;
         } else {
-          if (are_equal(current_x_speed, 0.0f)) {
-            current_x_speed = 0;
-          } else {
-            int multiplier = 1;
-            if (current_x_speed < 0) {
-              multiplier = -1;
-            }
-
-            current_x_speed -= multiplier * deacceleration_x * FIXED_TIMESTEP;
-            zero_movement_counter++;
-            // current_x_speed = 0;
-            if (zero_movement_counter >= MAX_N_OF_ZERO_IN_MOVEMENT) {
-              current_x_speed = 0;
-            }
-          }
+          current_x_speed = darena::decelerate(
+              current_x_speed, deacceleration_x * FIXED_TIMESTEP,
+              zero_movement_counter);
         }
-        position.x += current_x_speed * FIXED_TIMESTEP;
+        position.x = darena::to_float(darena::Real(position.x) +
+                                      current_x_speed * FIXED_TIMESTEP);
         finished_frame = true;
         break;
       }
       case CurrentAction::AIMING: {
         darena::log << "Aiming\n";
-        shot_angle += move_y * shot_angle_change_speed * FIXED_TIMESTEP;
-        shot_angle = std::clamp(shot_angle, min_shot_angle, max_shot_angle);
+        darena::Real angle = darena::Real(shot_angle) +
+                             move_y * shot_angle_change_speed * FIXED_TIMESTEP;
+        shot_angle = darena::to_float(
+            std::clamp<darena::Real>(angle, min_shot_angle, max_shot_angle));
         finished_frame = true;
         break;
       }
@@ -209,13 +260,14 @@ void Enemy::update(darena::Game* game, float delta_time) {
         }
 
         if (!shot) {
-          game->projectile = std::make_unique<darena::Projectile>(
-              position.x, position.y, shot_angle, shot_power, shot_direction,
-              true);
+          game->projectile.emplace(position.x, position.y, shot_angle,
+                                   shot_power, shot_direction, true);
           shot = true;
         }
 
-        if (game->projectile == nullptr) {
+        if (!game->projectile) {
+          // The shooter's crater replaces the one simulated here
+          game->apply_terrain_deltas(current_turn_data->terrain_deltas);
           shot = false;
           finished_frame = true;
         }
@@ -1,8 +1,13 @@
 #pragma once
 
 #include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "common.h"
+#include "physics.h"
+#include "state_hash.h"
+#include "turn_stream.h"
 
 namespace darena {
 
@@ -14,12 +19,15 @@ class Enemy {
   int cannon_height;
   int move_speed = 100;
   std::unique_ptr<darena::ClientTurn> current_turn_data;
+  // Set while playing a streamed turn, movements are read from it as they
+  // arrive and current_turn_data is taken from it once they ran out
+  darena::TurnStream* stream = nullptr;
 
-  float gravity = 4.91f;
-  float current_y_speed = 0.0f;
-  float current_x_speed = 0.0f;
-  float max_y_speed = 1000;
-  float deacceleration_x = 500;
+  darena::Real gravity = 4.91f;
+  darena::Real current_y_speed = 0.0f;
+  darena::Real current_x_speed = 0.0f;
+  darena::Real max_y_speed = 1000;
+  darena::Real deacceleration_x = 500;
 
   int zero_movement_counter = 0;
 
@@ -27,13 +35,14 @@ class Enemy {
 
   float shot_angle = M_PI / 4.0f;
   float shot_angle_should_be = M_PI / 4.0f;
-  float shot_angle_change_speed = 3;
-  float min_shot_angle = 0.0f;
-  float max_shot_angle = M_PI / 2.0f;
+  darena::Real shot_angle_change_speed = 3;
+  darena::Real min_shot_angle = 0.0f;
+  darena::Real max_shot_angle = M_PI / 2.0f;
 
   float shot_power = 0.0f;
 
   void simulation_thread();
+  bool next_movement(int& movement);
   size_t movement_index = 0;
   size_t shot_angle_index = 0;
   bool shot_initiated = false;
@@ -43,6 +52,11 @@ class Enemy {
   std::atomic_bool action_finished{
       true};  // True if update() finished last requested step
   std::mutex simulation_mutex;
+  // Runs simulation_thread(), stopping under simulation_mutex ends it
+  std::thread simulation;
+  bool stopping = false;
+  // Waits until update() finished the last action, false once stopping
+  bool wait_for_update(std::unique_lock<std::mutex>& lock);
   int move_x = 0;
   int move_y = 0;
   bool shot = false;
@@ -61,11 +75,24 @@ class Enemy {
     cannon_width = width * 1;
     cannon_height = height / 2;
   };
+  ~Enemy() { stop(); }
 
   void process_input(darena::Game* game, SDL_Event* e);
   void update(darena::Game* game, float delta_time);
   void render(darena::Game* game);
   void start_simulation(std::unique_ptr<darena::ClientTurn> turn_data);
+  void start_streamed_simulation(darena::TurnStream* turn_stream);
+  // Ends and joins the simulation thread. A thread waiting for a streamed
+  // movement only returns once that stream is aborted.
+  void stop();
+  // Shows a state simulated elsewhere, for the real-time mode
+  void show_state(const darena::Vec2& new_position, float tilt,
+                  float new_shot_angle, float new_shot_power);
+  // Aims as the enemy's last turn left it, for a resumed match
+  void set_shot(float new_shot_angle, float new_shot_power);
+  uint64_t state_hash() const {
+    return darena::hash_tank(position.x, shot_angle, shot_power);
+  }
 };
 
 }  // namespace darena
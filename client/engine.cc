@@ -3,6 +3,7 @@
 #include <SDL_opengl.h>
 #include <SDL_video.h>
 
+#include "alloc_tracker.h"
 #include "client_lib.h"
 #include "common.h"
 #include "game_state.h"
@@ -129,7 +130,9 @@ bool Engine::run() {
   game->username = "Player";
   game->server_ip = "127.0.0.1";
 
+  darena::AllocationScope frame_allocations;
   while (game_running) {
+    frame_allocations.restart();
     process_input();
 
     ImGuiIO& io = ImGui::GetIO();
@@ -145,6 +148,13 @@ bool Engine::run() {
       return false;
     }
 
+    if (DARENA_SHOW_ALLOCATIONS) {
+      render_allocation_overlay();
+    }
+    if (DARENA_SHOW_NETWORK) {
+      render_network_overlay();
+    }
+
     // Render ImGui
     ImGui::Render();
     glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
@@ -153,6 +163,9 @@ bool Engine::run() {
     // Swap the window
     SDL_GL_SwapWindow(window);
 
+    last_frame_allocations = frame_allocations.allocations();
+    last_frame_bytes_allocated = frame_allocations.bytes_allocated();
+
     // Frame limiting
     SDL_Delay(1000 * (1.0 / TARGET_FPS));
 
@@ -167,6 +180,53 @@ bool Engine::run() {
   return true;
 }
 
+void Engine::render_allocation_overlay() {
+  ImVec2 viewport_size = ImGui::GetMainViewport()->Size;
+  ImVec2 window_pos = ImVec2(viewport_size.x * 0.75f, viewport_size.y * 0.05f);
+
+  ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always);
+
+  ImGuiWindowFlags window_flags =
+      ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
+      ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoCollapse |
+      ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoSavedSettings |
+      ImGuiWindowFlags_AlwaysAutoResize;
+
+  ImGui::Begin("Allocation Overlay", nullptr, window_flags);
+  ImGui::Text("ALLOCS/FRAME: %llu\nBYTES/FRAME: %llu",
+              (unsigned long long)last_frame_allocations,
+              (unsigned long long)last_frame_bytes_allocated);
+  ImGui::End();
+}
+
+void Engine::render_network_overlay() {
+  darena::LinkStats stats = game->client.link_stats();
+  if (stats.n_of_pings == 0) {
+    return;
+  }
+
+  ImVec2 viewport_size = ImGui::GetMainViewport()->Size;
+  ImVec2 window_pos = ImVec2(viewport_size.x * 0.75f, viewport_size.y * 0.15f);
+
+  ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always);
+
+  ImGuiWindowFlags window_flags =
+      ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
+      ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoCollapse |
+      ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoSavedSettings |
+      ImGuiWindowFlags_AlwaysAutoResize;
+
+  ImGui::Begin("Network Overlay", nullptr, window_flags);
+  if (stats.n_of_samples == 0) {
+    ImGui::Text("RTT: -\nPONGS: %d/%d", stats.n_of_pongs, stats.n_of_pings);
+  } else {
+    ImGui::Text("RTT: %.1f MS (MIN %.1f)\nJITTER: %.1f MS\nPONGS: %d/%d",
+                stats.srtt_us / 1000, stats.min_rtt_us / 1000.0,
+                stats.jitter_us / 1000, stats.n_of_pongs, stats.n_of_pings);
+  }
+  ImGui::End();
+}
+
 void Engine::cleanup() {
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplSDL2_Shutdown();
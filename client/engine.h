@@ -6,6 +6,20 @@
 
 #include "game.h"
 
+// Per-frame allocation counts on screen, debug builds with allocation tracking
+#if DARENA_ALLOC_TRACKING && !defined(NDEBUG)
+#define DARENA_SHOW_ALLOCATIONS 1
+#else
+#define DARENA_SHOW_ALLOCATIONS 0
+#endif
+
+// Round trip times to the server on screen, debug builds
+#ifndef NDEBUG
+#define DARENA_SHOW_NETWORK 1
+#else
+#define DARENA_SHOW_NETWORK 0
+#endif
+
 namespace darena {
 
 struct Engine {
@@ -15,6 +29,8 @@ struct Engine {
   bool game_running;
   uint64_t last_frame_time;
   float fps;
+  uint64_t last_frame_allocations = 0;
+  uint64_t last_frame_bytes_allocated = 0;
 
   Engine()
       : window(nullptr),
@@ -40,6 +56,12 @@ struct Engine {
   // Render function with draw calls
   bool render();
 
+  // Allocation counts of the previous frame, see DARENA_SHOW_ALLOCATIONS
+  void render_allocation_overlay();
+
+  // The connection's LinkStats, see DARENA_SHOW_NETWORK
+  void render_network_overlay();
+
   // Cleanup function that destroys the window and renderer
   void cleanup();
 };
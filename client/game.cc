@@ -3,19 +3,134 @@
 #include <SDL_opengl.h>
 
 #include <random>
+#include <thread>
 
 #include "client_lib.h"
 #include "common.h"
+#include "keyframe.h"
+#include "terrain_delta.h"
 
 namespace darena {
 
-void Game::set_state(std::unique_ptr<GameState> new_state) {
-  state = std::move(new_state);
+Game::~Game() {
+  // Wakes everything waiting on the connection or the stream before joining
+  client.cancelled = true;
+  turn_stream.abort();
+  if (job_thread.joinable()) {
+    job_thread.join();
+  }
+  join_stream_receiver();
+  enemy.reset();
+  client.cleanup();
+}
+
+void Game::set_state(GameStateId new_state) { pending_state = new_state; }
+
+void Game::apply_pending_state() {
+  if (!pending_state) {
+    return;
+  }
+
+  GameStateId from = state_id();
+  GameStateId to = *pending_state;
+  pending_state.reset();
+  // The job points to the state being replaced
+  stop_job();
+
+  switch (to) {
+    case GameStateId::INITIAL:
+      state.emplace<GSInitial>();
+      break;
+    case GameStateId::CONNECTING:
+      state.emplace<GSConnecting>();
+      break;
+    case GameStateId::WAITING_FOR_ISLAND_DATA:
+      state.emplace<GSWaitingForIslandData>();
+      break;
+    case GameStateId::CONNECTED:
+      state.emplace<GSConnected>();
+      break;
+    case GameStateId::PLAY_TURN:
+      state.emplace<GSPlayTurn>();
+      break;
+    case GameStateId::SHOOT_PROJECTILE:
+      state.emplace<GSShootProjectile>();
+      break;
+    case GameStateId::WAIT_TURN:
+      state.emplace<GSWaitTurn>();
+      break;
+    case GameStateId::SIMULATE_TURN:
+      state.emplace<GSSimulateTurn>();
+      break;
+    case GameStateId::WON_GAME:
+      state.emplace<GSWonGame>();
+      break;
+    case GameStateId::LOSE_GAME:
+      state.emplace<GSLoseGame>();
+      break;
+    case GameStateId::REALTIME_MATCH:
+      state.emplace<GSRealtimeMatch>();
+      break;
+  }
+
+  uint64_t now = SDL_GetPerformanceCounter();
+  transition_log[n_of_transitions % STATE_TRANSITION_LOG_SIZE] = {from, to,
+                                                                  now};
+  n_of_transitions++;
+
+  if (print_state_transitions) {
+    uint64_t time_in_state_us =
+        (now - state_entered_at) * 1000000 / SDL_GetPerformanceFrequency();
+    darena::log << "State " << game_state_name(from) << " -> "
+                << game_state_name(to) << " after " << time_in_state_us
+                << " us\n";
+  }
+  state_entered_at = now;
+}
+
+GameStateId Game::state_id() const {
+  return static_cast<GameStateId>(state.index());
+}
+
+void Game::start_job(std::function<void()> job) {
+  stop_job();
+  job_running = true;
+  job_thread = std::thread([this, job = std::move(job)]() {
+    job();
+    job_running = false;
+  });
+}
+
+void Game::stop_job() {
+  if (job_running) {
+    client.cancelled = true;
+  }
+  if (job_thread.joinable()) {
+    job_thread.join();
+  }
+  client.cancelled = false;
+}
+
+void Game::join_stream_receiver() {
+  if (stream_receiver.joinable()) {
+    stream_receiver.join();
+  }
+}
+
+void Game::lose_connection() {
+  darena::log << "Lost the connection, resuming the match\n";
+  if (reconnect_deadline == 0) {
+    reconnect_deadline = SDL_GetTicks64() + DARENA_RESUME_TIMEOUT;
+  }
+  set_state(GameStateId::CONNECTING);
 }
 
 bool Game::connect_to_server() {
   bool noerr;
 
+  // It may still hold the connection being replaced
+  join_stream_receiver();
+
   darena::log << "Connecting to server " << server_ip << " with username "
               << username << "\n";
   client.username = username;
@@ -26,7 +141,7 @@ bool Game::connect_to_server() {
     return false;
   }
 
-  noerr = client.send_connection_request();
+  noerr = client.send_connection_request(resume_token);
   if (!noerr) {
     return false;
   }
@@ -40,29 +155,65 @@ bool Game::get_island_data() {
     return false;
   }
 
-  std::optional<msgpack::unpacked> response = client.get_response();
-  if (!response.has_value()) {
+  darena::ServerIDHeightmapsResponse res;
+  if (!client.receive_message(res)) {
     return false;
   }
-
-  msgpack::object obj = response->get();
-  darena::ServerIDHeightmapsResponse res;
-  obj.convert(res);
   id = res.client_id;
-  if (id == 0) {
-    my_turn = true;
-  } else {
-    my_turn = false;
+  resume_token = res.resume_token;
+  reconnect_deadline = 0;
+  keyframe = std::move(res.keyframe);
+  for (const darena::ClientTurn& turn : res.turns) {
+    if (!darena::advance_keyframe(keyframe, turn)) {
+      return false;
+    }
+  }
+  if (keyframe.n_of_turns > 0) {
+    darena::log << "Resuming as id " << id << " at turn "
+                << keyframe.n_of_turns << "\n";
+  }
+
+  if (DARENA_BITMAP_TERRAIN && !thread_pool) {
+    int n_of_workers = std::thread::hardware_concurrency();
+    thread_pool = std::make_unique<darena::ThreadPool>(
+        std::max(0, n_of_workers - 1));
   }
+
+  return true;
+}
+
+void Game::start_match() {
+  my_turn = keyframe.id_playing == id;
+  n_of_finished_turns = keyframe.n_of_turns;
+
   left_island = std::make_unique<darena::Island>(left_island_starting_position,
-                                                 res.heightmaps[0]);
+                                                 keyframe.heightmaps[0]);
   right_island = std::make_unique<darena::Island>(
-      right_island_starting_position, res.heightmaps[1]);
-
+      right_island_starting_position, keyframe.heightmaps[1]);
   left_island->rebuild_island_mesh();
   right_island->rebuild_island_mesh();
 
-  return true;
+  darena::Island* islands[MAX_CLIENTS] = {left_island.get(),
+                                          right_island.get()};
+  const darena::TankKeyframe& player_tank = keyframe.tanks[id];
+  const darena::TankKeyframe& enemy_tank = keyframe.tanks[1 - id];
+  player = std::make_unique<darena::Player>(
+      player_tank.position.x, player_tank.position.y, 25, 25);
+  player->heightmap = &islands[id]->heightmap;
+  player->shot_angle = player_tank.shot_angle;
+  player->shot_power = player_tank.shot_power;
+  enemy = std::make_unique<darena::Enemy>(enemy_tank.position.x,
+                                          enemy_tank.position.y, 25, 25);
+  enemy->heightmap = &islands[1 - id]->heightmap;
+  enemy->set_shot(enemy_tank.shot_angle, enemy_tank.shot_power);
+
+  // Whatever the lost connection interrupted starts over
+  projectile.reset();
+  turn_data = std::make_unique<darena::ClientTurn>();
+  n_of_streamed_movements = 0;
+  n_of_streamed_angles = 0;
+  enemy_was_simulating_previous_step = false;
+  check_for_enemy_finished = false;
 }
 
 void Game::end_turn() {
@@ -79,11 +230,11 @@ void Game::end_turn() {
     return;
   }
 
-  projectile = std::make_unique<darena::Projectile>(
-      player->position.x, player->position.y, turn_data->shot_angle,
-      turn_data->shot_power, shot_direction);
+  projectile.emplace(player->position.x, player->position.y,
+                     turn_data->shot_angle, turn_data->shot_power,
+                     shot_direction);
 
-  set_state(std::make_unique<GSShootProjectile>());
+  set_state(GameStateId::SHOOT_PROJECTILE);
 }
 
 void Game::end_game(bool win, GameEndWay how) {
@@ -127,9 +278,9 @@ void Game::end_game(bool win, GameEndWay how) {
   }
 
   if (win) {
-    set_state(std::make_unique<GSWonGame>());
+    set_state(GameStateId::WON_GAME);
   } else {
-    set_state(std::make_unique<GSLoseGame>());
+    set_state(GameStateId::LOSE_GAME);
   }
 
   darena::log << *game_end_message << "\n";
@@ -142,12 +293,22 @@ void Game::projectile_hit() {
     return;
   }
 
+  // The end digest has to see the collapse finished, update() sends it then
+  if (!terrain_settled()) {
+    turn_waiting_for_terrain = true;
+    return;
+  }
   send_turn_data();
 }
 
 void Game::send_turn_data() {
   bool noerr;
 
+  // The shot has landed, the other player starts their turn from this state
+  record_moved_terrain();
+  n_of_finished_turns++;
+  turn_data->end_digest = digest_state();
+
   std::string movements = "";
   std::string angles = "";
   for (int i : turn_data->movements) {
@@ -163,15 +324,125 @@ void Game::send_turn_data() {
               << "\tAngles: " << angles << "\t" << turn_data->shot_angle << "\t"
               << turn_data->shot_power << "\n";
 
-  noerr = client.send_turn_data(std::move(turn_data));
+  if (DARENA_STREAM_TURNS) {
+    noerr = stream_turn_inputs(true);
+  } else {
+    noerr = client.send_turn_data(std::move(turn_data));
+  }
   turn_data = std::make_unique<darena::ClientTurn>();
 
   my_turn = false;
 
   // TODO: Use a dynamic_cast here and some other places as well
   if (!game_end) {
-    set_state(std::make_unique<GSWaitTurn>());
+    set_state(GameStateId::WAIT_TURN);
+  }
+}
+
+bool Game::stream_turn_inputs(bool last) {
+  outgoing_batch.id = id;
+  outgoing_batch.last = last;
+  outgoing_batch.movements.assign(
+      turn_data->movements.begin() + n_of_streamed_movements,
+      turn_data->movements.end());
+  outgoing_batch.angle_changes.assign(
+      turn_data->angle_changes.begin() + n_of_streamed_angles,
+      turn_data->angle_changes.end());
+  n_of_streamed_movements = turn_data->movements.size();
+  n_of_streamed_angles = turn_data->angle_changes.size();
+
+  if (last) {
+    outgoing_batch.shot_angle = turn_data->shot_angle;
+    outgoing_batch.shot_power = turn_data->shot_power;
+    outgoing_batch.final_position = turn_data->final_position;
+    outgoing_batch.start_digest = turn_data->start_digest;
+    outgoing_batch.end_digest = turn_data->end_digest;
+    outgoing_batch.terrain_deltas = turn_data->terrain_deltas;
+    n_of_streamed_movements = 0;
+    n_of_streamed_angles = 0;
+  } else {
+    outgoing_batch.shot_angle = 0;
+    outgoing_batch.shot_power = 0;
+    outgoing_batch.final_position = {0, 0};
+    outgoing_batch.start_digest = {};
+    outgoing_batch.end_digest = {};
+    outgoing_batch.terrain_deltas.clear();
   }
+
+  return client.send_turn_batch(outgoing_batch);
+}
+
+bool Game::receive_turn_batch() {
+  if (!client.wait_for_message() || !client.receive_message(incoming_batch)) {
+    return false;
+  }
+  turn_stream.push(incoming_batch);
+  return true;
+}
+
+void Game::record_terrain_change(darena::Island& island, size_t first,
+                                 size_t last) {
+  if (!my_turn) {
+    return;
+  }
+
+  darena::TerrainDelta& delta = turn_data->terrain_deltas.emplace_back();
+  int index = &island == left_island.get() ? 0 : 1;
+  darena::encode_terrain_delta(island.heightmap, index, first, last, delta);
+}
+
+void Game::apply_terrain_deltas(
+    const std::vector<darena::TerrainDelta>& deltas) {
+  for (const darena::TerrainDelta& delta : deltas) {
+    darena::Island* island = nullptr;
+    if (delta.island == 0) {
+      island = left_island.get();
+    } else if (delta.island == 1) {
+      island = right_island.get();
+    }
+
+    if (!island || !island->apply_terrain_delta(delta)) {
+      darena::log << "Dropped terrain delta for island " << delta.island
+                  << "\n";
+    }
+  }
+}
+
+void Game::record_moved_terrain() {
+  for (darena::Island* island : {left_island.get(), right_island.get()}) {
+    size_t first;
+    size_t last;
+    if (!island || !island->take_changed_points(first, last)) {
+      continue;
+    }
+    record_terrain_change(*island, first, last);
+    island->heightmap_hash.update(island->heightmap, first, last);
+  }
+}
+
+bool Game::terrain_settled() const {
+  return (!left_island || left_island->is_settled()) &&
+         (!right_island || right_island->is_settled());
+}
+
+darena::StateDigest Game::digest_state() const {
+  darena::StateDigest digest;
+  digest.turn = n_of_finished_turns;
+  if (left_island) {
+    digest.parts[DIGEST_LEFT_TERRAIN] = left_island->heightmap_hash.value();
+  }
+  if (right_island) {
+    digest.parts[DIGEST_RIGHT_TERRAIN] = right_island->heightmap_hash.value();
+  }
+  if (player && enemy) {
+    digest.parts[DIGEST_TANK_0 + id] = player->state_hash();
+    digest.parts[DIGEST_TANK_0 + 1 - id] = enemy->state_hash();
+  }
+  // Whether each player lost, by id
+  bool lost_0 = game_end && (id == 0) != game_win;
+  bool lost_1 = game_end && (id == 1) != game_win;
+  digest.parts[DIGEST_GAME_END] = darena::hash_game_end(lost_0, lost_1);
+  return digest;
 }
 
 bool Game::simulate_turn() {
@@ -180,6 +451,12 @@ bool Game::simulate_turn() {
     return false;
   }
 
+  if (DARENA_STREAM_TURNS) {
+    darena::log << "Playing the streamed turn\n";
+    enemy->start_streamed_simulation(&turn_stream);
+    return true;
+  }
+
   std::string movements = "";
   std::string angles = "";
   for (int i : turn_data->movements) {
@@ -213,52 +490,68 @@ bool Game::simulate_enemy_shoot() {
     shot_direction = -1;
   }
 
-  projectile = std::make_unique<darena::Projectile>(
-      enemy->position.x, enemy->position.y, turn_data->shot_angle,
-      turn_data->shot_power, shot_direction);
+  projectile.emplace(enemy->position.x, enemy->position.y,
+                     turn_data->shot_angle, turn_data->shot_power,
+                     shot_direction);
 
   return true;
 }
 
 bool Game::get_turn_data() {
+  if (DARENA_STREAM_TURNS) {
+    // Returns with the first batch, the rest keeps arriving on another thread
+    // while the enemy plays the turn
+    join_stream_receiver();
+    turn_stream.reset();
+    if (!receive_turn_batch()) {
+      return false;
+    }
+    if (!turn_stream.is_finished()) {
+      stream_receiver = std::thread([this]() {
+        while (!turn_stream.is_finished()) {
+          if (!receive_turn_batch()) {
+            turn_stream.abort();
+            return;
+          }
+        }
+      });
+    }
+    return true;
+  }
+
   bool noerr = client.wait_for_message();
   if (!noerr) {
     return false;
   }
 
-  std::optional<msgpack::unpacked> response = client.get_response();
-  if (!response.has_value()) {
+  // Decoded in place, the turn after send_turn_data() is still empty
+  if (!turn_data) {
+    turn_data = std::make_unique<darena::ClientTurn>();
+  }
+  if (!client.receive_message(*turn_data)) {
     return false;
   }
 
-  try {
-    msgpack::object obj = response->get();
-    turn_data = std::make_unique<darena::ClientTurn>();
-    obj.convert(*turn_data);
-    int turn_data_client_id = turn_data->id;
-    std::string movements = "";
-    std::string angles = "";
-    for (int i : turn_data->movements) {
-      movements.append(std::to_string(i));
-      movements.append(" ");
-    }
-    for (int i : turn_data->angle_changes) {
-      angles.append(std::to_string(i));
-      angles.append(" ");
-    }
-    darena::log << turn_data_client_id << "\tMovements: " << movements
-                << "\tAngles: " << angles << "\t" << turn_data->shot_angle
-                << "\t" << turn_data->shot_power << "\n";
-  } catch (const std::exception& e) {
-    darena::log << "Message parse error: " << e.what() << "\n";
-    return false;
+  int turn_data_client_id = turn_data->id;
+  std::string movements = "";
+  std::string angles = "";
+  for (int i : turn_data->movements) {
+    movements.append(std::to_string(i));
+    movements.append(" ");
   }
+  for (int i : turn_data->angle_changes) {
+    angles.append(std::to_string(i));
+    angles.append(" ");
+  }
+  darena::log << turn_data_client_id << "\tMovements: " << movements
+              << "\tAngles: " << angles << "\t" << turn_data->shot_angle
+              << "\t" << turn_data->shot_power << "\n";
 
   return true;
 }
 
 void Game::process_input(SDL_Event* e) {
-  state->process_input(this, e);
+  std::visit([this, e](auto& s) { s.process_input(this, e); }, state);
 
   if (my_turn) {
     if (player) {
@@ -281,12 +574,40 @@ void Game::process_input(SDL_Event* e) {
   if (right_island) {
     right_island->process_input(this, e);
   }
+
+  apply_pending_state();
 }
 
 void Game::update(float delta_time) {
-  state->update(this, delta_time);
+  // The states waiting for the server do it on a job thread, which keeps the
+  // connection alive meanwhile
+  bool connected = true;
+  switch (state_id()) {
+    case GameStateId::PLAY_TURN:
+    case GameStateId::SHOOT_PROJECTILE:
+    case GameStateId::REALTIME_MATCH:
+      connected = client.keep_alive();
+      break;
+    case GameStateId::SIMULATE_TURN:
+      // With DARENA_STREAM_TURNS the rest of the turn may still be arriving
+      if (!DARENA_STREAM_TURNS || turn_stream.is_finished()) {
+        connected = client.keep_alive();
+      }
+      break;
+    default:
+      break;
+  }
+  if (!connected) {
+    lose_connection();
+  }
 
-  if (player) {
+  std::visit([this, delta_time](auto& s) { s.update(this, delta_time); },
+             state);
+
+  // The real-time match moves them through its own simulation
+  bool realtime = state_id() == GameStateId::REALTIME_MATCH;
+
+  if (player && !realtime) {
     player->update(this, delta_time);
   }
 
@@ -294,12 +615,15 @@ void Game::update(float delta_time) {
     projectile->update(this, delta_time);
   }
 
-  if (enemy) {
+  particles.update(FIXED_TIMESTEP);
+
+  if (enemy && !realtime) {
     enemy->update(this, delta_time);
 
     bool enemy_is_simulating = enemy->is_simulating.load();
     if (!enemy_is_simulating && enemy_was_simulating_previous_step) {
       check_for_enemy_finished = true;
+      n_of_finished_turns++;
     }
 
     if (check_for_enemy_finished) {
@@ -307,11 +631,14 @@ void Game::update(float delta_time) {
         darena::log << "I won by enemy falling!\n";
         check_for_enemy_finished = false;
         end_game(true, GameEndWay::FALL);
-      } else if (!enemy->falling) {
+      } else if (!enemy->falling && terrain_settled()) {
+        // The turn's start digest is taken once the collapse finished
         check_for_enemy_finished = false;
+        // The enemy's turn carried its own terrain deltas
+        record_moved_terrain();
         if (!game_end) {
           my_turn = true;
-          set_state(std::make_unique<GSPlayTurn>());
+          set_state(GameStateId::PLAY_TURN);
         }
       }
     }
@@ -326,6 +653,14 @@ void Game::update(float delta_time) {
   if (right_island) {
     right_island->update(this, delta_time);
   }
+
+  // See projectile_hit()
+  if (turn_waiting_for_terrain && terrain_settled()) {
+    turn_waiting_for_terrain = false;
+    send_turn_data();
+  }
+
+  apply_pending_state();
 }
 
 void Game::render() {
@@ -351,13 +686,18 @@ void Game::render() {
     projectile->render(this);
   }
 
-  state->render(this);
+  particles.render();
+
+  std::visit([this](auto& s) { s.render(this); }, state);
+  apply_pending_state();
 }
 
 // PLACEHOLDER FUNCTIONS FOR TESTING
+namespace {
 std::random_device rd;
 std::mt19937 gen(rd());
 std::uniform_real_distribution<> dis(0.0, 1.0);
+}  // namespace
 std::vector<darena::IslandPoint> Game::generate(
     const Vec2& starting_position, int num_of_points) {
   std::vector<darena::IslandPoint> output = {};
@@ -1,18 +1,32 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
 
 #include "client_lib.h"
 #include "enemy.h"
 #include "game_state.h"
 #include "island.h"
+#include "particles.h"
 #include "player.h"
 #include "projectile.h"
+#include "thread_pool.h"
+#include "turn_stream.h"
 
-namespace darena {
+// Frames of input reserved up front in the turn data, about a minute at
+// TARGET_FPS. Longer turns still work, they just reallocate.
+#define TURN_DATA_RESERVE 4096
+
+// Number of most recent state transitions kept in Game::transition_log
+#define STATE_TRANSITION_LOG_SIZE 64
 
-class GameState;
+namespace darena {
 
 struct Game {
   const char* win_by_fall = "I win. The enemy has fallen into the void.";
@@ -32,45 +46,136 @@ struct Game {
   bool my_turn;
   bool enemy_was_simulating_previous_step = false;
   bool check_for_enemy_finished = false;
+  // projectile_hit() left the turn for update() to send, see terrain_settled()
+  bool turn_waiting_for_terrain = false;
   std::string username;
   std::string server_ip;
   darena::TCPClient client;
-  std::unique_ptr<darena::GameState> state;
+  // Blocking work of the current state, see start_job()
+  std::thread job_thread;
+  std::atomic_bool job_running{false};
+  darena::GameStateVariant state;
+  // Requested by set_state(), applied once the current state callback returns
+  std::optional<darena::GameStateId> pending_state;
+  // Ring buffer of the last transitions, for profiling turn latency
+  std::array<darena::StateTransition, STATE_TRANSITION_LOG_SIZE> transition_log;
+  size_t n_of_transitions = 0;
+  uint64_t state_entered_at = 0;
+  // Logs every transition with the time spent in the previous state. Turned
+  // on by setting the DARENA_TRACE_STATES environment variable.
+  bool print_state_transitions = false;
   std::unique_ptr<darena::Player> player;
   std::unique_ptr<darena::Enemy> enemy;
-  std::unique_ptr<darena::Projectile> projectile;
+  // Constructed in place, at most one projectile is in flight
+  std::optional<darena::Projectile> projectile;
   std::unique_ptr<darena::Island> left_island;
   std::unique_ptr<darena::Island> right_island;
   std::unique_ptr<darena::ClientTurn> turn_data;
+  // Only used with DARENA_STREAM_TURNS. Inputs of turn_data already sent this
+  // turn, the batches reused for sending and receiving, and the enemy's turn
+  // as it arrives.
+  size_t n_of_streamed_movements = 0;
+  size_t n_of_streamed_angles = 0;
+  darena::TurnInputBatch outgoing_batch;
+  darena::TurnInputBatch incoming_batch;
+  darena::TurnStream turn_stream;
+  // Receives the batches after the first one into turn_stream, aborts it if
+  // the connection breaks
+  std::thread stream_receiver;
+  // Turns played by both players, counted when a shot of either lands
+  int n_of_finished_turns = 0;
+  // Sent when connecting again after losing the connection, 0 until the
+  // server gave one
+  uint64_t resume_token = 0;
+  // SDL_GetTicks64() after which the server gave the lost match up, 0 while
+  // connected
+  uint64_t reconnect_deadline = 0;
+  // Match to start from, set by get_island_data()
+  darena::MatchKeyframe keyframe;
+  darena::ParticleSystem particles;
+  // Workers for the terrain collapse simulation, only with bitmap terrain
+  std::unique_ptr<darena::ThreadPool> thread_pool;
 
   Game() : client(server_ip, username) {
-    state = std::make_unique<GSInitial>();
+    print_state_transitions = std::getenv("DARENA_TRACE_STATES") != nullptr;
+    state_entered_at = SDL_GetPerformanceCounter();
     turn_data = std::make_unique<darena::ClientTurn>();
     turn_data->movements.emplace_back(0);
     turn_data->angle_changes.emplace_back(0);
   }
+  ~Game();
+
+  // Requests a transition. It happens after the running process_input(),
+  // update() or render() returns, the last request of a frame wins.
+  void set_state(GameStateId new_state);
+
+  // Replaces the state with the requested one and records the transition
+  void apply_pending_state();
 
-  // Sets the new state
-  void set_state(std::unique_ptr<GameState> new_state);
+  GameStateId state_id() const;
+
+  // Runs job on job_thread. The states start their blocking network work with
+  // it, so no thread outlives the state or the game it points to.
+  void start_job(std::function<void()> job);
+
+  // Cancels a job still waiting for the server and joins job_thread
+  void stop_job();
 
   // Connects to the server
   bool connect_to_server();
 
-  // Waits for the server to send island data
+  // Waits for the server to send island data, the keyframe of a resumed
+  // match is brought up to date with the turns that came with it
   bool get_island_data();
 
+  // Builds the islands, the player and the enemy from keyframe. Called on the
+  // main thread, it replaces everything a lost connection left behind.
+  void start_match();
+
   // Shoots the projectile and ends the turn
   void end_turn();
 
   // Ends the game
   void end_game(bool win, GameEndWay how);
 
-  // Resets the projectile pointer and calls send_turn_data if its my turn
+  // Resets the projectile and calls send_turn_data if its my turn, once the
+  // terrain settled
   void projectile_hit();
 
   // Sends turn data to the server
   void send_turn_data();
 
+  // Sends the inputs of turn_data played since the last batch, the last batch
+  // of a turn also carries the shot
+  bool stream_turn_inputs(bool last);
+
+  // Receives the next batch of the enemy's turn into turn_stream
+  bool receive_turn_batch();
+  // Waits for the last turn's stream_receiver, which returns once the turn
+  // finished or was aborted
+  void join_stream_receiver();
+
+  // Connects again with the resume token, which picks the match up where the
+  // server has it. Called by the states that notice the connection broke.
+  void lose_connection();
+
+  // Sends heightmap points [first, last) of island with the turn, called by
+  // the shooter after an impact. Snaps the points to the heights sent.
+  void record_terrain_change(darena::Island& island, size_t first,
+                             size_t last);
+  // Records the points the bitmap terrain moved since the last call, which
+  // only clears them when it's not my turn
+  void record_moved_terrain();
+
+  // Applies the terrain the enemy's shot changed over the local crater
+  void apply_terrain_deltas(const std::vector<darena::TerrainDelta>& deltas);
+
+  // Hashes the islands, the tanks and the game end flags, see StateDigest
+  darena::StateDigest digest_state() const;
+  // False while a crater's collapse still moves heightmap points, digests
+  // taken meanwhile would differ between the clients
+  bool terrain_settled() const;
+
   // Simulates the turn
   bool simulate_turn();
 
@@ -2,7 +2,7 @@
 
 #include <SDL_opengl.h>
 
-#include <thread>
+#include <algorithm>
 
 #include "game.h"
 #include "imgui.h"
@@ -11,9 +11,33 @@
 
 namespace darena {
 
-Vec2 left_pos = {100, 100};
-Vec2 right_pos = {WINDOW_WIDTH - 100 - 25,  // - 25 because  of player width
-                      100};
+const char* game_state_name(GameStateId id) {
+  switch (id) {
+    case GameStateId::INITIAL:
+      return "INITIAL";
+    case GameStateId::CONNECTING:
+      return "CONNECTING";
+    case GameStateId::WAITING_FOR_ISLAND_DATA:
+      return "WAITING_FOR_ISLAND_DATA";
+    case GameStateId::CONNECTED:
+      return "CONNECTED";
+    case GameStateId::PLAY_TURN:
+      return "PLAY_TURN";
+    case GameStateId::SHOOT_PROJECTILE:
+      return "SHOOT_PROJECTILE";
+    case GameStateId::WAIT_TURN:
+      return "WAIT_TURN";
+    case GameStateId::SIMULATE_TURN:
+      return "SIMULATE_TURN";
+    case GameStateId::WON_GAME:
+      return "WON_GAME";
+    case GameStateId::LOSE_GAME:
+      return "LOSE_GAME";
+    case GameStateId::REALTIME_MATCH:
+      return "REALTIME_MATCH";
+  }
+  return "UNKNOWN";
+}
 
 void GSInitial::process_input(Game* game, SDL_Event* e) { return; }
 
@@ -38,7 +62,7 @@ void GSInitial::render(Game* game) {
   bool button = ImGui::Button("Connect");
 
   if (button) {
-    game->set_state(std::make_unique<GSConnecting>());
+    game->set_state(GameStateId::CONNECTING);
   }
 
   ImGui::End();
@@ -47,21 +71,41 @@ void GSInitial::render(Game* game) {
 void GSConnecting::process_input(Game* game, SDL_Event* e) { return; }
 
 void GSConnecting::job(Game* game) {
-  bool successfully_connected = game->connect_to_server();
-  if (successfully_connected) {
-    thread_running = false;
-    transition_ready = true;
+  // The server may not be up yet or not have noticed the old connection
+  // broke, so failed attempts are retried with a doubling delay
+  int delay_ms = CLIENT_RETRY_DELAY;
+  while (!game->connect_to_server()) {
+    if (game->reconnect_deadline != 0 &&
+        SDL_GetTicks64() + delay_ms > game->reconnect_deadline) {
+      gave_up = true;
+      return;
+    }
+    darena::log << "Connecting again in " << delay_ms << " ms\n";
+    if (!game->client.pause(delay_ms)) {
+      return;
+    }
+    delay_ms = std::min(delay_ms * 2, CLIENT_RETRY_MAX_DELAY);
   }
+  // thread_running stays set so no second job is started
+  transition_ready = true;
 }
 void GSConnecting::update(Game* game, float delta_time) {
   if (transition_ready) {
-    game->set_state(std::make_unique<GSWaitingForIslandData>());
+    game->set_state(GameStateId::WAITING_FOR_ISLAND_DATA);
     transition_ready = false;
   }
+  if (gave_up) {
+    gave_up = false;
+    darena::log << "The match can't be resumed any more\n";
+    game->resume_token = 0;
+    game->reconnect_deadline = 0;
+    game->set_state(GameStateId::INITIAL);
+    return;
+  }
 
   bool expected = false;
   if (thread_running.compare_exchange_strong(expected, true)) {
-    std::thread([this, game]() { this->job(game); }).detach();
+    game->start_job([this, game]() { this->job(game); });
   }
 }
 
@@ -94,38 +138,26 @@ void GSWaitingForIslandData::job(Game* game) {
   bool successfully_connected = game->get_island_data();
   if (successfully_connected) {
     transition_ready = true;
-    thread_running = false;
+  } else {
+    connection_lost = true;
   }
 }
 
 void GSWaitingForIslandData::update(Game* game, float delta_time) {
   if (transition_ready) {
     transition_ready = false;
-
-    Vec2 player_pos = left_pos;
-    Vec2 enemy_pos = right_pos;
-    const std::vector<darena::IslandPoint>* player_heightmap =
-        &game->left_island->heightmap;
-    const std::vector<darena::IslandPoint>* enemy_heightmap =
-        &game->right_island->heightmap;
-    if (game->id == 1) {
-      player_pos = right_pos;
-      player_heightmap = &game->right_island->heightmap;
-      enemy_pos = left_pos;
-      enemy_heightmap = &game->left_island->heightmap;
-    }
-    game->player =
-        std::make_unique<darena::Player>(player_pos.x, player_pos.y, 25, 25);
-    game->player->heightmap = player_heightmap;
-    game->enemy =
-        std::make_unique<darena::Enemy>(enemy_pos.x, enemy_pos.y, 25, 25);
-    game->enemy->heightmap = enemy_heightmap;
-    game->set_state(std::make_unique<GSConnected>());
+    game->start_match();
+    game->set_state(GameStateId::CONNECTED);
+  }
+  if (connection_lost) {
+    connection_lost = false;
+    game->lose_connection();
+    return;
   }
 
   bool expected = false;
   if (thread_running.compare_exchange_strong(expected, true)) {
-    std::thread([this, game]() { this->job(game); }).detach();
+    game->start_job([this, game]() { this->job(game); });
   }
 }
 
@@ -155,10 +187,12 @@ void GSWaitingForIslandData::render(Game* game) {
 void GSConnected::process_input(Game* game, SDL_Event* e) {}
 
 void GSConnected::update(Game* game, float delta_time) {
-  if (game->my_turn) {
-    game->set_state(std::make_unique<GSPlayTurn>());
+  if (DARENA_REALTIME_MODE) {
+    game->set_state(GameStateId::REALTIME_MATCH);
+  } else if (game->my_turn) {
+    game->set_state(GameStateId::PLAY_TURN);
   } else {
-    game->set_state(std::make_unique<GSWaitTurn>());
+    game->set_state(GameStateId::WAIT_TURN);
   }
 }
 
@@ -169,9 +203,9 @@ void GSPlayTurn::process_input(Game* game, SDL_Event* e) {
     case SDL_KEYDOWN: {
       if (e->key.keysym.sym == SDLK_r) {
         if (game->id == 0) {
-          game->player->position = left_pos;
+          game->player->position = left_tank_starting_position;
         } else {
-          game->player->position = right_pos;
+          game->player->position = right_tank_starting_position;
         }
         game->player->shot_power = 0;
         game->player->shot_state = Player::ShotState::IDLE;
@@ -184,8 +218,19 @@ void GSPlayTurn::process_input(Game* game, SDL_Event* e) {
 void GSPlayTurn::update(Game* game, float delta_time) {
   if (!reset) {
     game->player->reset();
+    // Player::update() appends to these every frame of the turn
+    game->turn_data->movements.reserve(TURN_DATA_RESERVE);
+    game->turn_data->angle_changes.reserve(TURN_DATA_RESERVE);
+    game->turn_data->start_digest = game->digest_state();
     reset = true;
   }
+
+  if (DARENA_STREAM_TURNS && ++frames_since_batch >= STREAM_BATCH_FRAMES) {
+    frames_since_batch = 0;
+    if (!game->stream_turn_inputs(false)) {
+      game->lose_connection();
+    }
+  }
 }
 
 void GSPlayTurn::render(Game* game) {
@@ -221,20 +266,26 @@ void GSWaitTurn::job(Game* game) {
   bool got_turn_data = game->get_turn_data();
   if (got_turn_data) {
     transition_ready = true;
-    thread_running = false;
+  } else {
+    connection_lost = true;
   }
 }
 
 void GSWaitTurn::update(Game* game, float delta_time) {
   if (transition_ready) {
     transition_ready = false;
-    game->set_state(std::make_unique<GSSimulateTurn>());
+    game->set_state(GameStateId::SIMULATE_TURN);
+    return;
+  }
+  if (connection_lost) {
+    connection_lost = false;
+    game->lose_connection();
     return;
   }
 
   bool expected = false;
   if (thread_running.compare_exchange_strong(expected, true)) {
-    std::thread([this, game]() { this->job(game); }).detach();
+    game->start_job([this, game]() { this->job(game); });
   }
 }
 
@@ -264,6 +315,10 @@ void GSWaitTurn::render(Game* game) {
 void GSSimulateTurn::process_input(Game* game, SDL_Event* e) {}
 
 void GSSimulateTurn::update(Game* game, float delta_time) {
+  if (DARENA_STREAM_TURNS && game->turn_stream.is_aborted()) {
+    game->lose_connection();
+    return;
+  }
   if (!sent) {
     sent = game->simulate_turn();
   }
@@ -292,6 +347,123 @@ void GSSimulateTurn::render(Game* game) {
   ImGui::End();
 }
 
+namespace {
+
+uint8_t realtime_input_bit(SDL_Keycode key) {
+  switch (key) {
+    case SDLK_LEFT:
+      return REALTIME_INPUT_LEFT;
+    case SDLK_RIGHT:
+      return REALTIME_INPUT_RIGHT;
+    case SDLK_UP:
+      return REALTIME_INPUT_UP;
+    case SDLK_DOWN:
+      return REALTIME_INPUT_DOWN;
+    case SDLK_SPACE:
+      return REALTIME_INPUT_FIRE;
+  }
+  return 0;
+}
+
+}  // namespace
+
+void GSRealtimeMatch::process_input(Game* game, SDL_Event* e) {
+  switch (e->type) {
+    case SDL_KEYDOWN: {
+      input |= realtime_input_bit(e->key.keysym.sym);
+      break;
+    }
+    case SDL_KEYUP: {
+      input &= ~realtime_input_bit(e->key.keysym.sym);
+      break;
+    }
+  }
+}
+
+void GSRealtimeMatch::update(Game* game, float delta_time) {
+  if (!started) {
+    session.start(game->id, darena::initial_sim_state());
+    started = true;
+  }
+
+  // Everything the other player sent since the last frame
+  while (game->client.connection->wait_readable(0)) {
+    if (!game->client.receive_message(incoming)) {
+      game->lose_connection();
+      return;
+    }
+    session.add_remote_input(incoming.frame, incoming.input);
+  }
+
+  if (!session.can_advance()) {
+    session.stats.n_of_stalls++;
+    return;
+  }
+
+  outgoing = {game->id, session.state.frame, input};
+  if (!game->client.send_message(outgoing)) {
+    game->lose_connection();
+    return;
+  }
+  darena::SimTerrain terrain = {&game->left_island->heightmap,
+                                &game->right_island->heightmap};
+  session.advance(input, terrain);
+
+  const darena::SimTank& mine = session.state.tanks[game->id];
+  game->player->position = darena::to_vec2(mine.position);
+  game->player->angle_rad = darena::to_float(mine.tilt);
+  game->player->shot_angle = darena::to_float(mine.shot_angle);
+  game->player->shot_power = darena::to_float(mine.shot_power);
+  const darena::SimTank& theirs = session.state.tanks[1 - game->id];
+  game->enemy->show_state(
+      darena::to_vec2(theirs.position), darena::to_float(theirs.tilt),
+      darena::to_float(theirs.shot_angle), darena::to_float(theirs.shot_power));
+
+  // A predicted ending could still be rolled back
+  if (session.is_confirmed() && darena::sim_game_over(session.state)) {
+    bool lost = session.state.lost[game->id];
+    const darena::SimTank& loser = lost ? mine : theirs;
+    game->end_game(!lost, loser.falling ? Game::GameEndWay::FALL
+                                        : Game::GameEndWay::DESTROY);
+  }
+}
+
+void GSRealtimeMatch::render(Game* game) {
+  for (const darena::SimProjectile& projectile : session.state.projectiles) {
+    if (!projectile.active) {
+      continue;
+    }
+    glPushMatrix();
+    darena::Vec2 position = darena::to_vec2(projectile.position);
+    glTranslatef(position.x, position.y, 0);
+    glColor3f(0.3f, 0.75f, 0.3f);
+    glBegin(GL_POLYGON);
+    glVertex2f(-10, 5);
+    glVertex2f(10, 5);
+    glVertex2f(10, -5);
+    glVertex2f(-10, -5);
+    glEnd();
+    glPopMatrix();
+  }
+
+  const darena::RollbackStats& stats = session.stats;
+  double us_per_tick = 1e6 / SDL_GetPerformanceFrequency();
+  ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_Always);
+  ImGuiWindowFlags window_flags =
+      ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
+      ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoSavedSettings |
+      ImGuiWindowFlags_AlwaysAutoResize;
+  ImGui::Begin("Rollback Overlay", nullptr, window_flags);
+  ImGui::Text("Frame %d", session.state.frame);
+  ImGui::Text("Rollbacks %d, max %d frames", stats.n_of_rollbacks,
+              stats.max_rollback_frames);
+  ImGui::Text("Resimulation last %.0f us, max %.0f us",
+              stats.last_rollback_ticks * us_per_tick,
+              stats.max_rollback_ticks * us_per_tick);
+  ImGui::Text("Stalls %d", stats.n_of_stalls);
+  ImGui::End();
+}
+
 void GSWonGame::process_input(darena::Game* game, SDL_Event* e) {}
 void GSWonGame::update(darena::Game* game, float delta_time) {}
 void GSWonGame::render(darena::Game* game) {
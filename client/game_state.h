@@ -3,108 +3,162 @@
 #include <SDL_events.h>
 
 #include <atomic>
+#include <cstdint>
+#include <variant>
+
+#include "rollback.h"
 
 namespace darena {
 
 struct Game;
 
-class GameState {
- public:
-  virtual ~GameState() = default;
-  virtual void process_input(darena::Game* game, SDL_Event* e) = 0;
-  virtual void update(darena::Game* game, float delta_time) = 0;
-  virtual void render(darena::Game* game) = 0;
-};
+// Every state has process_input(), update() and render(). Game keeps the
+// current one in a GameStateVariant and dispatches to it with std::visit, so
+// there are no virtual calls and a transition just constructs the new state in
+// place.
 
-class GSInitial : public GameState {
+class GSInitial {
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSConnecting : public GameState {
+class GSConnecting {
  private:
-  std::atomic_bool thread_running;
-  std::atomic_bool transition_ready;
+  std::atomic_bool thread_running{false};
+  std::atomic_bool transition_ready{false};
+  // Set once Game::reconnect_deadline passed without a connection
+  std::atomic_bool gave_up{false};
   void job(Game* game);
 
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSWaitingForIslandData : public GameState {
+class GSWaitingForIslandData {
  private:
-  std::atomic_bool thread_running;
-  std::atomic_bool transition_ready;
+  std::atomic_bool thread_running{false};
+  std::atomic_bool transition_ready{false};
+  std::atomic_bool connection_lost{false};
   void job(Game* game);
 
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSConnected : public GameState {
+class GSConnected {
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSPlayTurn : public GameState {
+class GSPlayTurn {
  private:
   bool reset = false;
+  // Frames since the last streamed batch, with DARENA_STREAM_TURNS
+  int frames_since_batch = 0;
 
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSShootProjectile : public GameState {
+class GSShootProjectile {
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSWaitTurn : public GameState {
+class GSWaitTurn {
  private:
-  std::atomic_bool thread_running;
-  std::atomic_bool transition_ready;
+  std::atomic_bool thread_running{false};
+  std::atomic_bool transition_ready{false};
+  std::atomic_bool connection_lost{false};
   void job(Game* game);
 
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSSimulateTurn : public GameState {
+class GSSimulateTurn {
  private:
   bool sent = false;
 
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSWonGame : public GameState {
+// Both players at once with DARENA_REALTIME_MODE. The match runs in session,
+// Player and Enemy only show its state.
+class GSRealtimeMatch {
+ private:
+  bool started = false;
+  // REALTIME_INPUT_* bits of the keys held down
+  uint8_t input = 0;
+  darena::RollbackSession session;
+  darena::RealtimeInput outgoing;
+  darena::RealtimeInput incoming;
+
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
-class GSLoseGame : public GameState {
+class GSWonGame {
  public:
-  void process_input(darena::Game* game, SDL_Event* e) override;
-  void update(darena::Game* game, float delta_time) override;
-  void render(darena::Game* game) override;
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
 };
 
+class GSLoseGame {
+ public:
+  void process_input(darena::Game* game, SDL_Event* e);
+  void update(darena::Game* game, float delta_time);
+  void render(darena::Game* game);
+};
+
+// Order matches GameStateVariant
+enum class GameStateId {
+  INITIAL,
+  CONNECTING,
+  WAITING_FOR_ISLAND_DATA,
+  CONNECTED,
+  PLAY_TURN,
+  SHOOT_PROJECTILE,
+  WAIT_TURN,
+  SIMULATE_TURN,
+  WON_GAME,
+  LOSE_GAME,
+  REALTIME_MATCH,
+};
+
+using GameStateVariant =
+    std::variant<GSInitial, GSConnecting, GSWaitingForIslandData, GSConnected,
+                 GSPlayTurn, GSShootProjectile, GSWaitTurn, GSSimulateTurn,
+                 GSWonGame, GSLoseGame, GSRealtimeMatch>;
+
+// Entry of Game::transition_log
+struct StateTransition {
+  darena::GameStateId from;
+  darena::GameStateId to;
+  // SDL_GetPerformanceCounter() at the transition
+  uint64_t time;
+};
+
+const char* game_state_name(darena::GameStateId id);
+
 }  // namespace darena
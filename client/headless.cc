@@ -0,0 +1,89 @@
+#include "headless.h"
+
+#include <memory>
+#include <vector>
+
+#include "client_lib.h"
+#include "common.h"
+#include "game.h"
+#include "input_script.h"
+
+namespace darena {
+
+namespace {
+
+struct HeadlessClient {
+  darena::Game game;
+  // Frames since the current turn started, drives the input script
+  int turn_frame = 0;
+};
+
+bool in_match(GameStateId state) {
+  return state != GameStateId::INITIAL && state != GameStateId::CONNECTING &&
+         state != GameStateId::WAITING_FOR_ISLAND_DATA;
+}
+
+bool match_ended(GameStateId state) {
+  return state == GameStateId::WON_GAME || state == GameStateId::LOSE_GAME;
+}
+
+}  // namespace
+
+bool run_headless_clients(int n_of_clients, const std::string& server_ip,
+                          int frames) {
+  std::vector<std::unique_ptr<HeadlessClient>> clients;
+  for (int i = 0; i < n_of_clients; i++) {
+    auto client = std::make_unique<HeadlessClient>();
+    client->game.username = "Headless" + std::to_string(i);
+    client->game.server_ip = server_ip;
+    // Skips GSInitial, which only renders the connect form
+    client->game.set_state(GameStateId::CONNECTING);
+    client->game.apply_pending_state();
+    clients.push_back(std::move(client));
+  }
+
+  int frame = 0;
+  for (; frame < frames; frame++) {
+    uint64_t frame_start = SDL_GetTicks64();
+
+    bool all_ended = true;
+    for (auto& client : clients) {
+      Game& game = client->game;
+      if (game.state_id() == GameStateId::PLAY_TURN ||
+          game.state_id() == GameStateId::REALTIME_MATCH) {
+        play_input_script(game, play_turn_script, client->turn_frame++);
+      } else {
+        client->turn_frame = 0;
+      }
+      game.update(FIXED_TIMESTEP);
+      all_ended = all_ended && match_ended(game.state_id());
+    }
+    if (all_ended) {
+      break;
+    }
+
+    // Keep real time pacing so turns and timeouts behave like a real client
+    uint64_t elapsed = SDL_GetTicks64() - frame_start;
+    if (elapsed < 1000 / TARGET_FPS) {
+      SDL_Delay(1000 / TARGET_FPS - elapsed);
+    }
+  }
+
+  int n_in_match = 0;
+  int n_ended = 0;
+  for (auto& client : clients) {
+    GameStateId state = client->game.state_id();
+    n_in_match += in_match(state);
+    n_ended += match_ended(state);
+    darena::log << client->game.username << ": " << game_state_name(state)
+                << " after " << client->game.n_of_transitions
+                << " transitions\n";
+  }
+  darena::log << "Headless run stopped after " << frame << " frames, "
+              << n_in_match << " of " << n_of_clients << " clients in a match, "
+              << n_ended << " finished\n";
+
+  return n_in_match == n_of_clients;
+}
+
+}  // namespace darena
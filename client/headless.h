@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+#define HEADLESS_DEFAULT_CLIENTS 2
+// One minute at TARGET_FPS
+#define HEADLESS_DEFAULT_FRAMES 3600
+
+namespace darena {
+
+// Runs n_of_clients games against the server without a window, GL context or
+// ImGui. Every game keeps its state machine, networking and physics. Nothing
+// is rendered, and input comes from play_turn_script whenever it is that
+// game's turn. All games step together at TARGET_FPS for at most frames
+// frames, or until every match has ended. Returns false if a client never got
+// into a match. Run with
+// `DuelArenaClient --headless [n_of_clients] [server_ip] [frames]`.
+bool run_headless_clients(int n_of_clients, const std::string& server_ip,
+                          int frames = HEADLESS_DEFAULT_FRAMES);
+
+}  // namespace darena
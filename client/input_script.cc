@@ -0,0 +1,46 @@
+#include "input_script.h"
+
+#include "game.h"
+
+namespace darena {
+
+namespace {
+
+const ScriptedKey walk_and_aim_keys[] = {
+    {0, SDLK_RIGHT, true}, {20, SDLK_RIGHT, false}, {30, SDLK_LEFT, true},
+    {50, SDLK_LEFT, false}, {60, SDLK_UP, true},    {75, SDLK_UP, false},
+    {80, SDLK_DOWN, true},  {95, SDLK_DOWN, false},
+};
+
+// The first space press starts charging, the second one shoots
+const ScriptedKey play_turn_keys[] = {
+    {10, SDLK_RIGHT, true},  {30, SDLK_RIGHT, false}, {40, SDLK_LEFT, true},
+    {55, SDLK_LEFT, false},  {60, SDLK_UP, true},     {70, SDLK_UP, false},
+    {80, SDLK_SPACE, true},  {81, SDLK_SPACE, false}, {140, SDLK_SPACE, true},
+    {141, SDLK_SPACE, false},
+};
+
+}  // namespace
+
+const InputScript walk_and_aim_script = {
+    walk_and_aim_keys,
+    sizeof(walk_and_aim_keys) / sizeof(walk_and_aim_keys[0]), 100};
+
+const InputScript play_turn_script = {
+    play_turn_keys, sizeof(play_turn_keys) / sizeof(play_turn_keys[0]), 240};
+
+void play_input_script(Game& game, const InputScript& script, int frame) {
+  int script_frame = frame % script.length;
+  for (int i = 0; i < script.n_of_keys; i++) {
+    const ScriptedKey& step = script.keys[i];
+    if (step.frame != script_frame) {
+      continue;
+    }
+    SDL_Event e;
+    e.type = step.down ? SDL_KEYDOWN : SDL_KEYUP;
+    e.key.keysym.sym = step.key;
+    game.process_input(&e);
+  }
+}
+
+}  // namespace darena
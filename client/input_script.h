@@ -0,0 +1,31 @@
+#pragma once
+
+#include <SDL_events.h>
+
+namespace darena {
+
+struct Game;
+
+// Key press or release on a frame of a repeating input script
+struct ScriptedKey {
+  int frame;
+  SDL_Keycode key;
+  bool down;
+};
+
+// Keys sorted by frame, replayed every length frames
+struct InputScript {
+  const ScriptedKey* keys;
+  int n_of_keys;
+  int length;
+};
+
+// Walks right and back, then aims up and down. Never shoots.
+extern const InputScript walk_and_aim_script;
+// Walks, aims, charges a shot and fires it
+extern const InputScript play_turn_script;
+
+// Sends the keys of frame (modulo the script length) to game.process_input()
+void play_input_script(Game& game, const InputScript& script, int frame);
+
+}  // namespace darena
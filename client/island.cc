@@ -6,6 +6,7 @@
 #include <string>
 
 #include "game.h"
+#include "terrain_delta.h"
 
 namespace darena {
 
@@ -19,7 +20,15 @@ std::string Island::to_string() const {
 }
 
 void Island::build_island_part(size_t start_i, size_t end_i) {
-  std::vector<darena::IslandPoint> inside = {};
+  if (n_of_parts == island_vertices.size()) {
+    island_vertices.emplace_back();
+  }
+  if (n_of_parts == part_ranges.size()) {
+    part_ranges.emplace_back();
+  }
+  part_ranges[n_of_parts] = {start_i, end_i};
+  std::vector<darena::IslandPoint>& inside = island_vertices[n_of_parts++];
+  inside.clear();
 
   // Top vertices left to right
   for (size_t i = start_i; i <= end_i; ++i) {
@@ -33,18 +42,13 @@ void Island::build_island_part(size_t start_i, size_t end_i) {
                                      (float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT)},
                         heightmap[current_map_i].strength);
   }
-
-  island_vertices.push_back(inside);
 }
 
-void Island::rebuild_island_mesh() {
-  island_vertices.clear();
-  island_indices.clear();
-
+void Island::build_island_parts(size_t begin, size_t end) {
   // If the island is split into segments, we need to build multiple polygons
-  size_t start_i = 0;
+  size_t start_i = begin;
   bool last_was_zero = false;
-  for (size_t i = 0; i < heightmap.size(); ++i) {
+  for (size_t i = begin; i < end; ++i) {
     bool zero = are_equal(heightmap[i].position.y,
                           (float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT));
     if (!zero && !last_was_zero) {
@@ -59,50 +63,250 @@ void Island::rebuild_island_mesh() {
   }
 
   if (last_was_zero) {
-    size_t last_heightmap_i = heightmap.size() - 1;
+    size_t last_heightmap_i = end - 1;
     if (last_heightmap_i > start_i) {
       build_island_part(start_i, last_heightmap_i);
     }
   }
+}
+
+void Island::triangulate_part(size_t part) {
+  if (island_indices.size() < n_of_parts) {
+    island_indices.resize(n_of_parts);
+  }
 
-  // Triangulation step
-  for (const auto& island_part : island_vertices) {
-    if (island_part.size() < 3) {
-      // Shouldn't happen as build_island_part should always produce >= 4
-      // points. Earcut requires at least 3 vertices to form a polygon.
+  const auto& island_part = island_vertices[part];
+  if (island_part.size() < 3) {
+    // Shouldn't happen as build_island_part should always produce >= 4
+    // points. Earcut requires at least 3 vertices to form a polygon.
 
-      // Add an empty list of indices
-      island_indices.emplace_back();
-      darena::log << "Vertex generation error for island!\n";
+    // Use an empty list of indices
+    island_indices[part].clear();
+    darena::log << "Vertex generation error for island!\n";
+    return;
+  }
+
+  // Earcut expects input as a vector of rings, where each ring is a vector of
+  // 2D points.
+  earcut_polygon.resize(1);
+  std::vector<std::array<float, 2>>& part_of_polygon = earcut_polygon[0];
+  part_of_polygon.clear();
+  for (const auto& island_point : island_part) {
+    part_of_polygon.push_back(
+        {island_point.position.x, island_point.position.y});
+  }
+
+  island_indices[part] = mapbox::earcut<uint>(earcut_polygon);
+}
+
+void Island::rebuild_island_mesh() {
+  // Parts are overwritten in place so their storage is reused between craters
+  n_of_parts = 0;
+  build_island_parts(0, heightmap.size());
+  for (size_t i = 0; i < n_of_parts; ++i) {
+    triangulate_part(i);
+  }
+}
+
+void Island::remesh(size_t first, size_t last) {
+  const float bottom = (float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT);
+  last = std::min(last, heightmap.size());
+  first = std::min(first, last);
+
+  // Parts are whole runs of standing points, widen the range to the points
+  // left standing on both sides
+  while (first > 0 && !are_equal(heightmap[first - 1].position.y, bottom)) {
+    first--;
+  }
+  while (last < heightmap.size() &&
+         !are_equal(heightmap[last].position.y, bottom)) {
+    last++;
+  }
+
+  // Drops the parts inside the range by swapping them past the ones in use.
+  // Render order doesn't matter, the parts never overlap.
+  for (size_t i = 0; i < n_of_parts;) {
+    if (part_ranges[i].second < first || part_ranges[i].first >= last) {
+      i++;
       continue;
     }
+    n_of_parts--;
+    std::swap(island_vertices[i], island_vertices[n_of_parts]);
+    std::swap(island_indices[i], island_indices[n_of_parts]);
+    std::swap(part_ranges[i], part_ranges[n_of_parts]);
+  }
 
-    // Earcut expects input as a vector of rings, where each ring is a vector of
-    // 2D points.
-    std::vector<std::vector<std::array<float, 2>>> earcut_input_polygon;
-    std::vector<std::array<float, 2>> part_of_polygon;
-    part_of_polygon.reserve(island_part.size());
+  size_t n_of_kept_parts = n_of_parts;
+  build_island_parts(first, last);
+  for (size_t i = n_of_kept_parts; i < n_of_parts; ++i) {
+    triangulate_part(i);
+  }
+}
 
-    for (const auto& island_point : island_part) {
-      part_of_polygon.push_back(
-          {island_point.position.x, island_point.position.y});
+bool Island::apply_terrain_delta(const darena::TerrainDelta& delta) {
+  if (!darena::apply_terrain_delta(delta, heightmap)) {
+    return false;
+  }
+
+  size_t last = delta.first + delta.heights.size();
+  heightmap_hash.update(heightmap, delta.first, last);
+  remesh(delta.first, last);
+  return true;
+}
+
+void Island::carve(float x, float y, float radius) {
+  if (!mask) {
+    return;
+  }
+
+  MaskRect touched = mask->carve_circle(x, y, radius);
+  if (touched.empty()) {
+    return;
+  }
+
+  sync_heightmap(touched);
+  collapse.settled = false;
+}
+
+bool Island::take_changed_points(size_t& first, size_t& last) {
+  if (first_changed_point == last_changed_point) {
+    return false;
+  }
+  first = first_changed_point;
+  last = last_changed_point;
+  first_changed_point = 0;
+  last_changed_point = 0;
+  return true;
+}
+
+void Island::sync_heightmap(const MaskRect& changed) {
+  if (changed.empty()) {
+    return;
+  }
+
+  for (size_t i = 0; i < heightmap.size(); i++) {
+    darena::IslandPoint& point = heightmap[i];
+    int local_x = (int)std::round(point.position.x - position.x);
+    if (local_x < changed.x0 || local_x >= changed.x1) {
+      continue;
+    }
+    point.position.y = position.y + mask->surface_y(local_x);
+    heightmap_hash.update(heightmap, i, i + 1);
+    if (first_changed_point == last_changed_point) {
+      first_changed_point = i;
+    }
+    first_changed_point = std::min(first_changed_point, i);
+    last_changed_point = std::max(last_changed_point, i + 1);
+  }
+}
+
+void Island::upload_dirty_mask() {
+  const MaskRect& dirty = mask->get_dirty();
+  if (dirty.empty()) {
+    return;
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (auto& tile : mask_tiles) {
+    int x0 = std::max(dirty.x0, tile.x);
+    int y0 = std::max(dirty.y0, tile.y);
+    int x1 = std::min(dirty.x1, tile.x + tile.width);
+    int y1 = std::min(dirty.y1, tile.y + tile.height);
+    if (x0 >= x1 || y0 >= y1) {
+      continue;
+    }
+
+    int w = x1 - x0;
+    int h = y1 - y0;
+    mask_pixels.resize((size_t)w * h);
+    for (int y = y0; y < y1; y++) {
+      const uint64_t* row = mask->row(y);
+      uint8_t* out = &mask_pixels[(size_t)(y - y0) * w];
+      for (int x = x0; x < x1; x++) {
+        uint64_t word = row[x / TERRAIN_MASK_WORD_BITS];
+        out[x - x0] = ((word >> (x % TERRAIN_MASK_WORD_BITS)) & 1) ? 255 : 0;
+      }
     }
 
-    earcut_input_polygon.push_back(part_of_polygon);
+    glBindTexture(GL_TEXTURE_2D, tile.texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x0 - tile.x, y0 - tile.y, w, h,
+                    GL_ALPHA, GL_UNSIGNED_BYTE, mask_pixels.data());
+  }
 
-    std::vector<uint> resulting_indices =
-        mapbox::earcut<uint>(earcut_input_polygon);
-    island_indices.push_back(resulting_indices);
+  mask->clear_dirty();
+}
+
+void Island::render_mask() {
+  // Textures are created here and not in the constructor so islands can be
+  // built without a GL context, like in the benchmarks
+  if (mask_tiles.empty()) {
+    for (int y = 0; y < mask->get_height(); y += TERRAIN_MASK_TILE_SIZE) {
+      for (int x = 0; x < mask->get_width(); x += TERRAIN_MASK_TILE_SIZE) {
+        MaskTile tile;
+        tile.x = x;
+        tile.y = y;
+        tile.width = std::min(TERRAIN_MASK_TILE_SIZE, mask->get_width() - x);
+        tile.height = std::min(TERRAIN_MASK_TILE_SIZE, mask->get_height() - y);
+        glGenTextures(1, &tile.texture);
+        glBindTexture(GL_TEXTURE_2D, tile.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, tile.width, tile.height, 0,
+                     GL_ALPHA, GL_UNSIGNED_BYTE, nullptr);
+        mask_tiles.push_back(tile);
+      }
+    }
+    // Fresh textures are empty, everything has to be uploaded once
+    mask->mark_all_dirty();
   }
+
+  upload_dirty_mask();
+
+  glEnable(GL_TEXTURE_2D);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glColor3f(1.0f, 1.0f, 1.0f);
+  for (const auto& tile : mask_tiles) {
+    float left = mask->origin.x + tile.x;
+    float top = mask->origin.y + tile.y;
+    float right = left + tile.width;
+    float bottom = top + tile.height;
+
+    glBindTexture(GL_TEXTURE_2D, tile.texture);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);
+    glVertex2f(left, top);
+    glTexCoord2f(1, 0);
+    glVertex2f(right, top);
+    glTexCoord2f(1, 1);
+    glVertex2f(right, bottom);
+    glTexCoord2f(0, 1);
+    glVertex2f(left, bottom);
+    glEnd();
+  }
+  glDisable(GL_BLEND);
+  glDisable(GL_TEXTURE_2D);
 }
 
 void Island::process_input(Game* game, SDL_Event* e) { return; }
 
-void Island::update(Game* game, float delta_time) { return; }
+void Island::update(Game* game, float delta_time) {
+  if (!mask || collapse.settled) {
+    return;
+  }
+
+  MaskRect changed = collapse.step(*mask, game->thread_pool.get());
+  sync_heightmap(changed);
+}
 
 void Island::render(Game* game) {
+  if (mask) {
+    render_mask();
+    return;
+  }
+
   glColor3f(1.0f, 1.0f, 1.0f);
-  for (size_t i = 0; i < island_indices.size(); ++i) {
+  for (size_t i = 0; i < n_of_parts; ++i) {
     const std::vector<uint>& indices = island_indices[i];
     const std::vector<darena::IslandPoint>& vertices = island_vertices[i];
 
@@ -1,31 +1,98 @@
 #pragma once
 
+#include <array>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include "common.h"
+#include "state_hash.h"
+#include "terrain_collapse.h"
+#include "terrain_mask.h"
+
+#define TERRAIN_MASK_TILE_SIZE 256
 
 namespace darena {
 
 struct Game;
 
+// Texture covering a TERRAIN_MASK_TILE_SIZE square of the terrain mask.
+// Splitting the mask keeps every texture under the GL size limit and lets a
+// crater re-upload only the tiles it touches.
+struct MaskTile {
+  uint texture = 0;
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
 // Defines the island position and height map.
 class Island {
  private:
   std::vector<std::vector<darena::IslandPoint>> island_vertices;
   std::vector<std::vector<uint>> island_indices;
+  // First and last heightmap index of every part
+  std::vector<std::pair<size_t, size_t>> part_ranges;
+  // Parts of the vectors above in use, the rest is kept for its storage
+  size_t n_of_parts = 0;
+  std::vector<std::vector<std::array<float, 2>>> earcut_polygon;
+  std::vector<darena::MaskTile> mask_tiles;
+  // Reused staging buffer for mask texture uploads
+  std::vector<uint8_t> mask_pixels;
+  darena::TerrainCollapse collapse;
+  // Heightmap points sync_heightmap() moved since take_changed_points(), an
+  // empty range if none
+  size_t first_changed_point = 0;
+  size_t last_changed_point = 0;
+
+  // Builds a part for every run of standing points in [begin, end)
+  void build_island_parts(size_t begin, size_t end);
+  void triangulate_part(size_t part);
+  // Moves heightmap points inside the changed columns to the mask surface
+  void sync_heightmap(const darena::MaskRect& changed);
+  void upload_dirty_mask();
+  void render_mask();
 
  public:
   darena::Vec2 position;
   std::vector<darena::IslandPoint> heightmap;
+  // Rehashed wherever heightmap points move
+  darena::HeightmapHash heightmap_hash;
+  // Only set when DARENA_BITMAP_TERRAIN is enabled
+  std::unique_ptr<darena::TerrainMask> mask;
 
   Island() {}
   Island(darena::Vec2 position, std::vector<darena::IslandPoint> heightmap)
-      : position(position), heightmap(heightmap) {}
+      : position(position), heightmap(heightmap) {
+    heightmap_hash.reset(this->heightmap);
+    if (DARENA_BITMAP_TERRAIN) {
+      mask = std::make_unique<darena::TerrainMask>(position, ISLAND_WIDTH,
+                                                   ISLAND_HEIGHT);
+      mask->fill_from_heightmap(this->heightmap);
+    }
+  }
 
   void build_island_part(size_t start_i, size_t end_i);
   void rebuild_island_mesh();
+  // Rebuilds only the parts touching heightmap points [first, last), the rest
+  // of the mesh is kept as it is
+  void remesh(size_t first, size_t last);
+
+  // Sets the heights a terrain delta carries and remeshes around them
+  bool apply_terrain_delta(const darena::TerrainDelta& delta);
   void deprecated_gl_island_render(darena::Game* game);
 
+  // Carves a crater into the mask and moves the heightmap points above it down
+  // to the new surface so the player keeps following the ground. Terrain left
+  // without support then collapses over the next frames in update().
+  void carve(float x, float y, float radius);
+  // False while terrain carve() left without support is still collapsing
+  bool is_settled() const { return !mask || collapse.settled; }
+  // Returns false if no heightmap point moved since the last call, otherwise
+  // sets [first, last) to the points that did
+  bool take_changed_points(size_t& first, size_t& last);
+
   void process_input(darena::Game* game, SDL_Event* e);
   void update(darena::Game* game, float delta_time);
   void render(darena::Game* game);
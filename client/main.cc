@@ -1,9 +1,26 @@
 #include <SDL.h>
 #include <SDL_net.h>
 
+#include <cstdlib>
+#include <cstring>
+
+#include "alloc_check.h"
 #include "engine.h"
+#include "headless.h"
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && std::strcmp(argv[1], "--alloc-check") == 0) {
+    return darena::run_allocation_check() ? 0 : 1;
+  }
+
+  if (argc > 1 && std::strcmp(argv[1], "--headless") == 0) {
+    int n_of_clients = argc > 2 ? std::atoi(argv[2]) : HEADLESS_DEFAULT_CLIENTS;
+    const char* server_ip = argc > 3 ? argv[3] : "127.0.0.1";
+    int frames = argc > 4 ? std::atoi(argv[4]) : HEADLESS_DEFAULT_FRAMES;
+    return darena::run_headless_clients(n_of_clients, server_ip, frames) ? 0
+                                                                          : 1;
+  }
 
-int main() {
   try {
     darena::Engine engine;
     bool noerr = engine.run();
@@ -0,0 +1,97 @@
+#include "particles.h"
+
+#include <SDL_opengl.h>
+
+#include <cmath>
+
+namespace darena {
+
+float ParticleSystem::random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return (random_state >> 8) * (1.0f / (1 << 24));
+}
+
+void ParticleSystem::spawn_burst(darena::Vec2 position, int n, float speed,
+                                 uint32_t rgb) {
+  n = std::min(n, PARTICLE_CAPACITY - count);
+
+  for (int i = 0; i < n; i++) {
+    int p = count + i;
+    // Mostly upwards, debris flies out of the crater
+    float angle = (float)M_PI * (1.0f + random());
+    float particle_speed = speed * (0.3f + 0.7f * random());
+    x[p] = position.x;
+    y[p] = position.y;
+    velocity_x[p] = std::cos(angle) * particle_speed;
+    velocity_y[p] = std::sin(angle) * particle_speed;
+    life[p] = max_life * (0.5f + 0.5f * random());
+    color[p] = rgb;
+  }
+
+  count += n;
+}
+
+void ParticleSystem::update(float delta_time) {
+  float* px = x.data();
+  float* py = y.data();
+  float* vx = velocity_x.data();
+  float* vy = velocity_y.data();
+  float* l = life.data();
+  float gravity_step = gravity * delta_time;
+
+  // Branch free so it vectorizes
+  for (int i = 0; i < count; i++) {
+    vy[i] += gravity_step;
+    px[i] += vx[i] * delta_time;
+    py[i] += vy[i] * delta_time;
+    l[i] -= delta_time;
+  }
+
+  // Remove dead particles by moving the last one into their slot
+  for (int i = 0; i < count;) {
+    if (l[i] > 0 && py[i] < WINDOW_HEIGHT) {
+      i++;
+      continue;
+    }
+    count--;
+    px[i] = px[count];
+    py[i] = py[count];
+    vx[i] = vx[count];
+    vy[i] = vy[count];
+    l[i] = l[count];
+    color[i] = color[count];
+  }
+}
+
+void ParticleSystem::render() {
+  if (count == 0) {
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    vertices[i * 2] = x[i];
+    vertices[i * 2 + 1] = y[i];
+    vertex_colors[i * 4] = (color[i] >> 16) & 0xff;
+    vertex_colors[i * 4 + 1] = (color[i] >> 8) & 0xff;
+    vertex_colors[i * 4 + 2] = color[i] & 0xff;
+    vertex_colors[i * 4 + 3] = (uint8_t)(255 * std::min(1.0f, life[i]));
+  }
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glPointSize(3.0f);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, vertices.data());
+  glColorPointer(4, GL_UNSIGNED_BYTE, 0, vertex_colors.data());
+
+  glDrawArrays(GL_POINTS, 0, count);
+
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisable(GL_BLEND);
+}
+
+}  // namespace darena
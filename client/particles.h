@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "common.h"
+
+#define PARTICLE_CAPACITY 4096
+#define PARTICLES_PER_IMPACT 256
+
+namespace darena {
+
+// Fixed-capacity debris particles. State is kept as structure of arrays so the
+// update loop is a straight run over plain float arrays that the compiler can
+// vectorize. All memory lives inside the object, nothing is allocated after
+// construction. When the pool is full new particles are dropped.
+class ParticleSystem {
+ private:
+  alignas(32) std::array<float, PARTICLE_CAPACITY> x;
+  alignas(32) std::array<float, PARTICLE_CAPACITY> y;
+  alignas(32) std::array<float, PARTICLE_CAPACITY> velocity_x;
+  alignas(32) std::array<float, PARTICLE_CAPACITY> velocity_y;
+  alignas(32) std::array<float, PARTICLE_CAPACITY> life;
+  std::array<uint32_t, PARTICLE_CAPACITY> color;
+
+  // Interleaved copies for the single draw call
+  std::array<float, PARTICLE_CAPACITY * 2> vertices;
+  std::array<uint8_t, PARTICLE_CAPACITY * 4> vertex_colors;
+
+  int count = 0;
+  uint32_t random_state = 0x9e3779b9;
+
+  float gravity = 600.0f;
+  float max_life = 1.2f;
+
+  // xorshift32, returns a float in [0, 1)
+  float random();
+
+ public:
+  // Spawns n particles flying out of position. rgb is packed as 0xRRGGBB.
+  void spawn_burst(darena::Vec2 position, int n, float speed, uint32_t rgb);
+  void update(float delta_time);
+  void render();
+  void clear() { count = 0; }
+
+  int size() const { return count; }
+};
+
+}  // namespace darena
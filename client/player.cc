@@ -7,6 +7,31 @@
 
 namespace darena {
 
+void PressedKeys::insert(SDL_Keycode key) {
+  if (count(key) || n_of_keys >= MAX_PRESSED_KEYS) {
+    return;
+  }
+  keys[n_of_keys++] = key;
+}
+
+void PressedKeys::erase(SDL_Keycode key) {
+  for (int i = 0; i < n_of_keys; i++) {
+    if (keys[i] == key) {
+      keys[i] = keys[--n_of_keys];
+      return;
+    }
+  }
+}
+
+int PressedKeys::count(SDL_Keycode key) const {
+  for (int i = 0; i < n_of_keys; i++) {
+    if (keys[i] == key) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 void Player::end_turn_trigger(darena::Game* game) {
   game->turn_data->shot_angle = shot_angle;
   game->turn_data->shot_power = shot_power;
@@ -81,7 +106,7 @@ void Player::update(darena::Game* game, float delta_time) {
     if (current_y_speed >= max_y_speed) {
       current_y_speed = max_y_speed;
     }
-    position.y += current_y_speed;
+    position.y = darena::to_float(darena::Real(position.y) + current_y_speed);
     if (position.y >= WINDOW_HEIGHT && game->my_turn) {
       shot_angle = 0;
       shot_power = -1;
@@ -91,50 +116,12 @@ void Player::update(darena::Game* game, float delta_time) {
     current_y_speed = 0;
   }
 
-  auto closest_it = heightmap->begin();
-  float closest_distance =
-      ISLAND_POINT_EVERY;  // If >= ISLAND_POINT_EVERY / 2 then the player is
-                           // off the island
-  for (auto it = heightmap->begin(); it != heightmap->end(); it++) {
-    Vec2 point = it->position;
-    float distance = point.x - position.x;
-    if (std::fabs(distance) < std::fabs(closest_distance)) {
-      closest_it = it;
-      closest_distance = distance;
-    }
-  }
-
-  Vec2 closest = closest_it->position;
-  Vec2 snd_closest = closest;
-  if (closest_distance < 0 && closest_it != heightmap->begin()) {
-    snd_closest = (*(--closest_it)).position;
-  } else if (closest_distance > 0 &&
-             std::next(closest_it) != heightmap->end()) {
-    snd_closest = (*(++closest_it)).position;
-  }
-  // Else closest_distance is 0 (exactly in the middle of a point), or player
-  // is falling
-
-  if (position.y + height / 2.0f < closest.y ||
-      closest_distance > ISLAND_POINT_EVERY / 2.0f ||
-      closest.y >= (float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT) - 1) {
-    falling = true;
-  } else {
-    falling = false;
-  }
-
-  float slope = 0.0f;
-  if (!are_equal(closest.x, snd_closest.x) && !falling) {
-    slope = (snd_closest.y - closest.y) / (snd_closest.x - closest.x);
-    angle_rad = std::atan(slope) / 2.0f;
-  } else {
-    angle_rad = 0.0f;
-  }
-
-  if (!falling && !are_equal(slope, 0.0f)) {
-    float y_intercept = closest.y - slope * closest.x;
-    float y_point = slope * position.x + y_intercept;
-    position.y = std::round(y_point) - height / 2.0f + 5;
+  darena::GroundContact contact =
+      darena::ground_contact(*heightmap, position.x, position.y, height);
+  falling = contact.falling;
+  angle_rad = darena::to_float(contact.tilt);
+  if (contact.on_slope) {
+    position.y = darena::to_float(contact.y);
   }
 
   if (!game->my_turn) {
@@ -146,26 +133,19 @@ void Player::update(darena::Game* game, float delta_time) {
     gas -= gas_depletion_multiplier;
     zero_movement_counter = 0;
   } else if (move_x == 0 || falling || gas <= 0) {
-    if (are_equal(current_x_speed, 0.0f)) {
-      current_x_speed = 0;
-    } else {
-      int multiplier = 1;
-      if (current_x_speed < 0) {
-        multiplier = -1;
-      }
-      zero_movement_counter++;
-      current_x_speed -= multiplier * deacceleration_x * FIXED_TIMESTEP;
-      if (zero_movement_counter >= MAX_N_OF_ZERO_IN_MOVEMENT) {
-        current_x_speed = 0;
-      }
-    }
+    current_x_speed = darena::decelerate(
+        current_x_speed, deacceleration_x * FIXED_TIMESTEP,
+        zero_movement_counter);
   }
 
   switch (shot_state) {
     case ShotState::IDLE: {
-      position.x += current_x_speed * FIXED_TIMESTEP;
-      shot_angle += move_y * shot_angle_change_speed * FIXED_TIMESTEP;
-      shot_angle = std::clamp(shot_angle, min_shot_angle, max_shot_angle);
+      position.x = darena::to_float(darena::Real(position.x) +
+                                    current_x_speed * FIXED_TIMESTEP);
+      darena::Real angle = darena::Real(shot_angle) +
+                           move_y * shot_angle_change_speed * FIXED_TIMESTEP;
+      shot_angle = darena::to_float(
+          std::clamp<darena::Real>(angle, min_shot_angle, max_shot_angle));
       if (!falling) {
         if (gas > 0) {
           game->turn_data->movements.emplace_back(move_x);
@@ -177,8 +157,10 @@ void Player::update(darena::Game* game, float delta_time) {
       break;
     }
     case ShotState::CHARGING: {
-      shot_power += move_y * shot_power_change_speed * FIXED_TIMESTEP;
-      shot_power = std::clamp(shot_power, min_shot_power, max_shot_power);
+      darena::Real power = darena::Real(shot_power) +
+                           move_y * shot_power_change_speed * FIXED_TIMESTEP;
+      shot_power = darena::to_float(
+          std::clamp<darena::Real>(power, min_shot_power, max_shot_power));
       break;
     }
     case ShotState::SHOOT: {
@@ -303,11 +285,6 @@ void Player::render(darena::Game* game) {
   glPopMatrix();
 
   // Shot power text
-  std::string message =
-      "GAS: " + std::to_string((int)gas) +
-      "\nSHOT POWER: " + std::to_string((int)shot_power) +
-      "\nSHOT_ANGLE: " + std::to_string((int)cannon_angle_deg) + "°";
-
   ImVec2 viewport_size = ImGui::GetMainViewport()->Size;
   ImVec2 window_pos = ImVec2(viewport_size.x * 0.1f, viewport_size.y * 0.05f);
 
@@ -320,7 +297,10 @@ void Player::render(darena::Game* game) {
       ImGuiWindowFlags_AlwaysAutoResize;
 
   ImGui::Begin("Player Overlay", nullptr, window_flags);
-  ImGui::TextUnformatted(message.c_str());
+  // Formatted by ImGui into its own buffer, building a std::string here would
+  // allocate every frame
+  ImGui::Text("GAS: %d\nSHOT POWER: %d\nSHOT_ANGLE: %d°", (int)gas,
+              (int)shot_power, cannon_angle_deg);
   ImGui::End();
 }
 
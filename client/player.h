@@ -2,15 +2,35 @@
 
 #include <SDL_events.h>
 
+#include <array>
+
 #include "common.h"
+#include "physics.h"
+#include "state_hash.h"
+
+// Capacity of Player::PressedKeys, more simultaneous keys are ignored
+#define MAX_PRESSED_KEYS 8
 
 namespace darena {
 
 struct Game;
 
+// Keys currently held down. Fixed capacity so key events never allocate.
+class PressedKeys {
+ private:
+  std::array<SDL_Keycode, MAX_PRESSED_KEYS> keys;
+  int n_of_keys = 0;
+
+ public:
+  void insert(SDL_Keycode key);
+  void erase(SDL_Keycode key);
+  int count(SDL_Keycode key) const;
+  void clear() { n_of_keys = 0; }
+};
+
 class Player {
  private:
-  std::unordered_set<SDL_Keycode> keys_pressed;
+  darena::PressedKeys keys_pressed;
   int move_x = 0;
   int move_y = 0;
   float gas = 100;
@@ -27,25 +47,25 @@ class Player {
   int cannon_width;
   int cannon_height;
   int move_speed = 100;
-  float gravity = 4.91f;
-  float current_y_speed = 0.0f;
-  float current_x_speed = 0.0f;
-  float max_y_speed = 1000;
-  float deacceleration_x = 500;
+  darena::Real gravity = 4.91f;
+  darena::Real current_y_speed = 0.0f;
+  darena::Real current_x_speed = 0.0f;
+  darena::Real max_y_speed = 1000;
+  darena::Real deacceleration_x = 500;
   bool falling = false;
   float angle_rad = 0.0f;
 
   const std::vector<darena::IslandPoint>* heightmap;
 
   float shot_angle = M_PI / 4.0f;
-  float shot_angle_change_speed = 3;
-  float min_shot_angle = 0.0f;
-  float max_shot_angle = M_PI / 2.0f;
+  darena::Real shot_angle_change_speed = 3;
+  darena::Real min_shot_angle = 0.0f;
+  darena::Real max_shot_angle = M_PI / 2.0f;
 
   float shot_power = 0.0f;
-  float shot_power_change_speed = 35;
-  float min_shot_power = 0.0f;
-  float max_shot_power = 100;
+  darena::Real shot_power_change_speed = 35;
+  darena::Real min_shot_power = 0.0f;
+  darena::Real max_shot_power = 100;
 
   Player(float x, float y, int width, int height)
       : position(x, y), width(width), height(height) {
@@ -59,6 +79,9 @@ class Player {
 
   void end_turn_trigger(darena::Game* game);
   void reset();
+  uint64_t state_hash() const {
+    return darena::hash_tank(position.x, shot_angle, shot_power);
+  }
 };
 
 }  // namespace darena
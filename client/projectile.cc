@@ -8,16 +8,17 @@
 namespace darena {
 
 void Projectile::hit(darena::Game* game) {
-  game->projectile_hit();
   velocity_y = 0;
   velocity_x = 0;
   no_hit_frames_count = 0;
+  // Destroys this projectile, don't touch members after it
+  game->projectile_hit();
 }
 
-int Projectile::island_hit_poll(darena::Game* game,
-                                std::vector<darena::IslandPoint>& heightmap,
+int Projectile::island_hit_poll(darena::Game* game, darena::Island& island,
                                 size_t check_index, float nose_x,
                                 float nose_y) {
+  std::vector<darena::IslandPoint>& heightmap = island.heightmap;
   darena::IslandPoint& point = heightmap[check_index];
 
   // Can't hit terrain that doesn't exist
@@ -29,32 +30,63 @@ int Projectile::island_hit_poll(darena::Game* game,
       nose_y <= (float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT) &&
       nose_x >= point.position.x - ISLAND_POINT_EVERY / 2.0f &&
       nose_x <= point.position.x + ISLAND_POINT_EVERY / 2.0f) {
-    hit(game);
     // TODO: Update to make use of strength
 
     int crater_radius = 4;
-    float center_impact_modifier = 20.0f;
+    darena::Real center_impact_modifier = 20.0f;
 
     for (int i = -crater_radius; i <= crater_radius; ++i) {
       int neighbour_i = (int)(check_index + i);
 
       if (neighbour_i >= 0 && (size_t)neighbour_i < heightmap.size()) {
-        float old_value = heightmap[neighbour_i].position.y;
-        float distance_factor =
-            1.0f - (std::abs((float)i) / (crater_radius + 1.0f));
-        float neighbor_modifier = center_impact_modifier * distance_factor;
-        float new_value = old_value + std::max(1.0f, neighbor_modifier);
-        heightmap[neighbour_i].position.y =
-            std::min((float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT), new_value);
+        darena::Real old_value = heightmap[neighbour_i].position.y;
+        darena::Real distance_factor =
+            darena::Real(1) -
+            darena::Real(std::abs(i)) / darena::Real(crater_radius + 1);
+        darena::Real neighbor_modifier =
+            center_impact_modifier * distance_factor;
+        darena::Real new_value =
+            old_value + std::max<darena::Real>(1, neighbor_modifier);
+        heightmap[neighbour_i].position.y = darena::to_float(
+            std::min<darena::Real>(ISLAND_Y_OFFSET + ISLAND_HEIGHT, new_value));
       }
     }
-
+    size_t first = check_index >= (size_t)crater_radius
+                       ? check_index - crater_radius
+                       : 0;
+    size_t last = std::min(check_index + crater_radius + 1, heightmap.size());
+    game->record_terrain_change(island, first, last);
+    island.heightmap_hash.update(heightmap, first, last);
+    island.remesh(first, last);
+
+    // After the crater, hitting ends the turn and hashes the terrain
+    game->particles.spawn_burst({nose_x, nose_y}, PARTICLES_PER_IMPACT, 200.0f,
+                                0xd0d0d0);
+    hit(game);
     return 1;
   }
 
   return 0;
 }
 
+int Projectile::island_mask_hit_poll(darena::Game* game,
+                                     darena::Island& island, float nose_x,
+                                     float nose_y) {
+  if (!island.mask->hit_world(nose_x, nose_y, 1.0f, 1.0f)) {
+    return 0;
+  }
+
+  float crater_radius = 20.0f;
+  // The points the crater and its collapse move go out with the turn, see
+  // Game::record_moved_terrain()
+  island.carve(nose_x, nose_y, crater_radius);
+  game->particles.spawn_burst({nose_x, nose_y}, PARTICLES_PER_IMPACT, 200.0f,
+                              0xd0d0d0);
+  hit(game);
+
+  return 1;
+}
+
 void Projectile::process_input(darena::Game* game, SDL_Event* e) {}
 
 void Projectile::update(darena::Game* game, float delta_time) {
@@ -62,7 +94,7 @@ void Projectile::update(darena::Game* game, float delta_time) {
 
   position.x += velocity_x * FIXED_TIMESTEP;
   position.y -= velocity_y * FIXED_TIMESTEP;
-  angle = std::atan(velocity_y / velocity_x);
+  angle = physics_atan(velocity_y / velocity_x);
 
   if (no_hit_frames_count <= max_no_hit_frames) {
     no_hit_frames_count++;
@@ -81,33 +113,50 @@ void Projectile::update(darena::Game* game, float delta_time) {
     check_h = game->player->height;
   }
 
-  float nose_x = position.x + std::cos(angle) * width / 2.0f * shot_direction;
-  float nose_y = position.y + std::sin(angle) * width / 2.0f;
+  float nose_x = darena::to_float(
+      position.x + physics_cos(angle) * width / 2 * shot_direction);
+  float nose_y =
+      darena::to_float(position.y + physics_sin(angle) * width / 2);
   if (nose_x >= check_x - check_w / 2.0f - width / 2.0f &&
       nose_x <= check_x + check_w / 2.0f + width / 2.0f &&
       nose_y >= check_y - check_h / 2.0f - height / 2.0f &&
       nose_y <= check_y + check_h / 2.0f + height / 2.0f) {
     // Hit enemy
+    game->particles.spawn_burst({nose_x, nose_y}, PARTICLES_PER_IMPACT, 250.0f,
+                                0xff8040);
+    // hit() destroys this projectile
+    bool was_simulated = from_a_simulation;
+    if (!was_simulated) {
+      // The turn hit() sends carries the ending, the server stops there
+      game->game_end = true;
+      game->game_win = true;
+    }
     hit(game);
-    game->end_game(!from_a_simulation, Game::GameEndWay::DESTROY);
+    game->end_game(!was_simulated, Game::GameEndWay::DESTROY);
     return;
   }
 
-  if (game->left_island) {
+  if (game->left_island && game->left_island->mask) {
+    if (island_mask_hit_poll(game, *game->left_island, nose_x, nose_y)) {
+      return;
+    }
+  } else if (game->left_island) {
     auto& left_heightmap = game->left_island->heightmap;
     for (size_t i = 0; i < left_heightmap.size(); ++i) {
-      if (island_hit_poll(game, left_heightmap, i, nose_x, nose_y)) {
-        game->left_island->rebuild_island_mesh();
+      if (island_hit_poll(game, *game->left_island, i, nose_x, nose_y)) {
         return;
       }
     }
   }
 
-  if (game->right_island) {
+  if (game->right_island && game->right_island->mask) {
+    if (island_mask_hit_poll(game, *game->right_island, nose_x, nose_y)) {
+      return;
+    }
+  } else if (game->right_island) {
     auto& right_heightmap = game->right_island->heightmap;
     for (size_t i = 0; i < right_heightmap.size(); ++i) {
-      if (island_hit_poll(game, right_heightmap, i, nose_x, nose_y)) {
-        game->right_island->rebuild_island_mesh();
+      if (island_hit_poll(game, *game->right_island, i, nose_x, nose_y)) {
         return;
       }
     }
@@ -125,10 +174,10 @@ void Projectile::render(darena::Game* game) {
   Vec2 top_right = {width / 2.0f, height / 2.0f};
   Vec2 bot_right = {width / 2.0f, -height / 2.0f};
   Vec2 bot_left = {-width / 2.0f, -height / 2.0f};
-  int angle_deg = angle * (180.0f / M_PI);
+  int angle_deg = darena::to_float(angle) * (180.0f / M_PI);
 
   glPushMatrix();
-  glTranslatef(position.x, position.y, 0);
+  glTranslatef(darena::to_float(position.x), darena::to_float(position.y), 0);
   glRotatef(-angle_deg, 0, 0, 1);
 
   glColor3f(0.3f, 0.75f, 0.3f);
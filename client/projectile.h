@@ -1,22 +1,24 @@
 #pragma once
 
 #include "common.h"
+#include "fixed_point.h"
 
 namespace darena {
 
 struct Game;
+class Island;
 
 class Projectile {
  private:
-  float gravity = 4.81f;
-  float velocity_multiplier = 7;
-  float initial_shot_angle = 0;
-  float angle = 0;
-  float velocity = 0;
-  float velocity_x = 0;
-  float velocity_y = 0;
+  darena::Real gravity = 4.81f;
+  darena::Real velocity_multiplier = 7;
+  darena::Real initial_shot_angle = 0;
+  darena::Real angle = 0;
+  darena::Real velocity = 0;
+  darena::Real velocity_x = 0;
+  darena::Real velocity_y = 0;
   int shot_direction = 1;
-  darena::Vec2 position;
+  darena::RealVec2 position;
   int width = 20;
   int height = 10;
   const int max_no_hit_frames = 1;
@@ -26,25 +28,29 @@ class Projectile {
  public:
   Projectile(float x, float y, float shot_angle, float shot_power,
              float shot_direction, float from_a_simulation = false)
-      : position(x, y),
+      : position{x, y},
         initial_shot_angle(shot_angle),
         velocity(shot_power),
         shot_direction(shot_direction),
         from_a_simulation(from_a_simulation) {
-    velocity_x =
-        velocity * std::cos(shot_angle) * velocity_multiplier * shot_direction;
-    velocity_y = velocity * std::sin(shot_angle) * velocity_multiplier;
+    velocity_x = velocity * physics_cos(initial_shot_angle) *
+                 velocity_multiplier * shot_direction;
+    velocity_y =
+        velocity * physics_sin(initial_shot_angle) * velocity_multiplier;
     angle = initial_shot_angle;
     darena::log << "shot_power: " << std::to_string(shot_power) << "\t"
                 << "shot_angle: " << std::to_string(shot_angle) << "\t"
-                << "velocity_x: " << std::to_string(velocity_x) << "\t"
-                << "velocity_y: " << std::to_string(velocity_y) << "\n";
+                << "velocity_x: "
+                << std::to_string(darena::to_float(velocity_x)) << "\t"
+                << "velocity_y: "
+                << std::to_string(darena::to_float(velocity_y)) << "\n";
   }
 
   void hit(darena::Game* game);
-  int island_hit_poll(darena::Game* game,
-                      std::vector<darena::IslandPoint>& heightmap,
+  int island_hit_poll(darena::Game* game, darena::Island& island,
                       size_t check_index, float nose_x, float nose_y);
+  int island_mask_hit_poll(darena::Game* game, darena::Island& island,
+                           float nose_x, float nose_y);
   void process_input(darena::Game* game, SDL_Event* e);
   void update(darena::Game* game, float delta_time);
   void render(darena::Game* game);
@@ -0,0 +1,89 @@
+#include "rollback.h"
+
+#include <SDL.h>
+
+#include <algorithm>
+
+namespace darena {
+
+void RollbackSession::start(int id, const darena::SimState& initial) {
+  local_id = id;
+  remote_id = 1 - id;
+  state = initial;
+  confirmed_frame = initial.frame - 1;
+  last_remote_input = 0;
+  rollback_frame = -1;
+  for (auto& frame_inputs : inputs) {
+    frame_inputs.fill(0);
+  }
+  stats = {};
+}
+
+bool RollbackSession::can_advance() const {
+  return state.frame - confirmed_frame < ROLLBACK_MAX_FRAMES;
+}
+
+void RollbackSession::add_remote_input(int frame, uint8_t input) {
+  if (frame != confirmed_frame + 1) {
+    darena::log << "Remote input for frame " << frame << " after "
+                << confirmed_frame << "\n";
+    return;
+  }
+
+  uint8_t& slot = inputs[frame % ROLLBACK_INPUT_FRAMES][remote_id];
+  if (frame < state.frame && slot != input &&
+      (rollback_frame < 0 || frame < rollback_frame)) {
+    rollback_frame = frame;
+  }
+  slot = input;
+  confirmed_frame = frame;
+  last_remote_input = input;
+}
+
+void RollbackSession::simulate(const darena::SimTerrain& terrain) {
+  snapshots[state.frame % ROLLBACK_MAX_FRAMES] = state;
+  darena::simulate_frame(state, inputs[state.frame % ROLLBACK_INPUT_FRAMES],
+                         terrain);
+}
+
+void RollbackSession::rollback(const darena::SimTerrain& terrain) {
+  uint64_t started_at = SDL_GetPerformanceCounter();
+  int current_frame = state.frame;
+  state = snapshots[rollback_frame % ROLLBACK_MAX_FRAMES];
+
+  // Frames after the last confirmed one are predicted again from the newest
+  // remote input
+  while (state.frame < current_frame) {
+    if (state.frame > confirmed_frame) {
+      inputs[state.frame % ROLLBACK_INPUT_FRAMES][remote_id] =
+          last_remote_input;
+    }
+    simulate(terrain);
+  }
+
+  int n_of_frames = current_frame - rollback_frame;
+  uint64_t ticks = SDL_GetPerformanceCounter() - started_at;
+  stats.n_of_rollbacks++;
+  stats.n_of_resimulated_frames += n_of_frames;
+  stats.max_rollback_frames = std::max(stats.max_rollback_frames, n_of_frames);
+  stats.last_rollback_ticks = ticks;
+  stats.max_rollback_ticks = std::max(stats.max_rollback_ticks, ticks);
+  rollback_frame = -1;
+}
+
+void RollbackSession::advance(uint8_t local_input,
+                              const darena::SimTerrain& terrain) {
+  if (rollback_frame >= 0) {
+    rollback(terrain);
+  }
+
+  std::array<uint8_t, MAX_CLIENTS>& frame_inputs =
+      inputs[state.frame % ROLLBACK_INPUT_FRAMES];
+  frame_inputs[local_id] = local_input;
+  if (state.frame > confirmed_frame) {
+    frame_inputs[remote_id] = last_remote_input;
+  }
+  simulate(terrain);
+}
+
+}  // namespace darena
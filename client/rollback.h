@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "common.h"
+#include "realtime_sim.h"
+
+// Frames the local simulation may run ahead of the last input received from
+// the other player. Also the size of the snapshot ring, so it bounds how far
+// back a rollback goes. Local play stalls when it is used up.
+#define ROLLBACK_MAX_FRAMES 16
+// Inputs are kept for twice that, the other player can be as far ahead of
+// this one as this one can be ahead of it
+#define ROLLBACK_INPUT_FRAMES (2 * ROLLBACK_MAX_FRAMES)
+
+namespace darena {
+
+struct RollbackStats {
+  int n_of_rollbacks = 0;
+  int n_of_resimulated_frames = 0;
+  int max_rollback_frames = 0;
+  // SDL_GetPerformanceCounter() ticks spent restoring and resimulating
+  uint64_t last_rollback_ticks = 0;
+  uint64_t max_rollback_ticks = 0;
+  // Frames local play waited because the prediction window was full
+  int n_of_stalls = 0;
+};
+
+// Rollback netcode for the real-time mode. Local inputs are simulated at once,
+// the other player's are predicted to repeat their last known input. The state
+// at the start of each frame is kept in a ring, when a remote input arrives
+// that differs from what was predicted the state is restored to that frame and
+// the frames since are simulated again with the corrected input.
+class RollbackSession {
+ private:
+  int local_id = 0;
+  int remote_id = 1;
+  // Indexed by frame % ROLLBACK_MAX_FRAMES and frame % ROLLBACK_INPUT_FRAMES
+  std::array<darena::SimState, ROLLBACK_MAX_FRAMES> snapshots;
+  std::array<std::array<uint8_t, MAX_CLIENTS>, ROLLBACK_INPUT_FRAMES> inputs;
+  // Last frame whose remote input arrived, -1 before the first
+  int confirmed_frame = -1;
+  uint8_t last_remote_input = 0;
+  // Earliest simulated frame that used a wrong prediction, -1 if none
+  int rollback_frame = -1;
+
+  void rollback(const darena::SimTerrain& terrain);
+  void simulate(const darena::SimTerrain& terrain);
+
+ public:
+  // Current state, state.frame is the next frame to simulate
+  darena::SimState state;
+  darena::RollbackStats stats;
+
+  void start(int id, const darena::SimState& initial);
+
+  // False while simulating another frame would leave the snapshot ring
+  bool can_advance() const;
+
+  // Remote inputs have to arrive in frame order, which the transport keeps
+  void add_remote_input(int frame, uint8_t input);
+
+  // Fixes mispredictions, then simulates the next frame with local_input
+  void advance(uint8_t local_input, const darena::SimTerrain& terrain);
+
+  // True if every input up to the current state is known, nothing in it is
+  // predicted
+  bool is_confirmed() const { return confirmed_frame >= state.frame - 1; }
+};
+
+}  // namespace darena
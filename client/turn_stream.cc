@@ -0,0 +1,123 @@
+#include "turn_stream.h"
+
+#include <SDL.h>
+
+#include <algorithm>
+
+#include "game.h"
+
+namespace darena {
+
+void JitterStats::add_sample(int depth) {
+  if (n_of_samples == 0) {
+    min_depth = depth;
+    max_depth = depth;
+  }
+  min_depth = std::min(min_depth, depth);
+  max_depth = std::max(max_depth, depth);
+  depth_sum += depth;
+  n_of_samples++;
+}
+
+void JitterStats::print() const {
+  float mean_depth = n_of_samples ? depth_sum / (float)n_of_samples : 0;
+  uint64_t stalled_ms = stalled_ticks * 1000 / SDL_GetPerformanceFrequency();
+  darena::log << "Jitter buffer depth min/mean/max: " << min_depth << "/"
+              << mean_depth << "/" << max_depth << " frames ("
+              << mean_depth * 1000 / TARGET_FPS << " ms mean), underruns: "
+              << n_of_underruns << ", stalled: " << stalled_ms << " ms\n";
+}
+
+void TurnStream::reset() {
+  std::lock_guard lock(mutex);
+  turn = std::make_unique<darena::ClientTurn>();
+  turn->id = 0;
+  turn->shot_angle = 0;
+  turn->shot_power = 0;
+  turn->final_position = {0, 0};
+  turn->movements.reserve(TURN_DATA_RESERVE);
+  turn->angle_changes.reserve(TURN_DATA_RESERVE);
+  finished = false;
+  aborted = false;
+  buffering = true;
+  stats = {};
+}
+
+void TurnStream::push(const darena::TurnInputBatch& batch) {
+  {
+    std::lock_guard lock(mutex);
+    turn->id = batch.id;
+    turn->movements.insert(turn->movements.end(), batch.movements.begin(),
+                           batch.movements.end());
+    turn->angle_changes.insert(turn->angle_changes.end(),
+                               batch.angle_changes.begin(),
+                               batch.angle_changes.end());
+    if (batch.last) {
+      turn->shot_angle = batch.shot_angle;
+      turn->shot_power = batch.shot_power;
+      turn->final_position = batch.final_position;
+      turn->start_digest = batch.start_digest;
+      turn->end_digest = batch.end_digest;
+      turn->terrain_deltas = batch.terrain_deltas;
+      finished = true;
+    }
+  }
+  inputs_arrived.notify_all();
+}
+
+void TurnStream::abort() {
+  {
+    std::lock_guard lock(mutex);
+    aborted = true;
+  }
+  inputs_arrived.notify_all();
+}
+
+bool TurnStream::is_finished() {
+  std::lock_guard lock(mutex);
+  return finished;
+}
+
+bool TurnStream::is_aborted() {
+  std::lock_guard lock(mutex);
+  return aborted;
+}
+
+bool TurnStream::wait_movement(size_t index, int& movement) {
+  std::unique_lock lock(mutex);
+  if (index >= turn->movements.size() && !finished) {
+    buffering = true;
+    if (index > 0) {
+      stats.n_of_underruns++;
+    }
+  }
+
+  if (buffering) {
+    uint64_t started_at = SDL_GetPerformanceCounter();
+    inputs_arrived.wait(lock, [&]() {
+      return finished || aborted ||
+             turn->movements.size() >= index + STREAM_JITTER_FRAMES;
+    });
+    stats.stalled_ticks += SDL_GetPerformanceCounter() - started_at;
+    buffering = false;
+  }
+
+  if (aborted || index >= turn->movements.size()) {
+    return false;
+  }
+  stats.add_sample(turn->movements.size() - index - 1);
+  movement = turn->movements[index];
+  return true;
+}
+
+std::unique_ptr<darena::ClientTurn> TurnStream::take_turn() {
+  std::unique_lock lock(mutex);
+  inputs_arrived.wait(lock, [&]() { return finished || aborted; });
+  if (aborted) {
+    return nullptr;
+  }
+  stats.print();
+  return std::move(turn);
+}
+
+}  // namespace darena
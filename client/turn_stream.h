@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "common.h"
+
+namespace darena {
+
+// How far playback of a streamed turn ran behind the inputs that had arrived.
+// Depth is the number of movements buffered ahead of the one being played,
+// every frame of depth is a frame of added latency.
+struct JitterStats {
+  int n_of_samples = 0;
+  int min_depth = 0;
+  int max_depth = 0;
+  int64_t depth_sum = 0;
+  // Times playback caught up with the stream and had to buffer again
+  int n_of_underruns = 0;
+  // SDL_GetPerformanceCounter() ticks the enemy spent waiting for inputs,
+  // including the initial buffering
+  uint64_t stalled_ticks = 0;
+
+  void add_sample(int depth);
+  void print() const;
+};
+
+// Jitter buffer between the thread receiving a streamed turn and the enemy
+// playing it. Playback starts once STREAM_JITTER_FRAMES movements are buffered
+// and buffers that many again whenever it runs dry, so uneven batch arrival
+// does not show up as stutter.
+class TurnStream {
+ private:
+  std::mutex mutex;
+  std::condition_variable inputs_arrived;
+  std::unique_ptr<darena::ClientTurn> turn;
+  bool finished = false;
+  // Set when the rest of the turn won't arrive
+  bool aborted = false;
+  bool buffering = true;
+
+ public:
+  darena::JitterStats stats;
+
+  TurnStream() { reset(); }
+
+  // Prepares for the next turn
+  void reset();
+
+  // Appends the inputs of batch, called by the receiving thread
+  void push(const darena::TurnInputBatch& batch);
+
+  // Called by the receiving thread when the connection broke mid-turn, wakes
+  // up the enemy waiting for inputs
+  void abort();
+
+  bool is_finished();
+  bool is_aborted();
+
+  // Blocks until movement index can be played and stores it in movement.
+  // Returns false once the turn finished with fewer movements or was aborted.
+  bool wait_movement(size_t index, int& movement);
+
+  // Blocks until the last batch arrived and returns the whole turn, nullptr
+  // if the turn was aborted
+  std::unique_ptr<darena::ClientTurn> take_turn();
+};
+
+}  // namespace darena
@@ -0,0 +1,108 @@
+#include "alloc_tracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "common.h"
+
+namespace darena {
+
+namespace {
+
+std::atomic<uint64_t> global_allocations{0};
+std::atomic<uint64_t> global_deallocations{0};
+std::atomic<uint64_t> global_bytes_allocated{0};
+thread_local AllocationStats thread_stats;
+
+void record_allocation(std::size_t size) {
+  global_allocations.fetch_add(1, std::memory_order_relaxed);
+  global_bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+  thread_stats.allocations++;
+  thread_stats.bytes_allocated += size;
+}
+
+void record_deallocation() {
+  global_deallocations.fetch_add(1, std::memory_order_relaxed);
+  thread_stats.deallocations++;
+}
+
+}  // namespace
+
+bool allocation_tracking_enabled() { return DARENA_ALLOC_TRACKING; }
+
+AllocationStats global_allocation_stats() {
+  AllocationStats stats;
+  stats.allocations = global_allocations.load(std::memory_order_relaxed);
+  stats.deallocations = global_deallocations.load(std::memory_order_relaxed);
+  stats.bytes_allocated =
+      global_bytes_allocated.load(std::memory_order_relaxed);
+  return stats;
+}
+
+AllocationStats thread_allocation_stats() { return thread_stats; }
+
+}  // namespace darena
+
+#if DARENA_ALLOC_TRACKING
+
+// Replacements for the global allocation functions. They live in the same
+// translation unit as the counters, so they are linked into every executable
+// that reads them.
+
+void* operator new(std::size_t size) {
+  darena::record_allocation(size);
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  darena::record_allocation(size);
+  return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  darena::record_allocation(size);
+  std::size_t align = static_cast<std::size_t>(alignment);
+  // aligned_alloc() wants the size to be a multiple of the alignment
+  std::size_t rounded = (size + align - 1) / align * align;
+  if (void* p = std::aligned_alloc(align, rounded ? rounded : align)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+  if (p) {
+    darena::record_deallocation();
+  }
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { operator delete(p); }
+void operator delete(void* p, std::align_val_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::align_val_t) noexcept {
+  operator delete(p);
+}
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+  operator delete(p);
+}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+  operator delete(p);
+}
+
+#endif
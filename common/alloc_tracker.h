@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+namespace darena {
+
+// Heap allocation counters. They only count when the build has
+// DARENA_ALLOC_TRACKING, which replaces the global operator new and delete.
+struct AllocationStats {
+  uint64_t allocations = 0;
+  uint64_t deallocations = 0;
+  uint64_t bytes_allocated = 0;
+};
+
+bool allocation_tracking_enabled();
+
+// Totals of all threads since the program started
+AllocationStats global_allocation_stats();
+
+// Totals of the calling thread since it started
+AllocationStats thread_allocation_stats();
+
+// Counts what the calling thread allocates from construction (or the last
+// restart()) until allocations() is called. Used to measure single frames.
+class AllocationScope {
+ private:
+  darena::AllocationStats start;
+
+ public:
+  AllocationScope() : start(thread_allocation_stats()) {}
+
+  void restart() { start = thread_allocation_stats(); }
+  uint64_t allocations() const {
+    return thread_allocation_stats().allocations - start.allocations;
+  }
+  uint64_t bytes_allocated() const {
+    return thread_allocation_stats().bytes_allocated - start.bytes_allocated;
+  }
+};
+
+}  // namespace darena
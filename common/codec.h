@@ -0,0 +1,286 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "msgpack.hpp"
+
+// Send protocol messages as msgpack instead of the binary codec, for reading
+// traffic with generic msgpack tools. Client and server must be built with the
+// same setting. Set with -DDARENA_MSGPACK_PROTOCOL=ON.
+#ifndef DARENA_MSGPACK_PROTOCOL
+#define DARENA_MSGPACK_PROTOCOL 0
+#endif
+
+// Lists the fields the binary codec sends, in order. Goes next to
+// MSGPACK_DEFINE, the layout is resolved at compile time from the field types.
+#define DARENA_CODEC_DEFINE(...)             \
+  template <typename Visitor>                \
+  void codec_visit(Visitor& visitor) {       \
+    visitor(__VA_ARGS__);                    \
+  }                                          \
+  template <typename Visitor>                \
+  void codec_visit(Visitor& visitor) const { \
+    visitor(__VA_ARGS__);                    \
+  }
+
+namespace darena {
+
+// Appends value to out as a LEB128 varint.
+void write_varint(std::vector<uint8_t>& out, uint64_t value);
+// Reads a LEB128 varint starting at offset and moves offset past it. Returns
+// false on truncated or oversized input.
+bool read_varint(const uint8_t* data, size_t size, size_t& offset,
+                 uint64_t& value);
+
+// Maps small negative and positive ints to small unsigned values
+inline uint64_t zigzag_encode(int value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int zigzag_decode(uint64_t value) {
+  uint32_t zigzag = (uint32_t)value;
+  return (int)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+}
+
+// Binary codec for the DARENA_CODEC_DEFINE structs. Integers are zigzag
+// varints, so the -1/0/1 movement runs of a turn take a byte each. Floats are
+// 4 little-endian bytes. Strings and vectors are a varint count followed by
+// the elements, std::array has no count. There are no field tags or type
+// markers, both sides know the layout.
+class Encoder {
+ private:
+  std::vector<uint8_t>& out;
+
+ public:
+  explicit Encoder(std::vector<uint8_t>& out) : out(out) {}
+
+  void write_unsigned(uint64_t value) {
+    if (value < 0x80) {
+      out.push_back((uint8_t)value);
+      return;
+    }
+    write_varint(out, value);
+  }
+
+  void write(int value) { write_unsigned(zigzag_encode(value)); }
+  void write(uint64_t value) { write_unsigned(value); }
+
+  // Appends already encoded bytes
+  void write_bytes(const uint8_t* data, size_t size) {
+    out.insert(out.end(), data, data + size);
+  }
+
+  void write(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint8_t bytes[4] = {(uint8_t)bits, (uint8_t)(bits >> 8),
+                        (uint8_t)(bits >> 16), (uint8_t)(bits >> 24)};
+    out.insert(out.end(), bytes, bytes + 4);
+  }
+
+  void write(const std::string& value) {
+    write_unsigned(value.size());
+    out.insert(out.end(), value.begin(), value.end());
+  }
+
+  template <typename T>
+  void write(const std::vector<T>& values) {
+    write_unsigned(values.size());
+    for (const T& value : values) {
+      write(value);
+    }
+  }
+
+  template <typename T, size_t N>
+  void write(const std::array<T, N>& values) {
+    for (const T& value : values) {
+      write(value);
+    }
+  }
+
+  template <typename T>
+  void write(const T& message) {
+    message.codec_visit(*this);
+  }
+
+  template <typename... Fields>
+  void operator()(const Fields&... fields) {
+    (write(fields), ...);
+  }
+};
+
+// Decodes into existing objects. Vectors and strings are resized in place, so
+// decoding into the same struct again reuses its storage. Stops at the first
+// error and leaves ok false.
+class Decoder {
+ private:
+  const uint8_t* data;
+  size_t size;
+  size_t offset = 0;
+
+ public:
+  bool ok = true;
+
+  Decoder(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+  bool at_end() const { return offset == size; }
+  size_t position() const { return offset; }
+
+  // Counts can never be larger than the bytes left, every element takes at
+  // least one. Keeps a corrupted count from allocating gigabytes.
+  bool read_count(size_t& count) {
+    uint64_t value;
+    if (!read_unsigned(value) || value > size - offset) {
+      ok = false;
+      return false;
+    }
+    count = value;
+    return true;
+  }
+
+  bool read_unsigned(uint64_t& value) {
+    if (offset < size && data[offset] < 0x80) {
+      value = data[offset++];
+      return true;
+    }
+    if (!read_varint(data, size, offset, value)) {
+      ok = false;
+      return false;
+    }
+    return true;
+  }
+
+  void read(int& value) {
+    uint64_t raw;
+    if (!ok || !read_unsigned(raw)) {
+      return;
+    }
+    value = zigzag_decode(raw);
+  }
+
+  void read(uint64_t& value) {
+    if (ok) {
+      read_unsigned(value);
+    }
+  }
+
+  void read(float& value) {
+    if (!ok || size - offset < 4) {
+      ok = false;
+      return;
+    }
+    const uint8_t* b = data + offset;
+    uint32_t bits = (uint32_t)b[0] | ((uint32_t)b[1] << 8) |
+                    ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    std::memcpy(&value, &bits, sizeof(value));
+    offset += 4;
+  }
+
+  void read(std::string& value) {
+    size_t count;
+    if (!ok || !read_count(count)) {
+      return;
+    }
+    value.assign((const char*)data + offset, count);
+    offset += count;
+  }
+
+  template <typename T>
+  void read(std::vector<T>& values) {
+    size_t count;
+    if (!ok || !read_count(count)) {
+      return;
+    }
+    values.resize(count);
+    for (T& value : values) {
+      read(value);
+    }
+  }
+
+  template <typename T, size_t N>
+  void read(std::array<T, N>& values) {
+    for (T& value : values) {
+      read(value);
+    }
+  }
+
+  template <typename T>
+  void read(T& message) {
+    if (ok) {
+      message.codec_visit(*this);
+    }
+  }
+
+  template <typename... Fields>
+  void operator()(Fields&... fields) {
+    (read(fields), ...);
+  }
+};
+
+// msgpack stream that appends to a byte vector
+struct VectorStream {
+  std::vector<uint8_t>& out;
+
+  void write(const char* data, size_t size) {
+    out.insert(out.end(), data, data + size);
+  }
+};
+
+// Replaces the contents of out with message, keeping its capacity
+template <typename T>
+void encode_message(const T& message, std::vector<uint8_t>& out) {
+  out.clear();
+  if (DARENA_MSGPACK_PROTOCOL) {
+    VectorStream stream{out};
+    msgpack::pack(stream, message);
+  } else {
+    Encoder encoder(out);
+    encoder.write(message);
+  }
+}
+
+// Decodes a whole message into out, reusing its storage. Returns false on
+// malformed input or trailing bytes.
+template <typename T>
+bool decode_message(const char* data, size_t size, T& out) {
+  if (DARENA_MSGPACK_PROTOCOL) {
+    try {
+      msgpack::unpacked result;
+      msgpack::unpack(result, data, size);
+      result.get().convert(out);
+      return true;
+    } catch (const std::exception& e) {
+      return false;
+    }
+  }
+
+  Decoder decoder(reinterpret_cast<const uint8_t*>(data), size);
+  decoder.read(out);
+  return decoder.ok && decoder.at_end();
+}
+
+// decode_message() unpacking msgpack into a zone kept by the caller instead of
+// a new one for every message. The zone is cleared afterwards and keeps its
+// first chunk, so decoding message after message stops allocating it.
+template <typename T>
+bool decode_message(const char* data, size_t size, T& out,
+                    msgpack::zone& zone) {
+  if (!DARENA_MSGPACK_PROTOCOL) {
+    return decode_message(data, size, out);
+  }
+  bool noerr = true;
+  try {
+    msgpack::object object = msgpack::unpack(zone, data, size);
+    object.convert(out);
+  } catch (const std::exception& e) {
+    noerr = false;
+  }
+  zone.clear();
+  return noerr;
+}
+
+}  // namespace darena
@@ -42,10 +42,37 @@ bool are_equal(float x1, float x2, float epsilon) {
   return std::fabs(x1 - x2) < epsilon;
 }
 
+void write_varint(std::vector<uint8_t>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+bool read_varint(const uint8_t* data, size_t size, size_t& offset,
+                 uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (offset >= size) {
+      return false;
+    }
+    uint8_t byte = data[offset++];
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 Logger log;
 
 Vec2 left_island_starting_position{ISLAND_X_OFFSET, ISLAND_Y_OFFSET};
 Vec2 right_island_starting_position{
     WINDOW_WIDTH - ISLAND_X_OFFSET - ISLAND_WIDTH, ISLAND_Y_OFFSET};
+// - 25 because of player width
+Vec2 left_tank_starting_position{100, 100};
+Vec2 right_tank_starting_position{WINDOW_WIDTH - 100 - 25, 100};
 
 }  // namespace darena
@@ -2,14 +2,27 @@
 
 #include <SDL_net.h>
 
+#include <cstdint>
 #include <iostream>
 #include <msgpack/adaptor/define_decl.hpp>
+#include <vector>
 
+#include "codec.h"
 #include "msgpack.hpp"
 
 #define DARENA_PORT 50325
+// Receive limit of the server's connections until their request arrived, and
+// of spectators, who only send pings and pongs
 #define DARENA_MAX_MESSAGE_LENGTH 1024
 #define DARENA_CONNECTION_AWAIT 250
+// Receive limit of a seated player and the largest turn the relay forwards, a
+// 60 s turn is about 8 KiB
+#define DARENA_MAX_TURN_LENGTH (1 << 20)
+// Admission control. Connections past this many without a request are left in
+// the listener's backlog, so clients wait in connect() rather than the server
+// buffering them. Spectators past the limit are turned away.
+#define DARENA_MAX_PENDING_CONNECTIONS 64
+#define DARENA_MAX_SPECTATORS 256
 
 #define ISLAND_X_OFFSET 80
 #define ISLAND_Y_OFFSET 300
@@ -18,6 +31,45 @@
 #define ISLAND_POINT_EVERY 13
 #define ISLAND_NUM_OF_POINTS (ISLAND_WIDTH / (ISLAND_POINT_EVERY * 1.0f))
 
+// Use the per-pixel TerrainMask for collision, craters and rendering instead of
+// the heightmap mesh. Set with -DDARENA_BITMAP_TERRAIN=ON.
+#ifndef DARENA_BITMAP_TERRAIN
+#define DARENA_BITMAP_TERRAIN 0
+#endif
+
+// Count heap allocations through replaced operator new/delete (see
+// alloc_tracker.h). Set with -DDARENA_ALLOC_TRACKING=ON.
+#ifndef DARENA_ALLOC_TRACKING
+#define DARENA_ALLOC_TRACKING 0
+#endif
+
+// Stream a turn's inputs to the opponent while it is played instead of sending
+// the whole turn at the end (see TurnInputBatch). Client and server must be
+// built with the same setting. Set with -DDARENA_STREAM_TURNS=ON.
+#ifndef DARENA_STREAM_TURNS
+#define DARENA_STREAM_TURNS 0
+#endif
+// Frames of input per streamed batch
+#define STREAM_BATCH_FRAMES 6
+// Frames the opponent buffers before playing streamed inputs, and again after
+// running dry
+#define STREAM_JITTER_FRAMES 9
+
+// Both players move and shoot at the same time, synchronized with rollback
+// (see RollbackSession) instead of taking turns. Client and server must be
+// built with the same setting. Set with -DDARENA_REALTIME_MODE=ON.
+#ifndef DARENA_REALTIME_MODE
+#define DARENA_REALTIME_MODE 0
+#endif
+
+// Run the Player, Enemy, Projectile and real-time physics in 16.16 fixed point
+// (see fixed_point.h) so replays and rollbacks are bit-identical across
+// compilers and CPUs. Client builds that play each other must use the same
+// setting. Set with -DDARENA_FIXED_POINT_PHYSICS=ON.
+#ifndef DARENA_FIXED_POINT_PHYSICS
+#define DARENA_FIXED_POINT_PHYSICS 0
+#endif
+
 #define WINDOW_WIDTH 960
 #define WINDOW_HEIGHT 540
 
@@ -25,6 +77,25 @@
 
 #define MAX_N_OF_ZERO_IN_MOVEMENT 1
 
+// Parts of a StateDigest, see StateDigestPart
+#define STATE_DIGEST_PARTS 5
+
+// Terrain deltas carry heights in 1/TERRAIN_DELTA_SCALE pixels
+#define TERRAIN_DELTA_SCALE 16
+
+// Turns the server keeps after its match keyframe before folding them into it
+#define KEYFRAME_INTERVAL_TURNS 8
+// How long the server waits for the ClientConnectionRequest of a connection
+#define DARENA_HANDSHAKE_TIMEOUT 2000
+// A player that takes longer for a turn is dropped, its seat can be resumed
+#define DARENA_TURN_TIMEOUT 120000
+// Both sides ping each other this often. A peer nothing arrived from for
+// DARENA_PEER_TIMEOUT is taken for dead, players can resume their seat.
+#define DARENA_PING_INTERVAL 1000
+#define DARENA_PEER_TIMEOUT 10000
+// How long the server keeps a match for the players that dropped
+#define DARENA_RESUME_TIMEOUT 60000
+
 namespace darena {
 
 // Handles log for client/server specific prefixes.
@@ -92,10 +163,14 @@ struct Vec2 {
   std::string to_string() const;
 
   MSGPACK_DEFINE(x, y);
+  DARENA_CODEC_DEFINE(x, y);
 };
 
 extern Vec2 left_island_starting_position;
 extern Vec2 right_island_starting_position;
+// Where the tanks drop in at the start of a match
+extern Vec2 left_tank_starting_position;
+extern Vec2 right_tank_starting_position;
 
 // Point on an island with position relative to the island and a height value.
 // Used in the island heightmap.
@@ -111,22 +186,49 @@ struct IslandPoint {
   std::string to_string() const;
 
   MSGPACK_DEFINE(position, strength);
+  DARENA_CODEC_DEFINE(position, strength);
 };
 
 struct ClientConnectionRequest {
   std::string player_name;
+  // Token of the seat to take back after a dropped connection, 0 to join
+  uint64_t resume_token = 0;
+  // Set to watch the match instead of playing. The answer has client_id -1,
+  // every message relayed to the players follows.
+  int spectate = 0;
 
   ClientConnectionRequest() {}
-  ClientConnectionRequest(std::string player_name) : player_name(player_name) {}
+  ClientConnectionRequest(std::string player_name, uint64_t resume_token = 0)
+      : player_name(player_name), resume_token(resume_token) {}
 
-  MSGPACK_DEFINE(player_name);
+  MSGPACK_DEFINE(player_name, resume_token, spectate);
+  DARENA_CODEC_DEFINE(player_name, resume_token, spectate);
 };
 
-struct ServerIDHeightmapsResponse {
-  int client_id;
-  std::array<std::vector<darena::IslandPoint>, MAX_CLIENTS> heightmaps;
+// Hash of the game state between two turns, split in parts so a mismatch
+// shows what diverged (see state_hash.h)
+struct StateDigest {
+  // Turns finished before the hashed state, -1 if there is no digest
+  int turn = -1;
+  std::array<uint64_t, STATE_DIGEST_PARTS> parts{};
 
-  MSGPACK_DEFINE(client_id, heightmaps);
+  MSGPACK_DEFINE(turn, parts);
+  DARENA_CODEC_DEFINE(turn, parts);
+};
+
+// Heights of the heightmap points [first, first + heights.size()) of one
+// island, set by the shooter's client after an impact (see terrain_delta.h).
+// Heights are quantized and stored as the difference to the previous point,
+// the first one to ISLAND_Y_OFFSET. Neighbouring points of a crater are close,
+// so each takes a byte or two as a varint whatever the terrain resolution.
+struct TerrainDelta {
+  // 0 for the left island, 1 for the right one
+  int island;
+  int first;
+  std::vector<int> heights;
+
+  MSGPACK_DEFINE(island, first, heights);
+  DARENA_CODEC_DEFINE(island, first, heights);
 };
 
 struct ClientTurn {
@@ -136,9 +238,87 @@ struct ClientTurn {
   float shot_angle;
   float shot_power;
   darena::Vec2 final_position;
+  // The state this turn started from and the one its shot left. The next turn
+  // of the other player starts from the same state, the server compares them.
+  darena::StateDigest start_digest;
+  darena::StateDigest end_digest;
+  // Terrain the shot changed, the other client applies it over its own crater
+  std::vector<darena::TerrainDelta> terrain_deltas;
 
   MSGPACK_DEFINE(id, movements, angle_changes, shot_angle, shot_power,
-                 final_position);
+                 final_position, start_digest, end_digest, terrain_deltas);
+  DARENA_CODEC_DEFINE(id, movements, angle_changes, shot_angle, shot_power,
+                      final_position, start_digest, end_digest,
+                      terrain_deltas);
+};
+
+// A tank as the last turn it played left it
+struct TankKeyframe {
+  darena::Vec2 position;
+  float shot_angle;
+  float shot_power;
+
+  MSGPACK_DEFINE(position, shot_angle, shot_power);
+  DARENA_CODEC_DEFINE(position, shot_angle, shot_power);
+};
+
+// Whole state of a turn-based match between two turns, enough to start
+// playing it from there (see keyframe.h)
+struct MatchKeyframe {
+  // Turns finished before the keyframe
+  int n_of_turns;
+  int id_playing;
+  std::array<std::vector<darena::IslandPoint>, MAX_CLIENTS> heightmaps;
+  std::array<darena::TankKeyframe, MAX_CLIENTS> tanks;
+
+  MSGPACK_DEFINE(n_of_turns, id_playing, heightmaps, tanks);
+  DARENA_CODEC_DEFINE(n_of_turns, id_playing, heightmaps, tanks);
+};
+
+// Answer to a ClientConnectionRequest. At the start of a match the keyframe
+// only holds the heightmaps, a player resuming or joining later gets the
+// server's last keyframe and the turns played since, and plays on from there.
+struct ServerIDHeightmapsResponse {
+  int client_id;
+  // Presented in ClientConnectionRequest to take the seat back
+  uint64_t resume_token;
+  darena::MatchKeyframe keyframe;
+  std::vector<darena::ClientTurn> turns;
+
+  MSGPACK_DEFINE(client_id, resume_token, keyframe, turns);
+  DARENA_CODEC_DEFINE(client_id, resume_token, keyframe, turns);
+};
+
+// Inputs played since the previous batch of a streamed turn. The last batch
+// has last set and carries the shot, the final position, the digests and the
+// terrain deltas, the other batches leave them at zero or empty.
+struct TurnInputBatch {
+  int id;
+  int last;
+  std::vector<int> movements;
+  std::vector<int> angle_changes;
+  float shot_angle;
+  float shot_power;
+  darena::Vec2 final_position;
+  darena::StateDigest start_digest;
+  darena::StateDigest end_digest;
+  std::vector<darena::TerrainDelta> terrain_deltas;
+
+  MSGPACK_DEFINE(id, last, movements, angle_changes, shot_angle, shot_power,
+                 final_position, start_digest, end_digest, terrain_deltas);
+  DARENA_CODEC_DEFINE(id, last, movements, angle_changes, shot_angle,
+                      shot_power, final_position, start_digest, end_digest,
+                      terrain_deltas);
+};
+
+// A player's input for one frame of the real-time mode, REALTIME_INPUT_* bits
+struct RealtimeInput {
+  int id;
+  int frame;
+  int input;
+
+  MSGPACK_DEFINE(id, frame, input);
+  DARENA_CODEC_DEFINE(id, frame, input);
 };
 
 std::string ipaddress_to_string(IPaddress* address);
@@ -0,0 +1,153 @@
+#include "fixed_point.h"
+
+#include <array>
+
+// Table entries per quarter turn of sine and over [0, 1] of arctangent
+#define FIXED_TRIG_TABLE_SIZE 1024
+// pi / 2 in 2.30, the precision the tables are built with
+#define HALF_PI_Q30 1686629713LL
+#define Q30_ONE (1LL << 30)
+
+namespace darena {
+
+namespace {
+
+// Rounds a 2.30 value to 16.16
+int32_t q30_to_fixed(int64_t value) {
+  return (int32_t)((value + (1 << 13)) >> 14);
+}
+
+int64_t q30_multiply(int64_t a, int64_t b) { return (a * b) >> 30; }
+
+uint64_t integer_sqrt(uint64_t value) {
+  uint64_t result = 0;
+  uint64_t bit = 1ULL << 62;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (value >= result + bit) {
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    } else {
+      result >>= 1;
+    }
+    bit >>= 2;
+  }
+  return result;
+}
+
+// Taylor series of sin(x) for x in [0, pi / 2], all in 2.30
+int64_t series_sin(int64_t x) {
+  int64_t sum = x;
+  int64_t term = x;
+  for (int n = 1; n <= 8; n++) {
+    term = -q30_multiply(q30_multiply(term, x), x) / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+// arctan(t) for t in [0, 1], all in 2.30. The argument is halved first with
+// atan(t) = 2 * atan(t / (1 + sqrt(1 + t^2))), after which the series
+// converges quickly.
+int64_t series_atan(int64_t t) {
+  int64_t root = integer_sqrt((uint64_t)(Q30_ONE + q30_multiply(t, t)) << 30);
+  int64_t half = (t << 30) / (Q30_ONE + root);
+  int64_t half_squared = q30_multiply(half, half);
+  int64_t sum = half;
+  int64_t power = half;
+  for (int n = 1; n <= 16; n++) {
+    power = q30_multiply(power, half_squared);
+    sum += (n % 2 ? -power : power) / (2 * n + 1);
+  }
+  return 2 * sum;
+}
+
+struct TrigTables {
+  std::array<int32_t, FIXED_TRIG_TABLE_SIZE + 1> sin;
+  std::array<int32_t, FIXED_TRIG_TABLE_SIZE + 1> atan;
+
+  TrigTables() {
+    for (int i = 0; i <= FIXED_TRIG_TABLE_SIZE; i++) {
+      int64_t angle = HALF_PI_Q30 * i / FIXED_TRIG_TABLE_SIZE;
+      sin[i] = q30_to_fixed(series_sin(angle));
+      atan[i] = q30_to_fixed(series_atan(Q30_ONE * i / FIXED_TRIG_TABLE_SIZE));
+    }
+  }
+};
+
+const TrigTables& trig_tables() {
+  static const TrigTables tables;
+  return tables;
+}
+
+// Interpolates table at position, a table index with 16 fraction bits
+int32_t interpolate(
+    const std::array<int32_t, FIXED_TRIG_TABLE_SIZE + 1>& table,
+    int64_t position) {
+  int index = (int)(position >> FIXED_FRACTION_BITS);
+  int64_t fraction = position & (FIXED_ONE - 1);
+  if (index >= FIXED_TRIG_TABLE_SIZE) {
+    return table[FIXED_TRIG_TABLE_SIZE];
+  }
+  int64_t step = table[index + 1] - table[index];
+  return table[index] + (int32_t)((step * fraction) >> FIXED_FRACTION_BITS);
+}
+
+}  // namespace
+
+darena::Fixed fixed_sin(darena::Fixed angle) {
+  const int32_t half_pi = q30_to_fixed(HALF_PI_Q30);
+  const int32_t two_pi = 4 * half_pi;
+  int64_t reduced = angle.raw % two_pi;
+  if (reduced < 0) {
+    reduced += two_pi;
+  }
+
+  // Position in quarter table steps over the whole turn
+  int64_t position = (reduced << 14) * FIXED_TRIG_TABLE_SIZE * FIXED_ONE /
+                     HALF_PI_Q30;
+  int64_t quarter_length = (int64_t)FIXED_TRIG_TABLE_SIZE * FIXED_ONE;
+  int quarter = (int)(position / quarter_length) % 4;
+  position %= quarter_length;
+
+  const TrigTables& tables = trig_tables();
+  int32_t value = 0;
+  if (quarter % 2 == 0) {
+    value = interpolate(tables.sin, position);
+  } else {
+    value = interpolate(tables.sin, quarter_length - position);
+  }
+  return darena::Fixed::from_raw(quarter < 2 ? value : -value);
+}
+
+darena::Fixed fixed_cos(darena::Fixed angle) {
+  return fixed_sin(angle + darena::Fixed::from_raw(q30_to_fixed(HALF_PI_Q30)));
+}
+
+darena::Fixed fixed_atan(darena::Fixed value) {
+  int64_t magnitude = value.raw < 0 ? -(int64_t)value.raw : value.raw;
+  const TrigTables& tables = trig_tables();
+
+  int32_t result = 0;
+  if (magnitude <= FIXED_ONE) {
+    result = interpolate(tables.atan, magnitude * FIXED_TRIG_TABLE_SIZE);
+  } else {
+    // atan(t) = pi / 2 - atan(1 / t)
+    int64_t inverse = ((int64_t)FIXED_ONE * FIXED_ONE) / magnitude;
+    result = q30_to_fixed(HALF_PI_Q30) -
+             interpolate(tables.atan, inverse * FIXED_TRIG_TABLE_SIZE);
+  }
+  return darena::Fixed::from_raw(value.raw < 0 ? -result : result);
+}
+
+darena::Fixed fixed_round(darena::Fixed value) {
+  int32_t mask = ~(FIXED_ONE - 1);
+  if (value.raw >= 0) {
+    return darena::Fixed::from_raw((value.raw + FIXED_ONE / 2) & mask);
+  }
+  return darena::Fixed::from_raw(-((-value.raw + FIXED_ONE / 2) & mask));
+}
+
+}  // namespace darena
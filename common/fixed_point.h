@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "common.h"
+
+#define FIXED_FRACTION_BITS 16
+#define FIXED_ONE (1 << FIXED_FRACTION_BITS)
+
+namespace darena {
+
+// Signed 16.16 fixed-point number. Every operation is integer arithmetic, so
+// results are the same on every compiler and CPU, which float math with its
+// contractions, excess precision and libm differences doesn't guarantee.
+// Range is about +-32768, enough for screen coordinates and speeds.
+//
+// Conversions from float and double round to the nearest 1/65536. They are
+// exact IEEE operations, so a float sent over the network converts to the same
+// Fixed on both ends.
+class Fixed {
+ public:
+  int32_t raw = 0;
+
+  constexpr Fixed() = default;
+  constexpr Fixed(int value) : raw(value * FIXED_ONE) {}
+  Fixed(float value) : raw((int32_t)std::lround(value * (float)FIXED_ONE)) {}
+  Fixed(double value) : raw((int32_t)std::lround(value * FIXED_ONE)) {}
+
+  static constexpr Fixed from_raw(int32_t raw) {
+    Fixed value;
+    value.raw = raw;
+    return value;
+  }
+
+  float to_float() const { return raw / (float)FIXED_ONE; }
+
+  Fixed operator-() const { return from_raw(-raw); }
+
+  Fixed& operator+=(Fixed other) {
+    raw += other.raw;
+    return *this;
+  }
+  Fixed& operator-=(Fixed other) {
+    raw -= other.raw;
+    return *this;
+  }
+  Fixed& operator*=(Fixed other) {
+    raw = (int32_t)(((int64_t)raw * other.raw) >> FIXED_FRACTION_BITS);
+    return *this;
+  }
+  // Division by zero saturates instead of trapping
+  Fixed& operator/=(Fixed other) {
+    if (other.raw == 0) {
+      raw = raw < 0 ? INT32_MIN : INT32_MAX;
+      return *this;
+    }
+    raw = (int32_t)(((int64_t)raw * FIXED_ONE) / other.raw);
+    return *this;
+  }
+
+  friend Fixed operator+(Fixed a, Fixed b) { return a += b; }
+  friend Fixed operator-(Fixed a, Fixed b) { return a -= b; }
+  friend Fixed operator*(Fixed a, Fixed b) { return a *= b; }
+  friend Fixed operator/(Fixed a, Fixed b) { return a /= b; }
+
+  friend bool operator==(Fixed a, Fixed b) { return a.raw == b.raw; }
+  friend bool operator!=(Fixed a, Fixed b) { return a.raw != b.raw; }
+  friend bool operator<(Fixed a, Fixed b) { return a.raw < b.raw; }
+  friend bool operator>(Fixed a, Fixed b) { return a.raw > b.raw; }
+  friend bool operator<=(Fixed a, Fixed b) { return a.raw <= b.raw; }
+  friend bool operator>=(Fixed a, Fixed b) { return a.raw >= b.raw; }
+};
+
+// Trigonometry through lookup tables with linear interpolation. The tables are
+// built with integer series on first use, never from libm. Angles are in
+// radians, the error is below 1e-4.
+darena::Fixed fixed_sin(darena::Fixed angle);
+darena::Fixed fixed_cos(darena::Fixed angle);
+darena::Fixed fixed_atan(darena::Fixed value);
+// Half away from zero, like std::round()
+darena::Fixed fixed_round(darena::Fixed value);
+
+// Scalar of the Player, Enemy, Projectile and real-time physics. Fixed with
+// DARENA_FIXED_POINT_PHYSICS, the game's replays and rollbacks are then
+// bit-identical everywhere. The physics_* functions below take either type,
+// so the same code compiles for both.
+using Real =
+    std::conditional_t<DARENA_FIXED_POINT_PHYSICS, darena::Fixed, float>;
+
+struct RealVec2 {
+  darena::Real x;
+  darena::Real y;
+};
+
+inline float to_float(float value) { return value; }
+inline float to_float(darena::Fixed value) { return value.to_float(); }
+inline darena::Vec2 to_vec2(const darena::RealVec2& value) {
+  return darena::Vec2(to_float(value.x), to_float(value.y));
+}
+
+inline float physics_sin(float angle) { return std::sin(angle); }
+inline float physics_cos(float angle) { return std::cos(angle); }
+inline float physics_atan(float value) { return std::atan(value); }
+inline float physics_round(float value) { return std::round(value); }
+inline float physics_abs(float value) { return std::fabs(value); }
+inline bool physics_equal(float a, float b) { return are_equal(a, b); }
+
+inline darena::Fixed physics_sin(darena::Fixed angle) {
+  return fixed_sin(angle);
+}
+inline darena::Fixed physics_cos(darena::Fixed angle) {
+  return fixed_cos(angle);
+}
+inline darena::Fixed physics_atan(darena::Fixed value) {
+  return fixed_atan(value);
+}
+inline darena::Fixed physics_round(darena::Fixed value) {
+  return fixed_round(value);
+}
+inline darena::Fixed physics_abs(darena::Fixed value) {
+  return value.raw < 0 ? -value : value;
+}
+inline bool physics_equal(darena::Fixed a, darena::Fixed b) { return a == b; }
+
+}  // namespace darena
@@ -0,0 +1,45 @@
+#include "keyframe.h"
+
+#include <cmath>
+
+#include "terrain_delta.h"
+
+namespace darena {
+
+darena::MatchKeyframe initial_keyframe(
+    const std::array<std::vector<darena::IslandPoint>, MAX_CLIENTS>&
+        heightmaps) {
+  darena::MatchKeyframe keyframe;
+  keyframe.n_of_turns = 0;
+  keyframe.id_playing = 0;
+  keyframe.heightmaps = heightmaps;
+  // Shot defaults of Player and Enemy
+  keyframe.tanks[0] = {left_tank_starting_position, (float)M_PI / 4.0f, 0};
+  keyframe.tanks[1] = {right_tank_starting_position, (float)M_PI / 4.0f, 0};
+  return keyframe;
+}
+
+bool advance_keyframe(darena::MatchKeyframe& keyframe,
+                      const darena::ClientTurn& turn) {
+  if (turn.id != keyframe.id_playing) {
+    darena::log << "Turn of id " << turn.id << " in a keyframe where id "
+                << keyframe.id_playing << " plays\n";
+    return false;
+  }
+
+  // Broken deltas are dropped like the clients drop them
+  for (const darena::TerrainDelta& delta : turn.terrain_deltas) {
+    if (delta.island < 0 || delta.island >= MAX_CLIENTS) {
+      darena::log << "Terrain delta for island " << delta.island << "\n";
+      continue;
+    }
+    darena::apply_terrain_delta(delta, keyframe.heightmaps[delta.island]);
+  }
+  keyframe.tanks[turn.id] = {turn.final_position, turn.shot_angle,
+                             turn.shot_power};
+  keyframe.n_of_turns++;
+  keyframe.id_playing = 1 - keyframe.id_playing;
+  return true;
+}
+
+}  // namespace darena
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "common.h"
+
+namespace darena {
+
+// Keyframe of a match before its first turn
+darena::MatchKeyframe initial_keyframe(
+    const std::array<std::vector<darena::IslandPoint>, MAX_CLIENTS>&
+        heightmaps);
+
+// Moves keyframe past turn: the shooter's tank is left where it shot from,
+// the terrain deltas are applied and the other player is on turn. Returns
+// false, leaving keyframe untouched, if it is not turn.id's turn.
+bool advance_keyframe(darena::MatchKeyframe& keyframe,
+                      const darena::ClientTurn& turn);
+
+}  // namespace darena
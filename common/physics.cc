@@ -0,0 +1,71 @@
+#include "physics.h"
+
+namespace darena {
+
+darena::GroundContact ground_contact(
+    const std::vector<darena::IslandPoint>& heightmap, darena::Real x,
+    darena::Real y, int height) {
+  darena::GroundContact contact = {true, 0, false, y};
+  if (heightmap.empty()) {
+    return contact;
+  }
+
+  auto closest_it = heightmap.begin();
+  // If >= ISLAND_POINT_EVERY / 2 then the tank is off the island
+  darena::Real closest_distance = ISLAND_POINT_EVERY;
+  for (auto it = heightmap.begin(); it != heightmap.end(); it++) {
+    darena::Real distance = darena::Real(it->position.x) - x;
+    if (physics_abs(distance) < physics_abs(closest_distance)) {
+      closest_it = it;
+      closest_distance = distance;
+    }
+  }
+
+  darena::Vec2 closest = closest_it->position;
+  darena::Vec2 snd_closest = closest;
+  if (closest_distance < 0 && closest_it != heightmap.begin()) {
+    snd_closest = std::prev(closest_it)->position;
+  } else if (closest_distance > 0 && std::next(closest_it) != heightmap.end()) {
+    snd_closest = std::next(closest_it)->position;
+  }
+  // Else closest_distance is 0 (exactly in the middle of a point), or the tank
+  // is falling
+
+  darena::Real closest_x = closest.x;
+  darena::Real closest_y = closest.y;
+  darena::Real snd_closest_x = snd_closest.x;
+  darena::Real snd_closest_y = snd_closest.y;
+  contact.falling =
+      y + darena::Real(height) / 2 < closest_y ||
+      closest_distance > darena::Real(ISLAND_POINT_EVERY) / 2 ||
+      closest_y >= darena::Real(ISLAND_Y_OFFSET + ISLAND_HEIGHT - 1);
+  if (contact.falling || physics_equal(closest_x, snd_closest_x)) {
+    return contact;
+  }
+
+  darena::Real slope =
+      (snd_closest_y - closest_y) / (snd_closest_x - closest_x);
+  contact.tilt = physics_atan(slope) / 2;
+  if (!physics_equal(slope, 0)) {
+    darena::Real y_intercept = closest_y - slope * closest_x;
+    darena::Real y_point = slope * x + y_intercept;
+    contact.on_slope = true;
+    contact.y = physics_round(y_point) - darena::Real(height) / 2 + 5;
+  }
+  return contact;
+}
+
+darena::Real decelerate(darena::Real speed, darena::Real deceleration_step,
+                        int& zero_movement_counter) {
+  if (physics_equal(speed, 0)) {
+    return 0;
+  }
+  zero_movement_counter++;
+  if (zero_movement_counter >= MAX_N_OF_ZERO_IN_MOVEMENT) {
+    return 0;
+  }
+  int multiplier = speed < 0 ? -1 : 1;
+  return speed - multiplier * deceleration_step;
+}
+
+}  // namespace darena
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include "common.h"
+#include "fixed_point.h"
+
+namespace darena {
+
+// How a tank stands on a heightmap
+struct GroundContact {
+  bool falling;
+  // Tilt from the slope under the tank
+  darena::Real tilt;
+  // Set when the tank is on a slope, y is then where it rests
+  bool on_slope;
+  darena::Real y;
+};
+
+// Ground handling shared by Player, Enemy and the real-time simulation, so a
+// replayed tank lands exactly where the original one did. A tank falls when it
+// is above the terrain, off the island edge or on a point blown down to the
+// island bottom.
+darena::GroundContact ground_contact(
+    const std::vector<darena::IslandPoint>& heightmap, darena::Real x,
+    darena::Real y, int height);
+
+// Horizontal speed of a tank after a frame without movement input, slowed by
+// deceleration_step. It stops after MAX_N_OF_ZERO_IN_MOVEMENT such frames.
+darena::Real decelerate(darena::Real speed, darena::Real deceleration_step,
+                        int& zero_movement_counter);
+
+}  // namespace darena
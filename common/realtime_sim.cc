@@ -0,0 +1,194 @@
+#include "realtime_sim.h"
+
+#include <algorithm>
+
+#include "physics.h"
+
+// Same tuning as Player and Projectile in the turn-based mode
+#define SIM_TIMESTEP (1.0f / 60.0f)
+#define SIM_MOVE_SPEED 100.0f
+#define SIM_TANK_GRAVITY 4.91f
+#define SIM_MAX_FALL_SPEED 1000.0f
+#define SIM_ANGLE_SPEED 3.0f
+#define SIM_POWER_SPEED 35.0f
+#define SIM_MAX_SHOT_POWER 100.0f
+#define SIM_PROJECTILE_GRAVITY 4.81f
+#define SIM_PROJECTILE_VELOCITY 7.0f
+#define SIM_PROJECTILE_WIDTH 20
+#define SIM_PROJECTILE_HEIGHT 10
+#define SIM_PROJECTILE_ARMING_FRAMES 2
+
+namespace darena {
+
+namespace {
+
+int shot_direction(int id) { return id == 0 ? 1 : -1; }
+
+void update_tank(darena::SimState& state, int id, uint8_t input,
+                 const std::vector<darena::IslandPoint>& heightmap) {
+  darena::SimTank& tank = state.tanks[id];
+
+  if (tank.falling) {
+    tank.y_speed = std::min<darena::Real>(
+        tank.y_speed + SIM_TANK_GRAVITY * SIM_TIMESTEP, SIM_MAX_FALL_SPEED);
+    tank.position.y += tank.y_speed;
+    if (tank.position.y >= WINDOW_HEIGHT) {
+      state.lost[id] = 1;
+    }
+  } else {
+    tank.y_speed = 0;
+  }
+
+  darena::GroundContact contact = darena::ground_contact(
+      heightmap, tank.position.x, tank.position.y, SIM_TANK_SIZE);
+  tank.falling = contact.falling;
+  tank.tilt = contact.tilt;
+  if (contact.on_slope) {
+    tank.position.y = contact.y;
+  }
+
+  int move_x =
+      !!(input & REALTIME_INPUT_RIGHT) - !!(input & REALTIME_INPUT_LEFT);
+  int move_y = !!(input & REALTIME_INPUT_UP) - !!(input & REALTIME_INPUT_DOWN);
+  if (tank.falling) {
+    move_x = 0;
+  }
+
+  if (tank.charging) {
+    tank.shot_power = std::clamp<darena::Real>(
+        tank.shot_power + move_y * SIM_POWER_SPEED * SIM_TIMESTEP, 0,
+        SIM_MAX_SHOT_POWER);
+  } else {
+    tank.position.x += move_x * SIM_MOVE_SPEED * SIM_TIMESTEP;
+    tank.shot_angle = std::clamp<darena::Real>(
+        tank.shot_angle + move_y * SIM_ANGLE_SPEED * SIM_TIMESTEP, 0,
+        M_PI / 2);
+  }
+
+  // The first press starts charging, the second one shoots
+  bool fire = input & REALTIME_INPUT_FIRE;
+  bool pressed = fire && !tank.fire_held;
+  tank.fire_held = fire;
+  darena::SimProjectile& projectile = state.projectiles[id];
+  if (!pressed || projectile.active) {
+    return;
+  }
+  if (!tank.charging) {
+    tank.charging = 1;
+    return;
+  }
+
+  tank.charging = 0;
+  darena::Real velocity = tank.shot_power * SIM_PROJECTILE_VELOCITY;
+  projectile.active = 1;
+  projectile.age = 0;
+  projectile.position = tank.position;
+  projectile.velocity = {
+      velocity * physics_cos(tank.shot_angle) * shot_direction(id),
+      velocity * physics_sin(tank.shot_angle)};
+}
+
+// Terrain check of Projectile::island_hit_poll(), without the crater
+bool hits_terrain(const std::vector<darena::IslandPoint>& heightmap,
+                  darena::Real nose_x, darena::Real nose_y) {
+  const darena::Real bottom = ISLAND_Y_OFFSET + ISLAND_HEIGHT;
+  const darena::Real half_width = darena::Real(ISLAND_POINT_EVERY) / 2;
+  for (const darena::IslandPoint& point : heightmap) {
+    darena::Real point_x = point.position.x;
+    darena::Real point_y = point.position.y;
+    if (point_y >= bottom) {
+      continue;
+    }
+    if (nose_y >= point_y && nose_y <= bottom &&
+        nose_x >= point_x - half_width && nose_x <= point_x + half_width) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void update_projectile(darena::SimState& state, int id,
+                       const darena::SimTerrain& terrain) {
+  darena::SimProjectile& projectile = state.projectiles[id];
+  if (!projectile.active) {
+    return;
+  }
+
+  projectile.velocity.y -= SIM_PROJECTILE_GRAVITY;
+  projectile.position.x += projectile.velocity.x * SIM_TIMESTEP;
+  projectile.position.y -= projectile.velocity.y * SIM_TIMESTEP;
+  if (projectile.age++ < SIM_PROJECTILE_ARMING_FRAMES) {
+    return;
+  }
+
+  darena::Real angle =
+      physics_atan(projectile.velocity.y / projectile.velocity.x);
+  darena::Real nose_x =
+      projectile.position.x +
+      physics_cos(angle) * SIM_PROJECTILE_WIDTH / 2 * shot_direction(id);
+  darena::Real nose_y =
+      projectile.position.y + physics_sin(angle) * SIM_PROJECTILE_WIDTH / 2;
+
+  int target = 1 - id;
+  const darena::SimTank& tank = state.tanks[target];
+  if (physics_abs(nose_x - tank.position.x) <=
+          darena::Real(SIM_TANK_SIZE + SIM_PROJECTILE_WIDTH) / 2 &&
+      physics_abs(nose_y - tank.position.y) <=
+          darena::Real(SIM_TANK_SIZE + SIM_PROJECTILE_HEIGHT) / 2) {
+    state.lost[target] = 1;
+    projectile.active = 0;
+    return;
+  }
+
+  for (const std::vector<darena::IslandPoint>* heightmap : terrain) {
+    if (heightmap && hits_terrain(*heightmap, nose_x, nose_y)) {
+      projectile.active = 0;
+      return;
+    }
+  }
+
+  if (nose_y >= WINDOW_HEIGHT + SIM_PROJECTILE_HEIGHT) {
+    projectile.active = 0;
+  }
+}
+
+}  // namespace
+
+darena::SimState initial_sim_state() {
+  darena::SimState state{};
+  state.tanks[0].position = {100, 100};
+  state.tanks[1].position = {WINDOW_WIDTH - 100 - SIM_TANK_SIZE, 100};
+  for (darena::SimTank& tank : state.tanks) {
+    tank.shot_angle = M_PI / 4;
+  }
+  for (darena::SimProjectile& projectile : state.projectiles) {
+    projectile.position = {0, 0};
+    projectile.velocity = {0, 0};
+  }
+  return state;
+}
+
+void simulate_frame(darena::SimState& state,
+                    const std::array<uint8_t, MAX_CLIENTS>& inputs,
+                    const darena::SimTerrain& terrain) {
+  for (int id = 0; id < MAX_CLIENTS; id++) {
+    if (terrain[id]) {
+      update_tank(state, id, inputs[id], *terrain[id]);
+    }
+  }
+  for (int id = 0; id < MAX_CLIENTS; id++) {
+    update_projectile(state, id, terrain);
+  }
+  state.frame++;
+}
+
+bool sim_game_over(const darena::SimState& state) {
+  for (int lost : state.lost) {
+    if (lost) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace darena
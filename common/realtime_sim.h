@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+#include "fixed_point.h"
+
+// Bits of a player's input for one frame in the real-time mode
+#define REALTIME_INPUT_LEFT 1
+#define REALTIME_INPUT_RIGHT 2
+#define REALTIME_INPUT_UP 4
+#define REALTIME_INPUT_DOWN 8
+#define REALTIME_INPUT_FIRE 16
+
+// Size of a tank, the same as Player and Enemy
+#define SIM_TANK_SIZE 25
+
+namespace darena {
+
+struct SimTank {
+  darena::RealVec2 position;
+  darena::Real y_speed;
+  // Tilt from the slope under the tank, only for rendering
+  darena::Real tilt;
+  darena::Real shot_angle;
+  darena::Real shot_power;
+  // 0 idle, 1 charging, fire presses toggle it and the second one shoots
+  int charging;
+  int fire_held;
+  int falling;
+};
+
+struct SimProjectile {
+  int active;
+  darena::RealVec2 position;
+  darena::RealVec2 velocity;
+  // Frames since it was fired, it can't hit anything during the first ones
+  int age;
+};
+
+// Everything the real-time mode simulates. Plain data, a snapshot is a copy.
+// Terrain is not part of it, projectiles do not dig craters in this mode.
+struct SimState {
+  // Index of the next frame simulate_frame() computes
+  int frame;
+  std::array<darena::SimTank, MAX_CLIENTS> tanks;
+  // One projectile in flight per player
+  std::array<darena::SimProjectile, MAX_CLIENTS> projectiles;
+  // Set for a player that fell off or got hit
+  std::array<int, MAX_CLIENTS> lost;
+};
+
+// Heightmaps the tanks stand on, indexed by player id
+using SimTerrain =
+    std::array<const std::vector<darena::IslandPoint>*, MAX_CLIENTS>;
+
+// Player 0 starts on the left island, player 1 on the right one
+darena::SimState initial_sim_state();
+
+// Advances state by one FIXED_TIMESTEP frame. The result depends only on the
+// arguments, both clients compute the same frames from the same inputs. Across
+// different compilers and CPUs that needs DARENA_FIXED_POINT_PHYSICS.
+void simulate_frame(darena::SimState& state,
+                    const std::array<uint8_t, MAX_CLIENTS>& inputs,
+                    const darena::SimTerrain& terrain);
+
+// True once a player lost
+bool sim_game_over(const darena::SimState& state);
+
+}  // namespace darena
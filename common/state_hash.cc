@@ -0,0 +1,99 @@
+#include "state_hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace darena {
+
+const char* state_digest_part_name(int part) {
+  switch (part) {
+    case DIGEST_LEFT_TERRAIN:
+      return "left terrain";
+    case DIGEST_RIGHT_TERRAIN:
+      return "right terrain";
+    case DIGEST_TANK_0:
+      return "tank 0";
+    case DIGEST_TANK_1:
+      return "tank 1";
+    case DIGEST_GAME_END:
+      return "game end";
+  }
+  return "unknown";
+}
+
+uint64_t hash_combine(uint64_t hash, uint64_t value) {
+  // splitmix64 finalizer over the running hash and the value
+  uint64_t z = hash + 0x9e3779b97f4a7c15ULL + value;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+uint64_t hash_combine(uint64_t hash, float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return hash_combine(hash, (uint64_t)bits);
+}
+
+namespace {
+
+uint64_t hash_point(size_t index, const darena::IslandPoint& point) {
+  uint64_t hash = hash_combine(0, (uint64_t)index);
+  hash = hash_combine(hash, point.position.x);
+  hash = hash_combine(hash, point.position.y);
+  return hash_combine(hash, (uint64_t)point.strength);
+}
+
+}  // namespace
+
+void HeightmapHash::reset(const std::vector<darena::IslandPoint>& heightmap) {
+  point_hashes.resize(heightmap.size());
+  sum = 0;
+  for (size_t i = 0; i < heightmap.size(); i++) {
+    point_hashes[i] = hash_point(i, heightmap[i]);
+    sum += point_hashes[i];
+  }
+}
+
+void HeightmapHash::update(const std::vector<darena::IslandPoint>& heightmap,
+                           size_t first, size_t last) {
+  if (point_hashes.size() != heightmap.size()) {
+    reset(heightmap);
+    return;
+  }
+  last = std::min(last, heightmap.size());
+  for (size_t i = first; i < last; i++) {
+    sum -= point_hashes[i];
+    point_hashes[i] = hash_point(i, heightmap[i]);
+    sum += point_hashes[i];
+  }
+}
+
+uint64_t hash_tank(float x, float shot_angle, float shot_power) {
+  uint64_t hash = hash_combine(0, x);
+  hash = hash_combine(hash, shot_angle);
+  return hash_combine(hash, shot_power);
+}
+
+uint64_t hash_game_end(bool lost_0, bool lost_1) {
+  return hash_combine(hash_combine(0, (uint64_t)lost_0), (uint64_t)lost_1);
+}
+
+bool compare_digests(const darena::StateDigest& expected, int expected_id,
+                     const darena::StateDigest& actual, int actual_id) {
+  bool equal = true;
+  for (int part = 0; part < STATE_DIGEST_PARTS; part++) {
+    if (expected.parts[part] == actual.parts[part]) {
+      continue;
+    }
+    darena::log << "Desync after turn " << expected.turn << ": "
+                << state_digest_part_name(part) << " is "
+                << expected.parts[part] << " for id " << expected_id
+                << " and " << actual.parts[part] << " for id " << actual_id
+                << "\n";
+    equal = false;
+  }
+  return equal;
+}
+
+}  // namespace darena
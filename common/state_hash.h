@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+namespace darena {
+
+// Indices into StateDigest::parts
+enum StateDigestPart {
+  DIGEST_LEFT_TERRAIN,
+  DIGEST_RIGHT_TERRAIN,
+  // Tank of the player with id 0, then id 1
+  DIGEST_TANK_0,
+  DIGEST_TANK_1,
+  DIGEST_GAME_END,
+};
+
+const char* state_digest_part_name(int part);
+
+// Mixes value into hash, the result depends on the order of the values
+uint64_t hash_combine(uint64_t hash, uint64_t value);
+// Hashes the bits, so it tells apart floats that compare nearly equal
+uint64_t hash_combine(uint64_t hash, float value);
+
+// Hash of a heightmap kept up to date point by point. The value is the sum of
+// a hash of every point with its index, so when a crater moves a few points
+// only those are hashed again.
+class HeightmapHash {
+ private:
+  std::vector<uint64_t> point_hashes;
+  uint64_t sum = 0;
+
+ public:
+  // Hashes every point
+  void reset(const std::vector<darena::IslandPoint>& heightmap);
+  // Hashes points [first, last) again after they changed
+  void update(const std::vector<darena::IslandPoint>& heightmap, size_t first,
+              size_t last);
+  uint64_t value() const { return sum; }
+};
+
+// Hash of what a tank keeps between turns. Its y and tilt follow from x and
+// the terrain once it settles, which can be a few frames apart on the two
+// clients, so they are left out.
+uint64_t hash_tank(float x, float shot_angle, float shot_power);
+
+// DIGEST_GAME_END part for whether each player lost, by id
+uint64_t hash_game_end(bool lost_0, bool lost_1);
+
+// Logs every part where the two digests of the same state differ. Returns
+// false if any does.
+bool compare_digests(const darena::StateDigest& expected, int expected_id,
+                     const darena::StateDigest& actual, int actual_id);
+
+}  // namespace darena
@@ -0,0 +1,78 @@
+#include "terrain_collapse.h"
+
+#include <algorithm>
+
+namespace darena {
+
+MaskRect TerrainCollapse::step_strip(TerrainMask& mask, int first_word,
+                                     int last_word, int max_steps) {
+  MaskRect changed;
+  int height = mask.get_height();
+
+  for (int s = 0; s < max_steps; s++) {
+    bool moved = false;
+    // Bottom up, so a pixel moves at most one row per step
+    for (int y = height - 2; y >= 0; y--) {
+      uint64_t* above = mask.row(y);
+      uint64_t* below = mask.row(y + 1);
+      for (int w = first_word; w < last_word; w++) {
+        uint64_t falling = above[w] & ~below[w];
+        if (!falling) {
+          continue;
+        }
+        above[w] &= ~falling;
+        below[w] |= falling;
+        moved = true;
+
+        int x0 = w * TERRAIN_MASK_WORD_BITS + __builtin_ctzll(falling);
+        int x1 = w * TERRAIN_MASK_WORD_BITS + TERRAIN_MASK_WORD_BITS -
+                 __builtin_clzll(falling);
+        changed.merge({x0, y, x1, y + 2});
+      }
+    }
+    if (!moved) {
+      break;
+    }
+  }
+
+  return changed;
+}
+
+MaskRect TerrainCollapse::step(TerrainMask& mask, ThreadPool* pool,
+                               int max_steps) {
+  MaskRect changed;
+  if (settled) {
+    return changed;
+  }
+
+  int words = mask.get_words_per_row();
+  int n_of_strips = 1;
+  if (pool) {
+    n_of_strips = std::min(words, pool->concurrency());
+  }
+  int words_per_strip = (words + n_of_strips - 1) / n_of_strips;
+  strip_changes.assign(n_of_strips, MaskRect());
+
+  auto job = [&](int strip) {
+    int first_word = strip * words_per_strip;
+    int last_word = std::min(words, first_word + words_per_strip);
+    strip_changes[strip] = step_strip(mask, first_word, last_word, max_steps);
+  };
+
+  if (pool) {
+    pool->parallel_for(n_of_strips, job);
+  } else {
+    job(0);
+  }
+
+  // Merged in strip order so the result is the same on every machine
+  for (const MaskRect& strip_changed : strip_changes) {
+    changed.merge(strip_changed);
+  }
+
+  mask.mark_dirty(changed);
+  settled = changed.empty();
+  return changed;
+}
+
+}  // namespace darena
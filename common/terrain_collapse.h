@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include "terrain_mask.h"
+#include "thread_pool.h"
+
+// Steps the collapse simulation may take per frame. Every step moves loose
+// pixels down by one row, so a chunk falls TERRAIN_COLLAPSE_STEPS_PER_FRAME
+// pixels per frame and the cost of a frame is bounded no matter how much
+// terrain is still moving.
+#define TERRAIN_COLLAPSE_STEPS_PER_FRAME 4
+
+namespace darena {
+
+// Falling sand simulation on a TerrainMask. A solid pixel with air below it
+// falls by one row per step until it lands on something, the bottom row of the
+// mask being the floor.
+//
+// Pixels only move straight down, so columns never interact. The mask is split
+// into strips of whole 64-bit words that are stepped in parallel, each word
+// moving 64 columns at once. Since strips are independent the result does not
+// depend on the number of threads or the scheduling, which keeps clients and
+// the server bit-identical.
+class TerrainCollapse {
+ private:
+  // Rectangle changed by every strip in the last step() call
+  std::vector<darena::MaskRect> strip_changes;
+
+  // Steps words [first_word, last_word) up to max_steps times
+  static darena::MaskRect step_strip(darena::TerrainMask& mask, int first_word,
+                                     int last_word, int max_steps);
+
+ public:
+  bool settled = true;
+
+  // Advances the simulation by at most max_steps steps. pool may be null, in
+  // which case everything runs on the calling thread. Returns the rectangle of
+  // the mask that changed.
+  darena::MaskRect step(darena::TerrainMask& mask, darena::ThreadPool* pool,
+                        int max_steps = TERRAIN_COLLAPSE_STEPS_PER_FRAME);
+};
+
+}  // namespace darena
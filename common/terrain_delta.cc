@@ -0,0 +1,46 @@
+#include "terrain_delta.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace darena {
+
+void encode_terrain_delta(std::vector<darena::IslandPoint>& heightmap,
+                          int island, size_t first, size_t last,
+                          darena::TerrainDelta& delta) {
+  last = std::min(last, heightmap.size());
+  first = std::min(first, last);
+  delta.island = island;
+  delta.first = (int)first;
+  delta.heights.clear();
+
+  int previous = ISLAND_Y_OFFSET * TERRAIN_DELTA_SCALE;
+  for (size_t i = first; i < last; i++) {
+    float& y = heightmap[i].position.y;
+    int height = (int)std::lround(y * TERRAIN_DELTA_SCALE);
+    y = height / (float)TERRAIN_DELTA_SCALE;
+    delta.heights.push_back(height - previous);
+    previous = height;
+  }
+}
+
+bool apply_terrain_delta(const darena::TerrainDelta& delta,
+                         std::vector<darena::IslandPoint>& heightmap) {
+  if (delta.first < 0 || (size_t)delta.first > heightmap.size() ||
+      delta.heights.size() > heightmap.size() - delta.first) {
+    darena::log << "Terrain delta for points " << delta.first << " to "
+                << delta.first + delta.heights.size() << " of "
+                << heightmap.size() << "\n";
+    return false;
+  }
+
+  int height = ISLAND_Y_OFFSET * TERRAIN_DELTA_SCALE;
+  for (size_t i = 0; i < delta.heights.size(); i++) {
+    height += delta.heights[i];
+    heightmap[delta.first + i].position.y =
+        height / (float)TERRAIN_DELTA_SCALE;
+  }
+  return true;
+}
+
+}  // namespace darena
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "common.h"
+
+namespace darena {
+
+// Fills delta with the heights of heightmap points [first, last) of island,
+// 0 for the left one and 1 for the right one. The points are snapped to the
+// quantized heights, so the sender keeps exactly what receivers apply.
+void encode_terrain_delta(std::vector<darena::IslandPoint>& heightmap,
+                          int island, size_t first, size_t last,
+                          darena::TerrainDelta& delta);
+
+// Sets the heights delta carries. Returns false, leaving heightmap untouched,
+// if the range does not fit it.
+bool apply_terrain_delta(const darena::TerrainDelta& delta,
+                         std::vector<darena::IslandPoint>& heightmap);
+
+}  // namespace darena
@@ -0,0 +1,189 @@
+#include "terrain_mask.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace darena {
+
+void MaskRect::merge(const MaskRect& other) {
+  if (other.empty()) {
+    return;
+  }
+  if (empty()) {
+    *this = other;
+    return;
+  }
+  x0 = std::min(x0, other.x0);
+  y0 = std::min(y0, other.y0);
+  x1 = std::max(x1, other.x1);
+  y1 = std::max(y1, other.y1);
+}
+
+TerrainMask::TerrainMask(darena::Vec2 origin, int width, int height)
+    : width(width),
+      height(height),
+      words_per_row((width + TERRAIN_MASK_WORD_BITS - 1) /
+                    TERRAIN_MASK_WORD_BITS),
+      bits((size_t)words_per_row * height, 0),
+      origin(origin) {}
+
+uint64_t TerrainMask::range_bits(int w, int x0, int x1) {
+  int word_start = w * TERRAIN_MASK_WORD_BITS;
+  int lo = std::max(x0, word_start) - word_start;
+  int hi = std::min(x1, word_start + TERRAIN_MASK_WORD_BITS) - word_start;
+  if (hi <= lo) {
+    return 0;
+  }
+  if (hi - lo == TERRAIN_MASK_WORD_BITS) {
+    return ~0ull;
+  }
+  return ((1ull << (hi - lo)) - 1) << lo;
+}
+
+void TerrainMask::fill_from_heightmap(
+    const std::vector<darena::IslandPoint>& heightmap) {
+  std::fill(bits.begin(), bits.end(), 0);
+  mark_all_dirty();
+
+  if (heightmap.empty()) {
+    return;
+  }
+
+  float bottom = (float)(ISLAND_Y_OFFSET + ISLAND_HEIGHT);
+  float step = ISLAND_WIDTH / ISLAND_NUM_OF_POINTS;
+
+  for (int x = 0; x < width; x++) {
+    float world_x = origin.x + x;
+    // Heightmap points are evenly spaced, so the segment is found directly
+    float t = (world_x - heightmap.front().position.x) / step;
+    if (t < 0 || t > heightmap.size() - 1) {
+      continue;
+    }
+    size_t i = std::min((size_t)t, heightmap.size() - 1);
+    size_t j = std::min(i + 1, heightmap.size() - 1);
+    const Vec2& a = heightmap[i].position;
+    const Vec2& b = heightmap[j].position;
+
+    // Craters that reach the bottom split the island, keep the gap open
+    if (a.y >= bottom || b.y >= bottom) {
+      continue;
+    }
+
+    float frac = t - i;
+    float surface = a.y + (b.y - a.y) * frac;
+    int first_row = std::max(0, (int)std::ceil(surface - origin.y));
+    uint64_t bit = 1ull << (x % TERRAIN_MASK_WORD_BITS);
+    for (int y = first_row; y < height; y++) {
+      bits[y * words_per_row + x / TERRAIN_MASK_WORD_BITS] |= bit;
+    }
+  }
+}
+
+bool TerrainMask::test(int x, int y) const {
+  if (x < 0 || y < 0 || x >= width || y >= height) {
+    return false;
+  }
+  uint64_t word = bits[y * words_per_row + x / TERRAIN_MASK_WORD_BITS];
+  return (word >> (x % TERRAIN_MASK_WORD_BITS)) & 1;
+}
+
+void TerrainMask::set(int x, int y, bool solid) {
+  if (x < 0 || y < 0 || x >= width || y >= height) {
+    return;
+  }
+  uint64_t& word = bits[y * words_per_row + x / TERRAIN_MASK_WORD_BITS];
+  uint64_t bit = 1ull << (x % TERRAIN_MASK_WORD_BITS);
+  if (solid) {
+    word |= bit;
+  } else {
+    word &= ~bit;
+  }
+  dirty.merge({x, y, x + 1, y + 1});
+}
+
+bool TerrainMask::any_in_rect(int x0, int y0, int x1, int y1) const {
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, width);
+  y1 = std::min(y1, height);
+  if (x0 >= x1 || y0 >= y1) {
+    return false;
+  }
+
+  int first_word = x0 / TERRAIN_MASK_WORD_BITS;
+  int last_word = (x1 - 1) / TERRAIN_MASK_WORD_BITS;
+  for (int y = y0; y < y1; y++) {
+    const uint64_t* r = row(y);
+    for (int w = first_word; w <= last_word; w++) {
+      if (r[w] & range_bits(w, x0, x1)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool TerrainMask::hit_world(float x, float y, float half_width,
+                            float half_height) const {
+  int x0 = (int)std::floor(x - half_width - origin.x);
+  int y0 = (int)std::floor(y - half_height - origin.y);
+  int x1 = (int)std::ceil(x + half_width - origin.x) + 1;
+  int y1 = (int)std::ceil(y + half_height - origin.y) + 1;
+  return any_in_rect(x0, y0, x1, y1);
+}
+
+MaskRect TerrainMask::carve_circle(float center_x, float center_y,
+                                   float radius) {
+  MaskRect touched;
+  float cx = center_x - origin.x;
+  float cy = center_y - origin.y;
+  int y0 = std::max(0, (int)std::floor(cy - radius));
+  int y1 = std::min(height, (int)std::ceil(cy + radius) + 1);
+
+  for (int y = y0; y < y1; y++) {
+    float dy = y - cy;
+    float span_sq = radius * radius - dy * dy;
+    if (span_sq < 0) {
+      continue;
+    }
+    float span = std::sqrt(span_sq);
+    int x0 = std::max(0, (int)std::ceil(cx - span));
+    int x1 = std::min(width, (int)std::floor(cx + span) + 1);
+    if (x0 >= x1) {
+      continue;
+    }
+
+    uint64_t* r = &bits[y * words_per_row];
+    bool row_changed = false;
+    for (int w = x0 / TERRAIN_MASK_WORD_BITS;
+         w <= (x1 - 1) / TERRAIN_MASK_WORD_BITS; w++) {
+      uint64_t range = range_bits(w, x0, x1);
+      if (r[w] & range) {
+        r[w] &= ~range;
+        row_changed = true;
+      }
+    }
+    if (row_changed) {
+      touched.merge({x0, y, x1, y + 1});
+    }
+  }
+
+  dirty.merge(touched);
+  return touched;
+}
+
+int TerrainMask::surface_y(int x) const {
+  if (x < 0 || x >= width) {
+    return height;
+  }
+  int w = x / TERRAIN_MASK_WORD_BITS;
+  uint64_t bit = 1ull << (x % TERRAIN_MASK_WORD_BITS);
+  for (int y = 0; y < height; y++) {
+    if (bits[y * words_per_row + w] & bit) {
+      return y;
+    }
+  }
+  return height;
+}
+
+}  // namespace darena
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+#define TERRAIN_MASK_WORD_BITS 64
+
+namespace darena {
+
+// Axis aligned rectangle in mask pixel coordinates covering [x0, x1) x [y0,
+// y1). Used to track which part of the mask changed since the last upload.
+struct MaskRect {
+  int x0 = 0;
+  int y0 = 0;
+  int x1 = 0;
+  int y1 = 0;
+
+  bool empty() const { return x0 >= x1 || y0 >= y1; }
+  void merge(const MaskRect& other);
+};
+
+// Bit-packed per-pixel terrain. A set bit is solid ground, a cleared bit is
+// air. Rows are stored as 64-bit words so collision tests and carving work on
+// 64 pixels at a time, which keeps both cheap no matter how large the arena
+// is.
+class TerrainMask {
+ private:
+  int width = 0;
+  int height = 0;
+  int words_per_row = 0;
+  std::vector<uint64_t> bits;
+  MaskRect dirty;
+
+  // Bits of word w that fall inside the columns [x0, x1)
+  static uint64_t range_bits(int w, int x0, int x1);
+
+ public:
+  // World position of pixel (0, 0)
+  darena::Vec2 origin;
+
+  TerrainMask() : origin(0, 0) {}
+  TerrainMask(darena::Vec2 origin, int width, int height);
+
+  int get_width() const { return width; }
+  int get_height() const { return height; }
+  int get_words_per_row() const { return words_per_row; }
+  const uint64_t* row(int y) const { return &bits[y * words_per_row]; }
+  uint64_t* row(int y) { return &bits[y * words_per_row]; }
+
+  // Fills everything below the heightmap polyline. Points sitting on the
+  // island bottom are treated as already destroyed.
+  void fill_from_heightmap(const std::vector<darena::IslandPoint>& heightmap);
+
+  bool test(int x, int y) const;
+  void set(int x, int y, bool solid);
+
+  // Returns true if any pixel inside [x0, x1) x [y0, y1) is solid
+  bool any_in_rect(int x0, int y0, int x1, int y1) const;
+
+  // Same as any_in_rect() but with a world space box around (x, y)
+  bool hit_world(float x, float y, float half_width, float half_height) const;
+
+  // Clears a filled circle given in world coordinates. Returns the rectangle
+  // that was touched, which is empty if no solid pixel was removed.
+  MaskRect carve_circle(float center_x, float center_y, float radius);
+
+  // Returns the first solid row in column x, or height if the column is empty
+  int surface_y(int x) const;
+
+  // Everything changed since the last clear_dirty()
+  const MaskRect& get_dirty() const { return dirty; }
+  void clear_dirty() { dirty = MaskRect(); }
+  void mark_dirty(const MaskRect& rect) { dirty.merge(rect); }
+  void mark_all_dirty() { dirty = {0, 0, width, height}; }
+};
+
+}  // namespace darena
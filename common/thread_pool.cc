@@ -0,0 +1,98 @@
+#include "thread_pool.h"
+
+namespace darena {
+
+ThreadPool::ThreadPool(int n_of_workers) {
+  for (int i = 0; i < n_of_workers; i++) {
+    workers.emplace_back([this]() { this->worker_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  work_cv.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::worker_loop() {
+  uint64_t seen_generation = 0;
+  while (true) {
+    {
+      std::unique_lock lock(mutex);
+      work_cv.wait(lock, [this, seen_generation] {
+        return stopping || generation != seen_generation;
+      });
+      if (stopping) {
+        return;
+      }
+      seen_generation = generation;
+    }
+
+    while (run_one()) {
+    }
+  }
+}
+
+bool ThreadPool::run_one() {
+  JobFunction function;
+  void* context;
+  int index;
+  {
+    std::lock_guard lock(mutex);
+    if (next_job >= job_count) {
+      return false;
+    }
+    function = job_function;
+    context = job_context;
+    index = next_job++;
+  }
+
+  function(context, index);
+
+  {
+    std::lock_guard lock(mutex);
+    jobs_done++;
+    if (jobs_done == job_count) {
+      done_cv.notify_all();
+    }
+  }
+  return true;
+}
+
+void ThreadPool::run(int count, JobFunction function, void* context) {
+  if (count <= 0) {
+    return;
+  }
+
+  // Not worth waking anybody up
+  if (workers.empty() || count == 1) {
+    for (int i = 0; i < count; i++) {
+      function(context, i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard lock(mutex);
+    job_function = function;
+    job_context = context;
+    job_count = count;
+    next_job = 0;
+    jobs_done = 0;
+    generation++;
+  }
+  work_cv.notify_all();
+
+  while (run_one()) {
+  }
+
+  std::unique_lock lock(mutex);
+  done_cv.wait(lock, [this] { return jobs_done == job_count; });
+}
+
+}  // namespace darena
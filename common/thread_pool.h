@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace darena {
+
+// Fixed set of worker threads for data parallel jobs. parallel_for() hands out
+// job indices to the workers and the calling thread, then blocks until all of
+// them are done. Jobs are passed as a plain function pointer and context so
+// dispatching does not allocate.
+class ThreadPool {
+ private:
+  using JobFunction = void (*)(void* context, int index);
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  JobFunction job_function = nullptr;
+  void* job_context = nullptr;
+  int job_count = 0;
+  int next_job = 0;
+  int jobs_done = 0;
+  uint64_t generation = 0;
+  bool stopping = false;
+
+  void worker_loop();
+  // Runs one pending job, returns false if there was none left
+  bool run_one();
+  void run(int count, JobFunction function, void* context);
+
+ public:
+  explicit ThreadPool(int n_of_workers);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Number of threads that work on a parallel_for(), including the caller
+  int concurrency() const { return workers.size() + 1; }
+
+  // Calls job(i) for every i in [0, count)
+  template <typename F>
+  void parallel_for(int count, F&& job) {
+    using Job = std::remove_reference_t<F>;
+    run(
+        count,
+        [](void* context, int index) { (*static_cast<Job*>(context))(index); },
+        &job);
+  }
+};
+
+}  // namespace darena
@@ -0,0 +1,192 @@
+#include "timer_wheel.h"
+
+#include <chrono>
+
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+namespace darena {
+
+namespace {
+
+// Ticks one slot of level spans
+uint64_t level_span(int level) {
+  return 1ULL << (TIMER_WHEEL_SLOT_BITS * level);
+}
+
+int slot_of(uint64_t tick, int level) {
+  return (tick >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+}
+
+// Slots from index to the first occupied one after it, wrapping around to
+// index itself last. 0 when none is occupied.
+int distance_to_occupied(uint64_t occupied, int index) {
+  if (occupied == 0) {
+    return 0;
+  }
+  int shift = (index + 1) & TIMER_WHEEL_SLOT_MASK;
+  uint64_t rotated = occupied;
+  if (shift != 0) {
+    rotated = (occupied >> shift) | (occupied << (64 - shift));
+  }
+  return __builtin_ctzll(rotated) + 1;
+}
+
+}  // namespace
+
+uint64_t monotonic_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Timer::~Timer() {
+  if (wheel) {
+    wheel->cancel(*this);
+  }
+}
+
+TimerWheel::TimerWheel(uint64_t now_ms)
+    : current_tick(now_ms / TIMER_WHEEL_TICK_MS) {
+  for (auto& level : slots) {
+    for (TimerLink& head : level) {
+      head.prev = &head;
+      head.next = &head;
+    }
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    for (TimerLink& head : slots[level]) {
+      while (head.next != &head) {
+        unlink(*static_cast<darena::Timer*>(head.next));
+      }
+    }
+  }
+}
+
+void TimerWheel::insert(darena::Timer& timer) {
+  uint64_t delta = timer.expires_at - current_tick;
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         delta >= level_span(level + 1)) {
+    level++;
+  }
+  if (delta >= level_span(TIMER_WHEEL_LEVELS)) {
+    timer.expires_at = current_tick + level_span(TIMER_WHEEL_LEVELS) - 1;
+  }
+
+  int slot = slot_of(timer.expires_at, level);
+  TimerLink& head = slots[level][slot];
+  timer.prev = head.prev;
+  timer.next = &head;
+  head.prev->next = &timer;
+  head.prev = &timer;
+  timer.wheel = this;
+  timer.level = level;
+  timer.slot = slot;
+  occupied[level] |= 1ULL << slot;
+  n_of_timers++;
+}
+
+void TimerWheel::unlink(darena::Timer& timer) {
+  timer.prev->next = timer.next;
+  timer.next->prev = timer.prev;
+  timer.prev = nullptr;
+  timer.next = nullptr;
+  timer.wheel = nullptr;
+  TimerLink& head = slots[timer.level][timer.slot];
+  if (head.next == &head) {
+    occupied[timer.level] &= ~(1ULL << timer.slot);
+  }
+  n_of_timers--;
+}
+
+void TimerWheel::schedule(darena::Timer& timer, uint64_t deadline_ms) {
+  if (timer.wheel) {
+    timer.wheel->cancel(timer);
+  }
+  // Rounded up, a timer never expires before its deadline
+  uint64_t tick =
+      (deadline_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+  // The current tick was processed already
+  timer.expires_at = tick > current_tick ? tick : current_tick + 1;
+  insert(timer);
+}
+
+void TimerWheel::cancel(darena::Timer& timer) {
+  if (timer.wheel == this) {
+    unlink(timer);
+  }
+}
+
+void TimerWheel::cascade(int level, int slot) {
+  TimerLink& head = slots[level][slot];
+  while (head.next != &head) {
+    darena::Timer& timer = *static_cast<darena::Timer*>(head.next);
+    unlink(timer);
+    // Within a span of the level below now, or due at the current tick
+    insert(timer);
+  }
+}
+
+void TimerWheel::advance(uint64_t now_ms) {
+  uint64_t target = now_ms / TIMER_WHEEL_TICK_MS;
+  while (current_tick < target) {
+    // Nothing to run or move down, an idle wheel catches up at once
+    if (n_of_timers == 0) {
+      current_tick = target;
+      return;
+    }
+
+    current_tick++;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      if (slot_of(current_tick, level - 1) != 0) {
+        break;
+      }
+      cascade(level, slot_of(current_tick, level));
+    }
+
+    // Callbacks may schedule and cancel timers, including in this slot
+    TimerLink& head = slots[0][slot_of(current_tick, 0)];
+    while (head.next != &head) {
+      darena::Timer& timer = *static_cast<darena::Timer*>(head.next);
+      unlink(timer);
+      if (timer.on_expire) {
+        timer.on_expire();
+      }
+    }
+  }
+}
+
+int TimerWheel::next_timeout_ms(uint64_t now_ms) const {
+  if (n_of_timers == 0) {
+    return -1;
+  }
+
+  // The next tick that expires a timer or moves a slot down
+  uint64_t next_tick = UINT64_MAX;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    int distance = distance_to_occupied(occupied[level],
+                                        slot_of(current_tick, level));
+    if (distance == 0) {
+      continue;
+    }
+    uint64_t span = level_span(level);
+    uint64_t tick = ((current_tick >> (TIMER_WHEEL_SLOT_BITS * level)) +
+                     distance) *
+                    span;
+    if (tick < next_tick) {
+      next_tick = tick;
+    }
+  }
+
+  uint64_t next_ms = next_tick * TIMER_WHEEL_TICK_MS;
+  if (next_ms <= now_ms) {
+    return 0;
+  }
+  uint64_t timeout = next_ms - now_ms;
+  return timeout > INT32_MAX ? INT32_MAX : (int)timeout;
+}
+
+}  // namespace darena
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+// Milliseconds per tick, timers expire at the first tick at or after their
+// deadline
+#define TIMER_WHEEL_TICK_MS 10
+// Each level has 1 << TIMER_WHEEL_SLOT_BITS slots and every slot covers a
+// whole rotation of the level below. Four levels of 64 reach about 46 hours,
+// later deadlines expire then.
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+namespace darena {
+
+// Milliseconds of the steady clock, the time base of a TimerWheel
+uint64_t monotonic_ms();
+
+class TimerWheel;
+
+// Intrusive list node, the slots of a TimerWheel are circular lists of them
+struct TimerLink {
+  TimerLink* prev = nullptr;
+  TimerLink* next = nullptr;
+};
+
+// A deadline that calls on_expire once when it passes. Timers are owned by
+// whoever schedules them and cancel themselves when destroyed, the wheel only
+// links them into its slots. on_expire may schedule its timer again but must
+// not destroy it.
+class Timer : private TimerLink {
+ public:
+  std::function<void()> on_expire;
+
+  Timer() = default;
+  explicit Timer(std::function<void()> on_expire)
+      : on_expire(std::move(on_expire)) {}
+  ~Timer();
+
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+  bool is_pending() const { return wheel != nullptr; }
+
+ private:
+  friend class TimerWheel;
+
+  TimerWheel* wheel = nullptr;
+  uint64_t expires_at = 0;
+  int level = 0;
+  int slot = 0;
+};
+
+// Hierarchical timing wheel. Scheduling and cancelling are O(1), advancing
+// is O(1) per tick plus the timers it expires. A timer far out sits in a
+// coarse level and moves down a level each time that level's slot comes up,
+// so each timer moves at most TIMER_WHEEL_LEVELS - 1 times. Not thread safe,
+// callbacks run on the thread calling advance().
+class TimerWheel {
+ private:
+  std::array<std::array<TimerLink, TIMER_WHEEL_SLOTS>, TIMER_WHEEL_LEVELS>
+      slots;
+  // Bit i set when slot i of the level holds a timer
+  std::array<uint64_t, TIMER_WHEEL_LEVELS> occupied{};
+  // Last tick advance() processed
+  uint64_t current_tick;
+  int n_of_timers = 0;
+
+  void insert(darena::Timer& timer);
+  void unlink(darena::Timer& timer);
+  // Moves the timers of a slot down to the levels below
+  void cascade(int level, int slot);
+
+ public:
+  explicit TimerWheel(uint64_t now_ms = darena::monotonic_ms());
+  ~TimerWheel();
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // Schedules timer to expire at deadline_ms, moving it if it is pending. A
+  // deadline already passed expires at the next advance().
+  void schedule(darena::Timer& timer, uint64_t deadline_ms);
+  void cancel(darena::Timer& timer);
+
+  // Runs the timers whose deadline is at or before now_ms
+  void advance(uint64_t now_ms = darena::monotonic_ms());
+
+  // Milliseconds a caller can block before the next advance() has work, -1
+  // when no timer is pending. Never later than the earliest deadline, it can
+  // be earlier when a coarse slot has to be moved down first.
+  int next_timeout_ms(uint64_t now_ms = darena::monotonic_ms()) const;
+
+  int size() const { return n_of_timers; }
+};
+
+}  // namespace darena
@@ -0,0 +1,204 @@
+#include "transport.h"
+
+#include <chrono>
+
+#include "codec.h"
+#include "common.h"
+
+// A wait_frame() that took longer slept until the frame arrived
+#define FRAME_WAKE_UP_US 1000
+
+namespace darena {
+
+namespace {
+
+enum ControlKind { CONTROL_PING = 1, CONTROL_PONG = 2 };
+
+// Follows an empty frame. A pong echoes its ping's sent_at_us and says how
+// long the ping was held before the pong went out, give or take held_error_us.
+struct ControlFrame {
+  int kind;
+  uint64_t sent_at_us;
+  uint64_t held_us = 0;
+  uint64_t held_error_us = 0;
+
+  MSGPACK_DEFINE(kind, sent_at_us, held_us, held_error_us);
+  DARENA_CODEC_DEFINE(kind, sent_at_us, held_us, held_error_us);
+};
+
+bool send_control(Connection& connection, const ControlFrame& frame,
+                  std::vector<uint8_t>& buffer) {
+  darena::encode_message(frame, buffer);
+  return connection.send(nullptr, 0) && connection.send(buffer);
+}
+
+uint64_t monotonic_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+const char* unix_prefix = "unix:";
+const char* inproc_prefix = "inproc:";
+const char* uring_prefix = "uring:";
+
+bool starts_with(const std::string& text, const char* prefix) {
+  return text.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+std::string strip(const std::string& text, const char* prefix) {
+  return text.substr(std::char_traits<char>::length(prefix));
+}
+
+}  // namespace
+
+Connection::Connection()
+    : quiet_at_us(monotonic_us()), last_heard_at_us(quiet_at_us) {}
+
+bool Connection::read_frame(std::vector<char>& out, bool& is_message) {
+  is_message = false;
+  if (!receive_frame(out)) {
+    return false;
+  }
+  uint64_t read_at = monotonic_us();
+  last_heard_at_us = read_at;
+  if (!out.empty()) {
+    is_message = true;
+    return true;
+  }
+  // The control frame was sent right behind the empty one
+  return receive_frame(control) && handle_control(read_at);
+}
+
+bool Connection::handle_control(uint64_t read_at_us) {
+  ControlFrame frame;
+  if (!darena::decode_message(control.data(), control.size(), frame)) {
+    // Unknown control frames are skipped, the peer may be newer
+    return true;
+  }
+
+  // The frame arrived somewhere since quiet_at_us, the middle of that is off
+  // by at most half of it
+  uint64_t held_error = (read_at_us - quiet_at_us) / 2;
+  uint64_t now = monotonic_us();
+  uint64_t held = now - read_at_us + held_error;
+
+  if (frame.kind == CONTROL_PING) {
+    ControlFrame pong{CONTROL_PONG, frame.sent_at_us, held, held_error};
+    return send_control(*this, pong, control_buffer);
+  }
+  if (frame.kind != CONTROL_PONG || frame.sent_at_us > now) {
+    return true;
+  }
+
+  stats.n_of_pongs++;
+  if (held_error + frame.held_error_us > PING_MAX_ERROR_US) {
+    return true;
+  }
+  int64_t rtt =
+      (int64_t)(now - frame.sent_at_us) - (int64_t)(held + frame.held_us);
+  uint64_t sample = rtt > 0 ? rtt : 0;
+  if (stats.n_of_samples == 0) {
+    stats.srtt_us = sample;
+    stats.min_rtt_us = sample;
+  } else {
+    double change = (double)sample - (double)stats.last_rtt_us;
+    stats.jitter_us += ((change < 0 ? -change : change) - stats.jitter_us) / 16;
+    stats.srtt_us += ((double)sample - stats.srtt_us) / 8;
+    if (sample < stats.min_rtt_us) {
+      stats.min_rtt_us = sample;
+    }
+  }
+  stats.last_rtt_us = sample;
+  stats.n_of_samples++;
+  return true;
+}
+
+bool Connection::fits_receive_limit(size_t size) const {
+  if (size <= receive_limit) {
+    return true;
+  }
+  darena::log << "Frame of " << size << " bytes from " << peer_name()
+              << " is over the limit of " << receive_limit << "\n";
+  return false;
+}
+
+bool Connection::wait_readable(int timeout_ms) {
+  uint64_t start = monotonic_us();
+  while (!has_held && !broken) {
+    int remaining = timeout_ms;
+    if (timeout_ms > 0) {
+      int elapsed_ms = (monotonic_us() - start) / 1000;
+      remaining = elapsed_ms < timeout_ms ? timeout_ms - elapsed_ms : 0;
+    }
+
+    uint64_t waited_at = monotonic_us();
+    bool readable = wait_frame(remaining);
+    uint64_t woke_at = monotonic_us();
+    if (!readable) {
+      quiet_at_us = woke_at;
+      if (timeout_ms >= 0) {
+        return false;
+      }
+      continue;
+    }
+    // Nothing was there while it slept
+    if (woke_at - waited_at >= FRAME_WAKE_UP_US) {
+      quiet_at_us = woke_at;
+    }
+
+    if (!read_frame(held, has_held)) {
+      broken = true;
+    }
+  }
+  return true;
+}
+
+bool Connection::receive(std::vector<char>& message) {
+  while (!has_held) {
+    if (broken || !read_frame(held, has_held)) {
+      broken = true;
+      return false;
+    }
+  }
+  message.swap(held);
+  has_held = false;
+  return true;
+}
+
+bool Connection::send_ping() {
+  stats.n_of_pings++;
+  return send_control(*this, {CONTROL_PING, monotonic_us()}, control_buffer);
+}
+
+int Connection::silent_ms() const {
+  return (monotonic_us() - last_heard_at_us) / 1000;
+}
+
+std::unique_ptr<Listener> listen(const std::string& address) {
+  if (starts_with(address, unix_prefix)) {
+    return listen_unix(strip(address, unix_prefix));
+  }
+  if (starts_with(address, inproc_prefix)) {
+    return listen_inproc(strip(address, inproc_prefix));
+  }
+  if (starts_with(address, uring_prefix)) {
+    return listen_uring();
+  }
+  return listen_tcp();
+}
+
+std::unique_ptr<Connection> connect(const std::string& address) {
+  if (starts_with(address, unix_prefix)) {
+    return connect_unix(strip(address, unix_prefix));
+  }
+  if (starts_with(address, inproc_prefix)) {
+    return connect_inproc(strip(address, inproc_prefix));
+  }
+  if (starts_with(address, uring_prefix)) {
+    return connect_uring(strip(address, uring_prefix));
+  }
+  return connect_tcp(address);
+}
+
+}  // namespace darena
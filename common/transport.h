@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Messages queued per direction of an in-process connection
+#define INPROC_QUEUE_CAPACITY 64
+// Submission queue entries of the io_uring a listener shares with the
+// connections it accepted, and of a client's own
+#define URING_QUEUE_DEPTH 1024
+#define URING_CLIENT_QUEUE_DEPTH 16
+// Receive buffers registered with a listener's io_uring and their size
+#define URING_RECEIVE_BUFFERS 64
+#define URING_RECEIVE_BUFFER_SIZE 16384
+// Connections a uring listener accepts ahead of accept() calls
+#define URING_ACCEPT_BACKLOG 64
+// Receive limit of a new connection, see Connection::set_receive_limit(). A
+// player resuming late in a match gets the keyframe and up to
+// KEYFRAME_INTERVAL_TURNS turns in one message.
+#define TRANSPORT_RECEIVE_LIMIT (32 << 20)
+// Round trip samples are dropped when either side may have left the ping or
+// pong unread for longer, see LinkStats
+#define PING_MAX_ERROR_US 10000
+
+namespace darena {
+
+// Round trip times of a connection, measured with send_ping(). A ping or pong
+// is only read when its receiver next waits for or receives a message, so
+// each side reports how long it may have sat unread. Samples where that adds
+// up to more than PING_MAX_ERROR_US only count as a sign of life.
+struct LinkStats {
+  // Smoothed like TCP does (RFC 6298), gain 1/8
+  double srtt_us = 0;
+  // Mean difference between consecutive samples (RFC 3550), gain 1/16
+  double jitter_us = 0;
+  uint64_t last_rtt_us = 0;
+  uint64_t min_rtt_us = 0;
+  int n_of_samples = 0;
+  int n_of_pings = 0;
+  int n_of_pongs = 0;
+};
+
+// Message framed, bidirectional connection between a client and the server.
+// Every backend delivers whole messages in order. Over byte streams a message
+// is a 4-byte big-endian length followed by the body.
+//
+// Pings and pongs travel as an empty frame followed by a control frame, no
+// message encodes to nothing. wait_readable() and receive() answer pings and
+// record pongs on the way and only ever return messages. A connection is used
+// by one thread at a time.
+//
+// Nothing is read that wasn't asked for, a peer that sends faster than it is
+// read is held back by the backend's own flow control.
+class Connection {
+ private:
+  // A message wait_readable() read ahead while looking for one
+  std::vector<char> held;
+  bool has_held = false;
+  bool broken = false;
+  std::vector<char> control;
+  std::vector<uint8_t> control_buffer;
+  LinkStats stats;
+  size_t receive_limit = TRANSPORT_RECEIVE_LIMIT;
+  int send_timeout_ms = -1;
+  // Microseconds of the steady clock when the connection was last known to
+  // have nothing unread, a frame read later arrived after it
+  uint64_t quiet_at_us;
+  uint64_t last_heard_at_us;
+
+  // Reads one frame, handling it if it is a control frame. Returns false if
+  // the connection broke, is_message tells whether out holds a message.
+  bool read_frame(std::vector<char>& out, bool& is_message);
+  bool handle_control(uint64_t read_at_us);
+
+ protected:
+  // The backend's side of wait_readable() and receive(), they see control
+  // frames like any other
+  virtual bool wait_frame(int timeout_ms) = 0;
+  virtual bool receive_frame(std::vector<char>& message) = 0;
+  // Backends call it with the length of every frame before making room for
+  // it. Returns false and logs if it is over the receive limit.
+  bool fits_receive_limit(size_t size) const;
+  int send_timeout() const { return send_timeout_ms; }
+
+ public:
+  Connection();
+  virtual ~Connection() = default;
+
+  // Sends one message, blocks until it is handed to the backend
+  virtual bool send(const char* data, size_t size) = 0;
+  bool send(const std::vector<uint8_t>& data) {
+    return send(reinterpret_cast<const char*>(data.data()), data.size());
+  }
+
+  // Queues a message for the next flush(), data must stay valid until then.
+  // Backends that batch submit the messages queued on all their connections
+  // at once, the others send right away.
+  virtual bool queue_send(const char* data, size_t size) {
+    return send(data, size);
+  }
+  // Waits until the queued message was handed to the backend, false if it
+  // failed
+  virtual bool flush() { return true; }
+
+  // True if send() can hand a message to the backend without waiting for the
+  // peer to read, or would fail at once. Backends that can't tell say true.
+  virtual bool can_send() { return true; }
+
+  // Returns true once a message can be received or the connection broke, in
+  // which case receive() fails. Returns false if nothing happened within
+  // timeout_ms, a negative timeout waits without a limit. A timeout of 0 only
+  // answers the pings that arrived.
+  bool wait_readable(int timeout_ms);
+
+  // Blocks until a whole message arrived and stores it in message, reusing its
+  // capacity. Returns false if the connection was closed or broken.
+  bool receive(std::vector<char>& message);
+
+  // Largest message receive() takes. A longer frame breaks the connection
+  // before anything is allocated for it, so the buffers of a connection never
+  // grow past the limit whatever length a peer claims.
+  void set_receive_limit(size_t bytes) { receive_limit = bytes; }
+
+  // Longest send() waits for the peer to take any more of the message, it
+  // fails after. Negative waits without a limit, the default. Only the TCP
+  // and Unix socket backends honor it.
+  void set_send_timeout(int timeout_ms) { send_timeout_ms = timeout_ms; }
+
+  // Sends a ping, its pong updates link_stats()
+  bool send_ping();
+  const LinkStats& link_stats() const { return stats; }
+  // Milliseconds since anything arrived, or since the connection was made
+  int silent_ms() const;
+  // Set once a wait or receive found the connection broken
+  bool is_broken() const { return broken; }
+
+  // Human readable address of the other side, for logs
+  virtual std::string peer_name() const = 0;
+};
+
+class Listener {
+ public:
+  virtual ~Listener() = default;
+
+  // Returns the next incoming connection, or nullptr if none arrived within
+  // timeout_ms. A negative timeout waits without a limit.
+  virtual std::unique_ptr<Connection> accept(int timeout_ms) = 0;
+};
+
+// Addresses select the backend:
+//   "unix:<path>"   Unix-domain stream socket at path
+//   "inproc:<name>" lock-free queues to a listener in the same process
+//   "uring:<host>"  TCP on DARENA_PORT through io_uring on Linux, SDL_net
+//                   where io_uring is unavailable
+//   anything else   TCP through SDL_net on DARENA_PORT, the address is the host
+//                   to connect to and is ignored when listening
+// All of them return nullptr and log the reason on failure.
+std::unique_ptr<Listener> listen(const std::string& address);
+std::unique_ptr<Connection> connect(const std::string& address);
+
+std::unique_ptr<Listener> listen_tcp();
+std::unique_ptr<Connection> connect_tcp(const std::string& host);
+std::unique_ptr<Listener> listen_unix(const std::string& path);
+std::unique_ptr<Connection> connect_unix(const std::string& path);
+std::unique_ptr<Listener> listen_inproc(const std::string& name);
+std::unique_ptr<Connection> connect_inproc(const std::string& name);
+std::unique_ptr<Listener> listen_uring();
+std::unique_ptr<Connection> connect_uring(const std::string& host);
+
+}  // namespace darena
@@ -0,0 +1,213 @@
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "transport.h"
+
+namespace darena {
+
+namespace {
+
+static_assert((INPROC_QUEUE_CAPACITY & (INPROC_QUEUE_CAPACITY - 1)) == 0,
+              "INPROC_QUEUE_CAPACITY must be a power of two");
+
+// Single producer, single consumer ring of messages. Slots keep their buffers,
+// receive() swaps them with the caller's vector, so after warming up nothing is
+// allocated.
+class MessageQueue {
+ private:
+  std::vector<char> slots[INPROC_QUEUE_CAPACITY];
+  alignas(64) std::atomic<uint64_t> head{0};
+  alignas(64) std::atomic<uint64_t> tail{0};
+
+ public:
+  std::atomic_bool closed{false};
+
+  bool try_push(const char* data, size_t size) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == INPROC_QUEUE_CAPACITY) {
+      return false;
+    }
+    slots[h % INPROC_QUEUE_CAPACITY].assign(data, data + size);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(std::vector<char>& message) {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    message.swap(slots[t % INPROC_QUEUE_CAPACITY]);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool full() const {
+    return head.load(std::memory_order_relaxed) -
+               tail.load(std::memory_order_acquire) ==
+           INPROC_QUEUE_CAPACITY;
+  }
+
+  bool empty() const {
+    return tail.load(std::memory_order_acquire) ==
+           head.load(std::memory_order_acquire);
+  }
+};
+
+// Polls condition until it holds or timeout_ms passes. Spins briefly, then
+// yields, then sleeps so an idle peer does not burn a core. A negative timeout
+// waits forever.
+template <typename Condition>
+bool wait_until(Condition&& condition, int timeout_ms) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeout_ms);
+  for (int i = 0;; i++) {
+    if (condition()) {
+      return true;
+    }
+    if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    if (i < 64) {
+      continue;
+    } else if (i < 1024) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+}
+
+// Both directions of one connection
+struct Channel {
+  MessageQueue to_server;
+  MessageQueue to_client;
+};
+
+class InProcessConnection : public Connection {
+ private:
+  std::shared_ptr<Channel> channel;
+  MessageQueue& outgoing;
+  MessageQueue& incoming;
+  std::string name;
+
+ public:
+  InProcessConnection(std::shared_ptr<Channel> channel, bool server_side,
+                      const std::string& name)
+      : channel(channel),
+        outgoing(server_side ? channel->to_client : channel->to_server),
+        incoming(server_side ? channel->to_server : channel->to_client),
+        name(name) {}
+
+  ~InProcessConnection() override { outgoing.closed.store(true); }
+
+  bool send(const char* data, size_t size) override {
+    // Waits for room while the peer is still there
+    return wait_until(
+        [&]() {
+          return incoming.closed.load() || outgoing.try_push(data, size);
+        },
+        -1) &&
+           !incoming.closed.load();
+  }
+
+  bool can_send() override {
+    return !outgoing.full() || incoming.closed.load();
+  }
+
+  bool wait_frame(int timeout_ms) override {
+    return wait_until(
+        [&]() { return !incoming.empty() || incoming.closed.load(); },
+        timeout_ms);
+  }
+
+  bool receive_frame(std::vector<char>& message) override {
+    wait_until(
+        [&]() { return !incoming.empty() || incoming.closed.load(); }, -1);
+    // Messages sent before the peer went away are still delivered
+    return incoming.try_pop(message) && fits_receive_limit(message.size());
+  }
+
+  std::string peer_name() const override { return "inproc:" + name; }
+};
+
+class InProcessListener;
+
+// Listeners by name. Only connecting and accepting take locks, messages go
+// through the lock-free queues.
+std::mutex registry_mutex;
+std::map<std::string, InProcessListener*> registry;
+
+class InProcessListener : public Listener {
+ private:
+  std::string name;
+  std::mutex pending_mutex;
+  std::deque<std::shared_ptr<Channel>> pending;
+
+ public:
+  explicit InProcessListener(const std::string& name) : name(name) {}
+
+  ~InProcessListener() override {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.erase(name);
+  }
+
+  void add_pending(std::shared_ptr<Channel> channel) {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending.push_back(channel);
+  }
+
+  std::unique_ptr<Connection> accept(int timeout_ms) override {
+    std::shared_ptr<Channel> channel;
+    wait_until(
+        [&]() {
+          std::lock_guard<std::mutex> lock(pending_mutex);
+          if (pending.empty()) {
+            return false;
+          }
+          channel = pending.front();
+          pending.pop_front();
+          return true;
+        },
+        timeout_ms);
+    if (!channel) {
+      return nullptr;
+    }
+    return std::make_unique<InProcessConnection>(channel, true, name);
+  }
+};
+
+}  // namespace
+
+std::unique_ptr<Listener> listen_inproc(const std::string& name) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  if (registry.count(name)) {
+    darena::log << "inproc:" << name << " is already listening\n";
+    return nullptr;
+  }
+  auto listener = std::make_unique<InProcessListener>(name);
+  registry[name] = listener.get();
+  darena::log << "Listening on inproc:" << name << "\n";
+  return listener;
+}
+
+std::unique_ptr<Connection> connect_inproc(const std::string& name) {
+  auto channel = std::make_shared<Channel>();
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto it = registry.find(name);
+    if (it == registry.end()) {
+      darena::log << "Nothing is listening on inproc:" << name << "\n";
+      return nullptr;
+    }
+    it->second->add_pending(channel);
+  }
+  return std::make_unique<InProcessConnection>(channel, false, name);
+}
+
+}  // namespace darena
@@ -0,0 +1,258 @@
+#include <SDL_net.h>
+
+#include "common.h"
+#include "timer_wheel.h"
+#include "transport.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <cstring>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace darena {
+
+namespace {
+
+#ifndef _WIN32
+// SDL_net keeps the descriptor of a TCPsocket private. Its struct has started
+// with these two members since SDL_net 1.2.
+struct SDLNetSocketHead {
+  int ready;
+  int channel;
+};
+
+int socket_fd(TCPsocket socket) {
+  return reinterpret_cast<SDLNetSocketHead*>(socket)->channel;
+}
+
+bool poll_fd(int fd, short events, int timeout_ms) {
+  pollfd entry = {fd, events, 0};
+  int result;
+  do {
+    result = poll(&entry, 1, timeout_ms);
+  } while (result < 0 && errno == EINTR);
+  return result > 0;
+}
+#endif
+
+// Every listener and connection owns one SDLNet_Init() reference and releases
+// it when destroyed, SDL_net counts them
+class TCPConnection : public Connection {
+ private:
+  TCPsocket socket;
+  SDLNet_SocketSet socket_set;
+
+  bool receive_exactly(void* data, size_t size) {
+    char* out = static_cast<char*>(data);
+    while (size > 0) {
+      int len = SDLNet_TCP_Recv(socket, out, size);
+      if (len <= 0) {
+        darena::log << "SDLNet_TCP_Recv Error, len=" << len
+                    << "\nError: " << SDLNet_GetError() << "\n";
+        return false;
+      }
+      out += len;
+      size -= len;
+    }
+    return true;
+  }
+
+#ifndef _WIN32
+  // SDLNet_TCP_Send() blocks until the peer makes room. This fails once the
+  // peer took nothing for send_timeout() ms since progress_at.
+  bool send_exactly(const void* data, size_t size, uint64_t& progress_at) {
+    int fd = socket_fd(socket);
+    const char* in = static_cast<const char*>(data);
+    while (size > 0) {
+      int timeout_ms = -1;
+      if (send_timeout() >= 0) {
+        uint64_t waited = darena::monotonic_ms() - progress_at;
+        if (waited >= (uint64_t)send_timeout()) {
+          darena::log << "TCP send stalled for " << waited << " ms\n";
+          return false;
+        }
+        timeout_ms = send_timeout() - (int)waited;
+      }
+      // On a timeout the send finds no room and the deadline ends the loop
+      poll_fd(fd, POLLOUT, timeout_ms);
+      ssize_t len = ::send(fd, in, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (len < 0 &&
+          (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+        continue;
+      }
+      if (len <= 0) {
+        darena::log << "TCP send error: " << std::strerror(errno) << "\n";
+        return false;
+      }
+      in += len;
+      size -= len;
+      progress_at = darena::monotonic_ms();
+    }
+    return true;
+  }
+#endif
+
+ public:
+  explicit TCPConnection(TCPsocket socket)
+      : socket(socket), socket_set(SDLNet_AllocSocketSet(1)) {
+    SDLNet_TCP_AddSocket(socket_set, socket);
+  }
+
+  ~TCPConnection() override {
+    SDLNet_TCP_DelSocket(socket_set, socket);
+    SDLNet_FreeSocketSet(socket_set);
+    SDLNet_TCP_Close(socket);
+    SDLNet_Quit();
+  }
+
+#ifndef _WIN32
+  bool send(const char* data, size_t size) override {
+    uint32_t message_size = htonl(size);
+    uint64_t progress_at = darena::monotonic_ms();
+    return send_exactly(&message_size, sizeof(message_size), progress_at) &&
+           send_exactly(data, size, progress_at);
+  }
+
+  bool can_send() override { return poll_fd(socket_fd(socket), POLLOUT, 0); }
+#else
+  // Blocks without a limit, send_timeout() is not honored here
+  bool send(const char* data, size_t size) override {
+    uint32_t message_size = htonl(size);
+    int result = SDLNet_TCP_Send(socket, &message_size, sizeof(message_size));
+    if (result < (int)sizeof(message_size)) {
+      darena::log << "SDLNet_TCP_Send Error, len=" << result
+                  << "\nError: " << SDLNet_GetError() << "\n";
+      return false;
+    }
+
+    result = SDLNet_TCP_Send(socket, data, size);
+    if (result < (int)size) {
+      darena::log << "SDLNet_TCP_Send Error, len=" << result
+                  << "\nError: " << SDLNet_GetError() << "\n";
+      return false;
+    }
+    return true;
+  }
+#endif
+
+  // A negative timeout becomes about 49 days, SDL_net's longest wait
+  bool wait_frame(int timeout_ms) override {
+    if (SDLNet_CheckSockets(socket_set, timeout_ms) <= 0) {
+      return false;
+    }
+    return SDLNet_SocketReady(socket);
+  }
+
+  bool receive_frame(std::vector<char>& message) override {
+    uint32_t message_size;
+    if (!receive_exactly(&message_size, sizeof(message_size))) {
+      return false;
+    }
+    message_size = ntohl(message_size);
+    if (!fits_receive_limit(message_size)) {
+      return false;
+    }
+    message.resize(message_size);
+    return receive_exactly(message.data(), message.size());
+  }
+
+  std::string peer_name() const override {
+    IPaddress* address = SDLNet_TCP_GetPeerAddress(socket);
+    if (!address) {
+      return "unknown";
+    }
+    return darena::ipaddress_to_string(address);
+  }
+};
+
+class TCPListener : public Listener {
+ private:
+  TCPsocket socket;
+  SDLNet_SocketSet socket_set;
+
+ public:
+  explicit TCPListener(TCPsocket socket)
+      : socket(socket), socket_set(SDLNet_AllocSocketSet(1)) {
+    SDLNet_TCP_AddSocket(socket_set, socket);
+  }
+
+  ~TCPListener() override {
+    SDLNet_TCP_DelSocket(socket_set, socket);
+    SDLNet_FreeSocketSet(socket_set);
+    SDLNet_TCP_Close(socket);
+    SDLNet_Quit();
+  }
+
+  std::unique_ptr<Connection> accept(int timeout_ms) override {
+    // A listening socket becomes ready when a connection is pending
+    if (SDLNet_CheckSockets(socket_set, timeout_ms) <= 0) {
+      return nullptr;
+    }
+    TCPsocket client = SDLNet_TCP_Accept(socket);
+    if (!client) {
+      return nullptr;
+    }
+    SDLNet_Init();
+    return std::make_unique<TCPConnection>(client);
+  }
+};
+
+}  // namespace
+
+std::unique_ptr<Listener> listen_tcp() {
+  if (SDLNet_Init() == -1) {
+    darena::log << "SDLNet_Init Error: " << SDLNet_GetError() << "\n";
+    return nullptr;
+  }
+
+  IPaddress server_ip;
+  if (SDLNet_ResolveHost(&server_ip, NULL, DARENA_PORT) == -1) {
+    darena::log << "SDLNet_ResolveHost Error: " << SDLNet_GetError() << "\n";
+    SDLNet_Quit();
+    return nullptr;
+  }
+
+  darena::log << "Listening from: "
+              << unit32_t_address_to_string(server_ip.host) << "\n";
+
+  TCPsocket socket = SDLNet_TCP_Open(&server_ip);
+  if (!socket) {
+    darena::log << "SDLNet_TCP_Open Error: " << SDLNet_GetError() << "\n";
+    SDLNet_Quit();
+    return nullptr;
+  }
+
+  return std::make_unique<TCPListener>(socket);
+}
+
+std::unique_ptr<Connection> connect_tcp(const std::string& host) {
+  if (SDLNet_Init() == -1) {
+    darena::log << "SDLNet_Init Error: " << SDLNet_GetError() << "\n";
+    return nullptr;
+  }
+
+  IPaddress server_ip;
+  if (SDLNet_ResolveHost(&server_ip, host.c_str(), DARENA_PORT) == -1) {
+    darena::log << "SDLNet_ResolveHost Error: " << SDLNet_GetError() << "\n";
+    SDLNet_Quit();
+    return nullptr;
+  }
+
+  TCPsocket socket = SDLNet_TCP_Open(&server_ip);
+  if (!socket) {
+    darena::log << "SDLNet_TCP_Open Error: " << SDLNet_GetError() << "\n";
+    SDLNet_Quit();
+    return nullptr;
+  }
+
+  return std::make_unique<TCPConnection>(socket);
+}
+
+}  // namespace darena
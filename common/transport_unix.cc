@@ -0,0 +1,222 @@
+#include "common.h"
+#include "timer_wheel.h"
+#include "transport.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+// macOS has no MSG_NOSIGNAL, SIGPIPE is left to the application there
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace darena {
+
+#ifndef _WIN32
+
+namespace {
+
+bool poll_fd(int fd, short events, int timeout_ms) {
+  pollfd entry = {fd, events, 0};
+  int result;
+  do {
+    result = poll(&entry, 1, timeout_ms);
+  } while (result < 0 && errno == EINTR);
+  return result > 0;
+}
+
+bool make_address(const std::string& path, sockaddr_un& address) {
+  if (path.size() >= sizeof(address.sun_path)) {
+    darena::log << "Unix socket path too long: " << path << "\n";
+    return false;
+  }
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+class UnixConnection : public Connection {
+ private:
+  int fd;
+  std::string path;
+
+  // Fails once the peer took nothing for send_timeout() ms since progress_at
+  bool send_exactly(const void* data, size_t size, uint64_t& progress_at) {
+    const char* in = static_cast<const char*>(data);
+    while (size > 0) {
+      int timeout_ms = -1;
+      if (send_timeout() >= 0) {
+        uint64_t waited = darena::monotonic_ms() - progress_at;
+        if (waited >= (uint64_t)send_timeout()) {
+          darena::log << "Unix socket send stalled for " << waited
+                      << " ms\n";
+          return false;
+        }
+        timeout_ms = send_timeout() - (int)waited;
+      }
+      // On a timeout the send finds no room and the deadline ends the loop
+      poll_fd(fd, POLLOUT, timeout_ms);
+      ssize_t len = ::send(fd, in, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (len < 0 &&
+          (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+        continue;
+      }
+      if (len <= 0) {
+        darena::log << "Unix socket send error: " << std::strerror(errno)
+                    << "\n";
+        return false;
+      }
+      in += len;
+      size -= len;
+      progress_at = darena::monotonic_ms();
+    }
+    return true;
+  }
+
+  bool receive_exactly(void* data, size_t size) {
+    char* out = static_cast<char*>(data);
+    while (size > 0) {
+      ssize_t len = ::recv(fd, out, size, 0);
+      if (len < 0 && errno == EINTR) {
+        continue;
+      }
+      if (len <= 0) {
+        darena::log << "Unix socket receive error, len=" << len << "\n";
+        return false;
+      }
+      out += len;
+      size -= len;
+    }
+    return true;
+  }
+
+ public:
+  UnixConnection(int fd, const std::string& path) : fd(fd), path(path) {}
+  ~UnixConnection() override { ::close(fd); }
+
+  bool send(const char* data, size_t size) override {
+    uint32_t message_size = htonl(size);
+    uint64_t progress_at = darena::monotonic_ms();
+    return send_exactly(&message_size, sizeof(message_size), progress_at) &&
+           send_exactly(data, size, progress_at);
+  }
+
+  bool wait_frame(int timeout_ms) override {
+    return poll_fd(fd, POLLIN, timeout_ms);
+  }
+
+  bool can_send() override { return poll_fd(fd, POLLOUT, 0); }
+
+  bool receive_frame(std::vector<char>& message) override {
+    uint32_t message_size;
+    if (!receive_exactly(&message_size, sizeof(message_size))) {
+      return false;
+    }
+    message_size = ntohl(message_size);
+    if (!fits_receive_limit(message_size)) {
+      return false;
+    }
+    message.resize(message_size);
+    return receive_exactly(message.data(), message.size());
+  }
+
+  std::string peer_name() const override { return "unix:" + path; }
+};
+
+class UnixListener : public Listener {
+ private:
+  int fd;
+  std::string path;
+
+ public:
+  UnixListener(int fd, const std::string& path) : fd(fd), path(path) {}
+  ~UnixListener() override {
+    ::close(fd);
+    ::unlink(path.c_str());
+  }
+
+  std::unique_ptr<Connection> accept(int timeout_ms) override {
+    if (!poll_fd(fd, POLLIN, timeout_ms)) {
+      return nullptr;
+    }
+    int client = ::accept(fd, nullptr, nullptr);
+    if (client < 0) {
+      return nullptr;
+    }
+    return std::make_unique<UnixConnection>(client, path);
+  }
+};
+
+}  // namespace
+
+std::unique_ptr<Listener> listen_unix(const std::string& path) {
+  sockaddr_un address;
+  if (!make_address(path, address)) {
+    return nullptr;
+  }
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    darena::log << "Unix socket error: " << std::strerror(errno) << "\n";
+    return nullptr;
+  }
+
+  // A socket file left behind by a previous server would make bind() fail
+  ::unlink(path.c_str());
+  if (::bind(fd, (sockaddr*)&address, sizeof(address)) < 0 ||
+      ::listen(fd, MAX_CLIENTS) < 0) {
+    darena::log << "Unix socket bind error: " << std::strerror(errno) << "\n";
+    ::close(fd);
+    return nullptr;
+  }
+
+  darena::log << "Listening on unix:" << path << "\n";
+  return std::make_unique<UnixListener>(fd, path);
+}
+
+std::unique_ptr<Connection> connect_unix(const std::string& path) {
+  sockaddr_un address;
+  if (!make_address(path, address)) {
+    return nullptr;
+  }
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    darena::log << "Unix socket error: " << std::strerror(errno) << "\n";
+    return nullptr;
+  }
+
+  if (::connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+    darena::log << "Unix socket connect error: " << std::strerror(errno)
+                << "\n";
+    ::close(fd);
+    return nullptr;
+  }
+
+  return std::make_unique<UnixConnection>(fd, path);
+}
+
+#else
+
+std::unique_ptr<Listener> listen_unix(const std::string& path) {
+  darena::log << "Unix-domain sockets are not supported on this platform\n";
+  return nullptr;
+}
+
+std::unique_ptr<Connection> connect_unix(const std::string& path) {
+  darena::log << "Unix-domain sockets are not supported on this platform\n";
+  return nullptr;
+}
+
+#endif
+
+}  // namespace darena
@@ -0,0 +1,908 @@
+#include "common.h"
+#include "transport.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define DARENA_HAS_IO_URING 1
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#else
+#define DARENA_HAS_IO_URING 0
+#endif
+
+namespace darena {
+
+#if DARENA_HAS_IO_URING
+
+namespace {
+
+// liburing is not a dependency, the three system calls are all it wraps
+int uring_setup(unsigned entries, io_uring_params* params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      nullptr, 0);
+}
+
+int uring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+unsigned load_acquire(const unsigned* value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void store_release(unsigned* value, unsigned new_value) {
+  __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+// Target of an operation's user_data. complete() is called with the ring's
+// mutex held.
+struct Completion {
+  virtual ~Completion() = default;
+  virtual void complete(int result, uint32_t flags) = 0;
+};
+
+// Operation with a single completion
+struct Request : Completion {
+  int result = 0;
+  bool done = false;
+
+  void complete(int result, uint32_t flags) override {
+    this->result = result;
+    done = true;
+  }
+};
+
+// One io_uring shared by a listener and every connection it accepted, so
+// their sends are submitted together. Any thread may submit. Whichever thread
+// waits first reaps completions for all the others, which sleep on a
+// condition variable until theirs arrived.
+class Uring {
+ private:
+  int fd = -1;
+  void* sq_ring = MAP_FAILED;
+  size_t sq_ring_size = 0;
+  void* cq_ring = MAP_FAILED;
+  size_t cq_ring_size = 0;
+  io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+  size_t sqes_size = 0;
+
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe* cqes;
+
+  // Tail of the prepared entries. The kernel's sq_tail only moves up to it in
+  // publish(), once the entries before it are filled in.
+  unsigned sq_prepared = 0;
+  bool reaping = false;
+  bool broken = false;
+  std::condition_variable completed;
+
+  // Registered with the ring, receives read into them with READ_FIXED
+  std::vector<char> receive_buffers;
+  std::vector<int> free_receive_buffers;
+
+  void reap() {
+    unsigned head = *cq_head;
+    unsigned tail = load_acquire(cq_tail);
+    while (head != tail) {
+      io_uring_cqe* cqe = &cqes[head & cq_mask];
+      if (cqe->user_data) {
+        reinterpret_cast<Completion*>(cqe->user_data)
+            ->complete(cqe->res, cqe->flags);
+      }
+      head++;
+    }
+    store_release(cq_head, head);
+  }
+
+ public:
+  std::mutex mutex;
+
+  ~Uring() {
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+      munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring != MAP_FAILED) {
+      munmap(sq_ring, sq_ring_size);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  // Sets up the rings and registers n_of_buffers receive buffers. Fails if
+  // the kernel has no io_uring or it is disabled.
+  bool initialize(unsigned entries, int n_of_buffers) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = entries * 4;
+    fd = uring_setup(entries, &params);
+    if (fd < 0 && errno == EINVAL) {
+      // SUBMIT_ALL is from 5.18
+      std::memset(&params, 0, sizeof(params));
+      params.flags = IORING_SETUP_CQSIZE;
+      params.cq_entries = entries * 4;
+      fd = uring_setup(entries, &params);
+    }
+    if (fd < 0) {
+      darena::log << "io_uring_setup error: " << std::strerror(errno) << "\n";
+      return false;
+    }
+    if (!(params.features & IORING_FEAT_NODROP)) {
+      darena::log << "io_uring is too old, completions can be dropped\n";
+      return false;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+      darena::log << "io_uring mmap error: " << std::strerror(errno) << "\n";
+      return false;
+    }
+    if (single_mmap) {
+      cq_ring = sq_ring;
+    } else {
+      cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd,
+                               IORING_OFF_SQES);
+    if (cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+      darena::log << "io_uring mmap error: " << std::strerror(errno) << "\n";
+      return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ring);
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_prepared = *sq_tail;
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+    sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sq_entries = *(unsigned*)(sq + params.sq_off.ring_entries);
+    char* cq = static_cast<char*>(cq_ring);
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    receive_buffers.resize((size_t)n_of_buffers * URING_RECEIVE_BUFFER_SIZE);
+    std::vector<iovec> iovecs(n_of_buffers);
+    for (int i = 0; i < n_of_buffers; i++) {
+      iovecs[i].iov_base =
+          receive_buffers.data() + (size_t)i * URING_RECEIVE_BUFFER_SIZE;
+      iovecs[i].iov_len = URING_RECEIVE_BUFFER_SIZE;
+    }
+    // Older kernels count registered buffers against RLIMIT_MEMLOCK, receives
+    // then go to the connection's own buffer
+    if (n_of_buffers > 0 &&
+        uring_register(fd, IORING_REGISTER_BUFFERS, iovecs.data(),
+                       n_of_buffers) < 0) {
+      darena::log << "io_uring buffer registration error: "
+                  << std::strerror(errno) << ", receiving unregistered\n";
+      receive_buffers.clear();
+      n_of_buffers = 0;
+    }
+    for (int i = n_of_buffers - 1; i >= 0; i--) {
+      free_receive_buffers.push_back(i);
+    }
+    return true;
+  }
+
+  bool has_receive_buffers() const { return !receive_buffers.empty(); }
+
+  // Returns a zeroed entry to prepare, submitting the queue if it is full.
+  // Needs the mutex, the entry goes to the kernel with the next submit().
+  io_uring_sqe* get_sqe() {
+    if (unsubmitted() == sq_entries &&
+        (!submit() || unsubmitted() == sq_entries)) {
+      darena::log << "io_uring submission queue is full\n";
+      return nullptr;
+    }
+    return try_get_sqe();
+  }
+
+  // get_sqe() that never submits, for completions preparing an entry while
+  // they are reaped. Returns nullptr if the queue is full.
+  io_uring_sqe* try_get_sqe() {
+    if (unsubmitted() == sq_entries) {
+      return nullptr;
+    }
+    unsigned index = sq_prepared & sq_mask;
+    io_uring_sqe* sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sq_prepared++;
+    return sqe;
+  }
+
+  // Prepared entries the kernel has not consumed. It moves sq_head past the
+  // entries it takes, whichever thread's io_uring_enter() took them.
+  unsigned unsubmitted() const { return sq_prepared - load_acquire(sq_head); }
+
+  // Lets the kernel see the prepared entries. Needs the mutex, and every
+  // entry handed out must be filled in, which holds whenever the mutex is
+  // taken again.
+  void publish() { store_release(sq_tail, sq_prepared); }
+
+  // Hands every prepared entry to the kernel in one call. Needs the mutex.
+  bool submit() {
+    publish();
+    while (unsubmitted() > 0) {
+      int result = uring_enter(fd, unsubmitted(), 0, 0);
+      if (result < 0 && errno == EBUSY) {
+        // The completion queue is full, make room
+        reap();
+        completed.notify_all();
+        continue;
+      }
+      if (result < 0 && errno != EINTR) {
+        darena::log << "io_uring_enter error: " << std::strerror(errno)
+                    << "\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Blocks until done() holds, reaping completions for every waiting thread.
+  // Submits whatever is prepared, together with the wait when this thread
+  // reaps. Returns false if the ring broke.
+  template <typename Done>
+  bool wait(std::unique_lock<std::mutex>& lock, Done done) {
+    reap();
+    while (!done()) {
+      if (broken) {
+        return false;
+      }
+      if (reaping) {
+        // The reaping thread only submits what was prepared before it started
+        if (!submit()) {
+          return false;
+        }
+        completed.wait(lock);
+        continue;
+      }
+
+      reaping = true;
+      // Entries prepared while the lock is dropped stay unpublished, until
+      // they are filled in and submitted
+      publish();
+      unsigned to_submit = unsubmitted();
+      lock.unlock();
+      int result =
+          uring_enter(fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+      int error = errno;
+      lock.lock();
+      if (result < 0 && error != EINTR && error != EBUSY) {
+        darena::log << "io_uring_enter error: " << std::strerror(error)
+                    << "\n";
+        broken = true;
+      }
+      reap();
+      reaping = false;
+      completed.notify_all();
+    }
+    return true;
+  }
+
+  // wait() for at most timeout_ms, returns done()
+  template <typename Done>
+  bool wait_for(std::unique_lock<std::mutex>& lock, Done done,
+                int timeout_ms) {
+    Request timer;
+    __kernel_timespec timeout = {timeout_ms / 1000,
+                                 (timeout_ms % 1000) * 1000000LL};
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)&timeout;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)&timer;
+
+    wait(lock, [&]() { return timer.done || done(); });
+    if (!timer.done && !cancel(lock, timer)) {
+      return false;
+    }
+    return done();
+  }
+
+  // Cancels an operation and waits until its completion arrived
+  bool cancel(std::unique_lock<std::mutex>& lock, Request& target) {
+    Request cancellation;
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)&target;
+    sqe->user_data = (uint64_t)&cancellation;
+    return wait(lock, [&]() { return cancellation.done && target.done; });
+  }
+
+  // Takes a registered receive buffer, waiting if all are in use
+  int acquire_receive_buffer(std::unique_lock<std::mutex>& lock) {
+    completed.wait(lock, [this]() { return !free_receive_buffers.empty(); });
+    int index = free_receive_buffers.back();
+    free_receive_buffers.pop_back();
+    return index;
+  }
+
+  void release_receive_buffer(int index) {
+    free_receive_buffers.push_back(index);
+    completed.notify_all();
+  }
+
+  char* receive_buffer(int index) {
+    return receive_buffers.data() + (size_t)index * URING_RECEIVE_BUFFER_SIZE;
+  }
+};
+
+std::shared_ptr<Uring> make_uring(unsigned entries, int n_of_buffers) {
+  auto ring = std::make_shared<Uring>();
+  if (!ring->initialize(entries, n_of_buffers)) {
+    return nullptr;
+  }
+  return ring;
+}
+
+std::string socket_peer_name(int fd) {
+  sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  char host[INET6_ADDRSTRLEN] = "unknown";
+  int port = 0;
+  if (getpeername(fd, (sockaddr*)&address, &length) == 0) {
+    if (address.ss_family == AF_INET) {
+      sockaddr_in* in = (sockaddr_in*)&address;
+      inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+      port = ntohs(in->sin_port);
+    } else if (address.ss_family == AF_INET6) {
+      sockaddr_in6* in6 = (sockaddr_in6*)&address;
+      inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+      port = ntohs(in6->sin6_port);
+    }
+  }
+  return "uring:" + std::string(host) + ":" + std::to_string(port);
+}
+
+void set_no_delay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Frame waiting for flush(). The length prefix is kept with it, the body is
+// the caller's.
+struct OutboundFrame {
+  uint32_t header;
+  iovec parts[2];
+  int first_part;
+  msghdr message;
+  Request request;
+  size_t remaining;
+
+  // Drops what a short send already sent from the front
+  void advance(size_t sent) {
+    remaining -= sent;
+    while (sent > 0) {
+      iovec& part = parts[first_part];
+      size_t part_sent = std::min(sent, part.iov_len);
+      part.iov_base = (char*)part.iov_base + part_sent;
+      part.iov_len -= part_sent;
+      sent -= part_sent;
+      if (part.iov_len == 0) {
+        first_part++;
+      }
+    }
+  }
+};
+
+// Multishot accept, every completion carries a connected socket. Kernels
+// before 5.19 reject the multishot flag, the listener then arms a single
+// accept at a time. Once URING_ACCEPT_BACKLOG sockets wait for accept() the
+// stream cancels itself, further connections wait in the kernel's listen
+// backlog until accept() makes room and arms it again.
+struct AcceptStream : Completion {
+  Uring* ring;
+  std::deque<int> accepted;
+  bool armed = false;
+  bool multishot = true;
+  // Set when accepting failed, accept() then returns nullptr
+  bool failed = false;
+  // The stream's own ASYNC_CANCEL, nothing may be armed while it is in flight
+  Request cancellation;
+  bool cancelling = false;
+
+  explicit AcceptStream(Uring* ring) : ring(ring) {}
+
+  bool cancel_in_flight() const { return cancelling && !cancellation.done; }
+
+  void complete(int result, uint32_t flags) override {
+    if (result >= 0 && accepted.size() >= URING_ACCEPT_BACKLOG) {
+      // Accepted before the cancel took effect
+      ::close(result);
+    } else if (result >= 0) {
+      accepted.push_back(result);
+    } else if (result == -EINVAL && multishot) {
+      multishot = false;
+    } else if (result != -ECANCELED) {
+      darena::log << "io_uring accept error: " << std::strerror(-result)
+                  << "\n";
+      failed = true;
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+      armed = false;
+    } else if (accepted.size() >= URING_ACCEPT_BACKLOG &&
+               !cancel_in_flight()) {
+      cancel();
+    }
+  }
+
+  // Runs while reaping, so the entry is only prepared. It goes to the kernel
+  // with the next submit, a full queue retries at the next completion.
+  void cancel() {
+    io_uring_sqe* sqe = ring->try_get_sqe();
+    if (!sqe) {
+      return;
+    }
+    cancellation = Request();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)this;
+    sqe->user_data = (uint64_t)&cancellation;
+    cancelling = true;
+  }
+};
+
+class UringConnection : public Connection {
+ private:
+  std::shared_ptr<Uring> ring;
+  int fd;
+  std::string name;
+  // Bytes received past the last message returned, receives read ahead
+  std::vector<char> received;
+  size_t received_begin = 0;
+  // At most one frame in flight, queue_send() flushes the previous one
+  bool has_outbound = false;
+  OutboundFrame outbound;
+
+  // Prepares a SENDMSG of what is left of the outbound frame
+  bool prepare_send() {
+    io_uring_sqe* sqe = ring->get_sqe();
+    if (!sqe) {
+      return false;
+    }
+    std::memset(&outbound.message, 0, sizeof(outbound.message));
+    outbound.message.msg_iov = outbound.parts + outbound.first_part;
+    outbound.message.msg_iovlen = 2 - outbound.first_part;
+    outbound.request = Request();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)&outbound.message;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = (uint64_t)&outbound.request;
+    return true;
+  }
+
+  // Waits for the outbound frame, sending what a short send left over
+  bool finish_send(std::unique_lock<std::mutex>& lock) {
+    has_outbound = false;
+    while (true) {
+      if (!ring->wait(lock, [this]() { return outbound.request.done; })) {
+        return false;
+      }
+      int result = outbound.request.result;
+      if (result < 0 && result != -EINTR && result != -EAGAIN) {
+        darena::log << "io_uring send error: " << std::strerror(-result)
+                    << "\n";
+        return false;
+      }
+      if (result == 0) {
+        darena::log << "io_uring send error, connection closed\n";
+        return false;
+      }
+      outbound.advance(result > 0 ? result : 0);
+      if (outbound.remaining == 0) {
+        return true;
+      }
+      if (!prepare_send()) {
+        return false;
+      }
+    }
+  }
+
+  // Reads whatever arrived into received, at least one byte
+  bool receive_some(std::unique_lock<std::mutex>& lock) {
+    if (received_begin > 0) {
+      received.erase(received.begin(), received.begin() + received_begin);
+      received_begin = 0;
+    }
+
+    Request request;
+    int buffer = -1;
+    size_t old_size = received.size();
+    io_uring_sqe* sqe;
+    if (ring->has_receive_buffers()) {
+      buffer = ring->acquire_receive_buffer(lock);
+      sqe = ring->get_sqe();
+      if (sqe) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t)ring->receive_buffer(buffer);
+        sqe->buf_index = buffer;
+      }
+    } else {
+      received.resize(old_size + URING_RECEIVE_BUFFER_SIZE);
+      sqe = ring->get_sqe();
+      if (sqe) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = (uint64_t)(received.data() + old_size);
+      }
+    }
+    if (sqe) {
+      sqe->fd = fd;
+      sqe->len = URING_RECEIVE_BUFFER_SIZE;
+      sqe->user_data = (uint64_t)&request;
+    }
+
+    bool noerr = sqe &&
+                 ring->wait(lock, [&request]() { return request.done; });
+    int len = request.result;
+    if (buffer >= 0) {
+      if (noerr && len > 0) {
+        const char* data = ring->receive_buffer(buffer);
+        received.insert(received.end(), data, data + len);
+      }
+      ring->release_receive_buffer(buffer);
+    } else {
+      received.resize(old_size + (noerr && len > 0 ? len : 0));
+    }
+    if (!noerr || len <= 0) {
+      darena::log << "io_uring receive error, len=" << len << "\n";
+      return false;
+    }
+    return true;
+  }
+
+  bool receive_at_least(std::unique_lock<std::mutex>& lock, size_t size) {
+    while (received.size() - received_begin < size) {
+      if (!receive_some(lock)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ public:
+  UringConnection(std::shared_ptr<Uring> ring, int fd)
+      : ring(ring), fd(fd), name(socket_peer_name(fd)) {}
+
+  ~UringConnection() override {
+    flush();
+    ::close(fd);
+  }
+
+  bool send(const char* data, size_t size) override {
+    return queue_send(data, size) && flush();
+  }
+
+  bool queue_send(const char* data, size_t size) override {
+    std::unique_lock lock(ring->mutex);
+    if (has_outbound && !finish_send(lock)) {
+      return false;
+    }
+    outbound.header = htonl(size);
+    outbound.parts[0] = {&outbound.header, sizeof(outbound.header)};
+    outbound.parts[1] = {const_cast<char*>(data), size};
+    outbound.first_part = 0;
+    outbound.remaining = sizeof(outbound.header) + size;
+    if (!prepare_send()) {
+      return false;
+    }
+    has_outbound = true;
+    return true;
+  }
+
+  bool flush() override {
+    std::unique_lock lock(ring->mutex);
+    if (!has_outbound) {
+      return true;
+    }
+    // Submits every connection's queued frames, not only this one
+    return finish_send(lock);
+  }
+
+  // The socket itself is polled, sends go through the ring but the kernel
+  // buffer is the same
+  bool can_send() override {
+    pollfd entry = {fd, POLLOUT, 0};
+    return poll(&entry, 1, 0) > 0;
+  }
+
+  bool wait_frame(int timeout_ms) override {
+    if (received.size() > received_begin) {
+      return true;
+    }
+
+    std::unique_lock lock(ring->mutex);
+    Request poll;
+    Request timer;
+    __kernel_timespec timeout = {timeout_ms / 1000,
+                                 (timeout_ms % 1000) * 1000000LL};
+    io_uring_sqe* sqe = ring->get_sqe();
+    if (!sqe) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uint64_t)&poll;
+    if (timeout_ms >= 0) {
+      // The poll is cancelled if it is still waiting when the timeout expires
+      sqe->flags |= IOSQE_IO_LINK;
+      sqe = ring->get_sqe();
+      if (!sqe) {
+        return false;
+      }
+      sqe->opcode = IORING_OP_LINK_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)&timeout;
+      sqe->len = 1;
+      sqe->user_data = (uint64_t)&timer;
+    } else {
+      timer.done = true;
+    }
+
+    // A broken connection is readable, receive() then fails
+    ring->wait(lock, [&]() { return poll.done && timer.done; });
+    return poll.done && poll.result > 0;
+  }
+
+  bool receive_frame(std::vector<char>& message) override {
+    std::unique_lock lock(ring->mutex);
+    uint32_t message_size;
+    if (!receive_at_least(lock, sizeof(message_size))) {
+      return false;
+    }
+    std::memcpy(&message_size, received.data() + received_begin,
+                sizeof(message_size));
+    message_size = ntohl(message_size);
+    if (!fits_receive_limit(message_size) ||
+        !receive_at_least(lock, sizeof(message_size) + message_size)) {
+      return false;
+    }
+    const char* body = received.data() + received_begin + sizeof(message_size);
+    message.assign(body, body + message_size);
+    received_begin += sizeof(message_size) + message_size;
+    return true;
+  }
+
+  std::string peer_name() const override { return name; }
+};
+
+class UringListener : public Listener {
+ private:
+  std::shared_ptr<Uring> ring;
+  int fd;
+  AcceptStream accepting{ring.get()};
+
+  bool arm(std::unique_lock<std::mutex>& lock) {
+    io_uring_sqe* sqe = ring->get_sqe();
+    if (!sqe) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    if (accepting.multishot) {
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+    sqe->user_data = (uint64_t)&accepting;
+    accepting.armed = true;
+    return true;
+  }
+
+ public:
+  UringListener(std::shared_ptr<Uring> ring, int fd) : ring(ring), fd(fd) {}
+
+  ~UringListener() override {
+    std::unique_lock lock(ring->mutex);
+    if (accepting.armed) {
+      Request cancellation;
+      io_uring_sqe* sqe = ring->get_sqe();
+      if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)&accepting;
+        sqe->user_data = (uint64_t)&cancellation;
+        ring->wait(lock, [&]() {
+          return cancellation.done && !accepting.armed;
+        });
+      }
+    }
+    // A cancel the stream sent itself still points to it
+    ring->wait(lock, [this]() { return !accepting.cancel_in_flight(); });
+    for (int client : accepting.accepted) {
+      ::close(client);
+    }
+    ::close(fd);
+  }
+
+  std::unique_ptr<Connection> accept(int timeout_ms) override {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    std::unique_lock lock(ring->mutex);
+    while (accepting.accepted.empty()) {
+      // Multishot accept stays armed, it is rearmed only after an error, a
+      // full backlog or on kernels without it
+      if (!accepting.armed && !accepting.cancel_in_flight() && !arm(lock)) {
+        return nullptr;
+      }
+      auto accepted_or_disarmed = [this]() {
+        return !accepting.accepted.empty() ||
+               (!accepting.armed && !accepting.cancel_in_flight());
+      };
+      if (timeout_ms < 0) {
+        ring->wait(lock, accepted_or_disarmed);
+      } else {
+        int remaining_ms =
+            (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now())
+                .count();
+        if (remaining_ms < 0) {
+          break;
+        }
+        ring->wait_for(lock, accepted_or_disarmed, remaining_ms);
+      }
+      if (accepting.failed) {
+        accepting.failed = false;
+        break;
+      }
+    }
+    if (accepting.accepted.empty()) {
+      return nullptr;
+    }
+
+    int client = accepting.accepted.front();
+    accepting.accepted.pop_front();
+    // A stream that cancelled itself when full takes connections again
+    if (!accepting.armed && !accepting.cancel_in_flight()) {
+      arm(lock);
+    }
+    set_no_delay(client);
+    return std::make_unique<UringConnection>(ring, client);
+  }
+};
+
+}  // namespace
+
+std::unique_ptr<Listener> listen_uring() {
+  std::shared_ptr<Uring> ring =
+      make_uring(URING_QUEUE_DEPTH, URING_RECEIVE_BUFFERS);
+  if (!ring) {
+    darena::log << "io_uring unavailable, falling back to SDL_net\n";
+    return listen_tcp();
+  }
+
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    darena::log << "Socket error: " << std::strerror(errno) << "\n";
+    return nullptr;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(DARENA_PORT);
+  if (::bind(fd, (sockaddr*)&address, sizeof(address)) < 0 ||
+      ::listen(fd, SOMAXCONN) < 0) {
+    darena::log << "Socket bind error: " << std::strerror(errno) << "\n";
+    ::close(fd);
+    return nullptr;
+  }
+
+  darena::log << "Listening with io_uring on port " << DARENA_PORT << "\n";
+  return std::make_unique<UringListener>(ring, fd);
+}
+
+std::unique_ptr<Connection> connect_uring(const std::string& host) {
+  std::shared_ptr<Uring> ring = make_uring(URING_CLIENT_QUEUE_DEPTH, 1);
+  if (!ring) {
+    darena::log << "io_uring unavailable, falling back to SDL_net\n";
+    return connect_tcp(host);
+  }
+
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses;
+  std::string port = std::to_string(DARENA_PORT);
+  int result = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+  if (result != 0) {
+    darena::log << "Resolve error for " << host << ": "
+                << gai_strerror(result) << "\n";
+    return nullptr;
+  }
+
+  int fd = -1;
+  for (addrinfo* address = addresses; address; address = address->ai_next) {
+    fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC,
+                  address->ai_protocol);
+    if (fd >= 0 && ::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    darena::log << "Connect error to " << host << ": " << std::strerror(errno)
+                << "\n";
+    return nullptr;
+  }
+
+  set_no_delay(fd);
+  return std::make_unique<UringConnection>(ring, fd);
+}
+
+#else
+
+std::unique_ptr<Listener> listen_uring() {
+  darena::log << "io_uring is not supported on this platform, using SDL_net\n";
+  return listen_tcp();
+}
+
+std::unique_ptr<Connection> connect_uring(const std::string& host) {
+  darena::log << "io_uring is not supported on this platform, using SDL_net\n";
+  return connect_tcp(host);
+}
+
+#endif
+
+}  // namespace darena
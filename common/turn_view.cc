@@ -0,0 +1,70 @@
+#include "turn_view.h"
+
+namespace darena {
+
+namespace {
+
+// Walks over count ints, checking they decode, and records where they are
+bool skip_ints(Decoder& decoder, const uint8_t* bytes, EncodedInts& ints) {
+  if (!decoder.read_count(ints.count)) {
+    return false;
+  }
+  size_t begin = decoder.position();
+  int value;
+  for (size_t i = 0; i < ints.count && decoder.ok; i++) {
+    decoder.read(value);
+  }
+  ints.data = bytes + begin;
+  ints.size = decoder.position() - begin;
+  return decoder.ok;
+}
+
+// Walks over the terrain deltas, the server only forwards them
+bool skip_terrain_deltas(Decoder& decoder, const uint8_t* bytes,
+                         size_t& count) {
+  if (!decoder.read_count(count)) {
+    return false;
+  }
+  int island;
+  int first;
+  EncodedInts heights;
+  for (size_t i = 0; i < count && decoder.ok; i++) {
+    decoder.read(island);
+    decoder.read(first);
+    if (!decoder.ok || !skip_ints(decoder, bytes, heights)) {
+      return false;
+    }
+  }
+  return decoder.ok;
+}
+
+}  // namespace
+
+bool ClientTurnView::parse(const char* data, size_t size) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  Decoder decoder(bytes, size);
+
+  // Field order follows DARENA_CODEC_DEFINE in ClientTurn
+  decoder.read(id);
+  if (!decoder.ok || !skip_ints(decoder, bytes, movements)) {
+    return false;
+  }
+  tail = bytes + decoder.position();
+  if (!skip_ints(decoder, bytes, angle_changes)) {
+    return false;
+  }
+  decoder.read(shot_angle);
+  decoder.read(shot_power);
+  decoder.read(final_position);
+  decoder.read(start_digest);
+  decoder.read(end_digest);
+  if (!decoder.ok ||
+      !skip_terrain_deltas(decoder, bytes, n_of_terrain_deltas)) {
+    return false;
+  }
+  tail_size = bytes + decoder.position() - tail;
+
+  return decoder.ok && decoder.at_end();
+}
+
+}  // namespace darena
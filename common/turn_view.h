@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "codec.h"
+#include "common.h"
+
+namespace darena {
+
+// Varint ints of an encoded message, decoded one at a time straight from the
+// bytes. Only valid while the buffer it points into is.
+struct EncodedInts {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  size_t count = 0;
+
+  // Calls function with every value in order. The bytes were checked by
+  // ClientTurnView::parse(), so there are no bounds checks here.
+  template <typename Function>
+  void for_each(Function&& function) const {
+    const uint8_t* p = data;
+    for (size_t i = 0; i < count; i++) {
+      uint64_t value = 0;
+      int shift = 0;
+      while (*p & 0x80) {
+        value |= (uint64_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+      }
+      value |= (uint64_t)*p++ << shift;
+      function(zigzag_decode(value));
+    }
+  }
+};
+
+// A ClientTurn read in place from a message encoded with the binary codec.
+// parse() validates the whole message without allocating, the movement and
+// angle vectors are never materialized. Points into the received buffer, so it
+// is only valid until the next receive into it.
+struct ClientTurnView {
+  int id = 0;
+  EncodedInts movements;
+  EncodedInts angle_changes;
+  float shot_angle = 0;
+  float shot_power = 0;
+  Vec2 final_position{0, 0};
+  darena::StateDigest start_digest;
+  darena::StateDigest end_digest;
+  // The deltas are checked but left encoded in the tail
+  size_t n_of_terrain_deltas = 0;
+
+  // Everything from angle_changes to the end of the message, still encoded
+  const uint8_t* tail = nullptr;
+  size_t tail_size = 0;
+
+  // Returns false if data is not a well formed ClientTurn
+  bool parse(const char* data, size_t size);
+};
+
+}  // namespace darena
@@ -7,9 +7,13 @@
 namespace darena {
 
 // Used to randomly generate numbers in generate_heightmap()
+namespace {
 std::random_device rd;
 std::mt19937 gen(rd());
 std::uniform_real_distribution<> dis(0.0, 1.0);
+}  // namespace
+
+void GameMaster::seed(unsigned int value) { gen.seed(value); }
 
 std::vector<darena::IslandPoint> GameMaster::generate_heightmap(
     const Vec2& starting_position, int num_of_points) {
@@ -7,6 +7,9 @@
 namespace darena {
 
 struct GameMaster {
+  // Makes generate_heightmap() repeatable, it is seeded randomly otherwise
+  void seed(unsigned int value);
+
   std::vector<darena::IslandPoint> generate_heightmap(
       const Vec2& starting_position, int num_of_points);
 };
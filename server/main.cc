@@ -1,6 +1,7 @@
 #include <SDL_net.h>
 
 #include <array>
+#include <string>
 
 #include "common.h"
 #include "game_master.h"
@@ -10,13 +11,28 @@ bool game_running = false;
 TCPsocket server_listening_socket, client_communication_socket[MAX_CLIENTS];
 int client_id = 0;
 
-int main() {
+// Usage: DuelArenaServer [--pass-through] [--metrics <path>] [address]
+// address selects the transport, see darena::listen(). TCP by default.
+// --pass-through forwards turns without decoding them (see TCPServer).
+// --metrics rewrites path with the server's metrics in the Prometheus text
+// format every METRICS_DUMP_INTERVAL ms.
+int main(int argc, char* argv[]) {
   darena::GameMaster game_master{};
 
   darena::log << "Starting server...\n";
 
   darena::TCPServer server{};
-  game_running = server.initialize();
+  std::string address = "";
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--pass-through") {
+      server.pass_through = true;
+    } else if (std::string(argv[i]) == "--metrics" && i + 1 < argc) {
+      server.metrics_path = argv[++i];
+    } else {
+      address = argv[i];
+    }
+  }
+  game_running = server.initialize(address);
 
   if (!game_running) {
     return 1;
@@ -40,60 +56,30 @@ int main() {
                                      ISLAND_NUM_OF_POINTS);
 
   std::array<std::vector<darena::IslandPoint>, 2> heightmaps = {
-      left_island_heightmap, right_island_heightmap};
-
-  // Stores the buffers containing heightmap information which are sent to the
-  // clients
-  std::vector<msgpack::sbuffer> buffers;
-
-  darena::log << "Waiting for clients to try to connect.\n";
-  for (client_id = 0; client_id < MAX_CLIENTS; client_id++) {
-    noerr = server.wait_for_connection(client_id);
-    if (!noerr) {
-      return 1;
-    }
-
-    noerr = server.read_message(client_id);
-    if (!noerr) {
-      return 1;
-    }
-
-    buffers.emplace_back();
-
-    // Pack the heightmaps information in the buffer
-    darena::ServerIDHeightmapsResponse res = {client_id, heightmaps};
-    msgpack::packer<msgpack::sbuffer> packer(&buffers[client_id]);
-    packer.pack(res);
-  }
-
-  for (int i = 0; i < client_id; i++) {
-    noerr = server.send_response(i, std::move(buffers[i]));
-    if (!noerr) {
-      return 1;
-    }
-  }
-
-  int id_playing = 0;
-  int id_waiting = 1;
-  while (true) {
-    noerr = server.get_turn_data(id_playing);
-    if (!noerr) {
-      return 1;
-    }
-    server.trim_turn_data();
-    msgpack::sbuffer buf;
-    msgpack::packer<msgpack::sbuffer> packer(&buf);
-    packer.pack(server.turn_data);
-    noerr = server.send_response(id_waiting, std::move(buf));
-    if (!noerr) {
-      return 1;
+      std::move(left_island_heightmap), std::move(right_island_heightmap)};
+
+  noerr = server.accept_players(heightmaps);
+  if (noerr && DARENA_REALTIME_MODE) {
+    noerr = server.relay_realtime();
+  } else if (noerr) {
+    // A player whose connection breaks gets the match back by reconnecting,
+    // the server waits for it and goes on from the turn it missed
+    while (!server.match_over) {
+      int id_playing = server.id_playing();
+      noerr = server.relay_turn(id_playing, 1 - id_playing);
+      if (!noerr && !server.has_dropped_players()) {
+        break;
+      }
+      noerr = server.resume_dropped_players();
+      if (!noerr) {
+        break;
+      }
     }
-    id_playing = id_waiting;
-    id_waiting = 1 - id_playing;
   }
 
+  // The server plays one match, every way out of it ends in cleanup()
   server.cleanup();
   darena::log << "Server ended.\n";
 
-  return 0;
+  return noerr ? 0 : 1;
 }
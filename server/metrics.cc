@@ -0,0 +1,304 @@
+#include "metrics.h"
+
+#include <SDL.h>
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "common.h"
+
+#define N_OF_COUNTERS ((int)darena::Counter::COUNT)
+#define N_OF_GAUGES ((int)darena::Gauge::COUNT)
+#define N_OF_HISTOGRAMS ((int)darena::Histogram::COUNT)
+
+namespace darena {
+
+namespace {
+
+struct MetricInfo {
+  const char* name;
+  // Inside the braces of every sample, empty for none
+  const char* labels;
+  const char* help;
+  // Multiplies recorded values on export
+  double scale;
+};
+
+// In the order of the enums. Entries sharing a name are one metric with
+// different labels, they have to be next to each other.
+const MetricInfo counter_info[N_OF_COUNTERS] = {
+    {"darena_connections_accepted_total", "", "Connections accepted", 1},
+    {"darena_players_dropped_total", "", "Player connections dropped", 1},
+    {"darena_turns_relayed_total", "", "Turns relayed to the other player",
+     1},
+    {"darena_messages_received_total", "", "Messages received", 1},
+    {"darena_received_bytes_total", "", "Message bytes received", 1},
+    {"darena_messages_sent_total", "", "Messages sent", 1},
+    {"darena_sent_bytes_total", "", "Message bytes sent", 1},
+    {"darena_errors_total", "kind=\"receive\"", "Errors by kind", 1},
+    {"darena_errors_total", "kind=\"send\"", "", 1},
+    {"darena_errors_total", "kind=\"decode\"", "", 1},
+    {"darena_errors_total", "kind=\"rejected\"", "", 1},
+    {"darena_errors_total", "kind=\"desync\"", "", 1},
+    {"darena_errors_total", "kind=\"handshake_timeout\"", "", 1},
+    {"darena_errors_total", "kind=\"spectator_behind\"", "", 1},
+    {"darena_connections_shed_total", "",
+     "Connections turned away by admission control", 1},
+};
+
+const MetricInfo gauge_info[N_OF_GAUGES] = {
+    {"darena_connections", "kind=\"player\"", "Open connections by kind",
+     1},
+    {"darena_connections", "kind=\"pending\"", "", 1},
+    {"darena_connections", "kind=\"spectator\"", "", 1},
+    {"darena_matches_active", "", "Matches being played", 1},
+    {"darena_link_srtt_seconds", "seat=\"0\"",
+     "Smoothed round trip time of a seat's connection", 1e-6},
+    {"darena_link_srtt_seconds", "seat=\"1\"", "", 1e-6},
+    {"darena_link_jitter_seconds", "seat=\"0\"",
+     "Round trip jitter of a seat's connection", 1e-6},
+    {"darena_link_jitter_seconds", "seat=\"1\"", "", 1e-6},
+    {"darena_link_min_rtt_seconds", "seat=\"0\"",
+     "Lowest round trip time of a seat's connection", 1e-6},
+    {"darena_link_min_rtt_seconds", "seat=\"1\"", "", 1e-6},
+    {"darena_link_pongs", "seat=\"0\"",
+     "Pongs received on a seat's connection", 1},
+    {"darena_link_pongs", "seat=\"1\"", "", 1},
+};
+
+// The LINK_* gauges and their labels have one entry per seat
+static_assert(MAX_CLIENTS == 2, "gauge_info lists two seats");
+
+const MetricInfo histogram_info[N_OF_HISTOGRAMS] = {
+    {"darena_message_size_bytes", "", "Size of the messages received", 1},
+    {"darena_decode_seconds", "", "Time to decode a message", 1e-6},
+    {"darena_encode_seconds", "", "Time to encode a message", 1e-6},
+    {"darena_relay_stage_seconds", "stage=\"receive\"",
+     "Time a relayed turn spent in each stage", 1e-6},
+    {"darena_relay_stage_seconds", "stage=\"trim\"", "", 1e-6},
+    {"darena_relay_stage_seconds", "stage=\"pack\"", "", 1e-6},
+    {"darena_relay_stage_seconds", "stage=\"forward\"", "", 1e-6},
+    {"darena_relay_stage_seconds", "stage=\"total\"", "", 1e-6},
+    {"darena_spectator_queue_depth", "",
+     "Messages queued for a spectator when one is pushed", 1},
+};
+
+// Values recorded by one thread. Only that thread writes them, so a relaxed
+// load and store is enough to add and the exporter never sees a torn value.
+struct MetricsShard {
+  std::array<std::atomic<uint64_t>, N_OF_COUNTERS> counters;
+  std::array<std::array<std::atomic<uint64_t>, METRICS_HISTOGRAM_BUCKETS>,
+             N_OF_HISTOGRAMS>
+      buckets;
+  std::array<std::atomic<uint64_t>, N_OF_HISTOGRAMS> sums;
+};
+
+void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+  value.store(value.load(std::memory_order_relaxed) + amount,
+              std::memory_order_relaxed);
+}
+
+// Shards of the running threads, and the values of those that exited
+std::mutex registry_mutex;
+std::vector<darena::MetricsShard*> shards;
+darena::MetricsShard retired;
+
+std::array<std::atomic<int64_t>, N_OF_GAUGES> gauges;
+
+// The calling thread's shard, registered on first use
+struct ThreadShard {
+  darena::MetricsShard* shard = new darena::MetricsShard();
+
+  ThreadShard() {
+    std::lock_guard lock(registry_mutex);
+    shards.push_back(shard);
+  }
+
+  ~ThreadShard() {
+    std::lock_guard lock(registry_mutex);
+    for (int i = 0; i < N_OF_COUNTERS; i++) {
+      retired.counters[i].fetch_add(shard->counters[i].load());
+    }
+    for (int i = 0; i < N_OF_HISTOGRAMS; i++) {
+      for (int j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++) {
+        retired.buckets[i][j].fetch_add(shard->buckets[i][j].load());
+      }
+      retired.sums[i].fetch_add(shard->sums[i].load());
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+      if (shards[i] == shard) {
+        shards[i] = shards.back();
+        shards.pop_back();
+        break;
+      }
+    }
+    delete shard;
+  }
+};
+
+thread_local ThreadShard thread_shard;
+
+int bucket_of(uint64_t value) {
+  if (value <= 1) {
+    return 0;
+  }
+  int bucket = 64 - __builtin_clzll(value - 1);
+  return bucket < METRICS_HISTOGRAM_BUCKETS - 1 ? bucket
+                                                : METRICS_HISTOGRAM_BUCKETS - 1;
+}
+
+// Plain copy of the totals, taken under registry_mutex
+struct MetricsSnapshot {
+  uint64_t counters[N_OF_COUNTERS] = {};
+  uint64_t buckets[N_OF_HISTOGRAMS][METRICS_HISTOGRAM_BUCKETS] = {};
+  uint64_t sums[N_OF_HISTOGRAMS] = {};
+
+  void add(const darena::MetricsShard& shard) {
+    for (int i = 0; i < N_OF_COUNTERS; i++) {
+      counters[i] += shard.counters[i].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < N_OF_HISTOGRAMS; i++) {
+      for (int j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++) {
+        buckets[i][j] += shard.buckets[i][j].load(std::memory_order_relaxed);
+      }
+      sums[i] += shard.sums[i].load(std::memory_order_relaxed);
+    }
+  }
+};
+
+void append_header(std::string& out, const MetricInfo& info,
+                   const MetricInfo* previous, const char* type) {
+  if (previous && std::strcmp(previous->name, info.name) == 0) {
+    return;
+  }
+  out.append("# HELP ").append(info.name).append(" ");
+  out.append(info.help).append("\n");
+  out.append("# TYPE ").append(info.name).append(" ");
+  out.append(type).append("\n");
+}
+
+// name{labels} value, extra_label goes after labels
+void append_sample(std::string& out, const char* name, const char* suffix,
+                   const char* labels, const std::string& extra_label,
+                   double value) {
+  out.append(name).append(suffix);
+  bool has_labels = labels[0] != '\0';
+  if (has_labels || !extra_label.empty()) {
+    out.append("{").append(labels);
+    if (has_labels && !extra_label.empty()) {
+      out.append(",");
+    }
+    out.append(extra_label).append("}");
+  }
+  char number[32];
+  std::snprintf(number, sizeof(number), " %.12g\n", value);
+  out.append(number);
+}
+
+}  // namespace
+
+void add_metric(darena::Counter counter, uint64_t amount) {
+  bump(thread_shard.shard->counters[(int)counter], amount);
+}
+
+void set_metric(darena::Gauge gauge, int64_t value) {
+  gauges[(int)gauge].store(value, std::memory_order_relaxed);
+}
+
+void observe_metric(darena::Histogram histogram, uint64_t value) {
+  darena::MetricsShard& shard = *thread_shard.shard;
+  bump(shard.buckets[(int)histogram][bucket_of(value)], 1);
+  bump(shard.sums[(int)histogram], value);
+}
+
+void set_link_metrics(int seat, double srtt_us, double jitter_us,
+                      uint64_t min_rtt_us, int n_of_pongs) {
+  darena::set_metric((darena::Gauge)((int)darena::Gauge::LINK_SRTT_US + seat),
+                     srtt_us);
+  darena::set_metric(
+      (darena::Gauge)((int)darena::Gauge::LINK_JITTER_US + seat), jitter_us);
+  darena::set_metric(
+      (darena::Gauge)((int)darena::Gauge::LINK_MIN_RTT_US + seat), min_rtt_us);
+  darena::set_metric((darena::Gauge)((int)darena::Gauge::LINK_PONGS + seat),
+                     n_of_pongs);
+}
+
+uint64_t ticks_to_us(uint64_t from, uint64_t to) {
+  if (to <= from) {
+    return 0;
+  }
+  return (uint64_t)((double)(to - from) * 1e6 /
+                    SDL_GetPerformanceFrequency());
+}
+
+void format_metrics(std::string& out) {
+  MetricsSnapshot snapshot;
+  {
+    std::lock_guard lock(registry_mutex);
+    snapshot.add(retired);
+    for (const darena::MetricsShard* shard : shards) {
+      snapshot.add(*shard);
+    }
+  }
+
+  for (int i = 0; i < N_OF_COUNTERS; i++) {
+    const MetricInfo& info = counter_info[i];
+    append_header(out, info, i > 0 ? &counter_info[i - 1] : nullptr,
+                  "counter");
+    append_sample(out, info.name, "", info.labels, "",
+                  snapshot.counters[i] * info.scale);
+  }
+
+  for (int i = 0; i < N_OF_GAUGES; i++) {
+    const MetricInfo& info = gauge_info[i];
+    append_header(out, info, i > 0 ? &gauge_info[i - 1] : nullptr, "gauge");
+    append_sample(out, info.name, "", info.labels, "",
+                  gauges[i].load(std::memory_order_relaxed) * info.scale);
+  }
+
+  for (int i = 0; i < N_OF_HISTOGRAMS; i++) {
+    const MetricInfo& info = histogram_info[i];
+    append_header(out, info, i > 0 ? &histogram_info[i - 1] : nullptr,
+                  "histogram");
+    // Prometheus buckets are cumulative
+    uint64_t count = 0;
+    for (int j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++) {
+      count += snapshot.buckets[i][j];
+      char bound[48] = "le=\"+Inf\"";
+      if (j < METRICS_HISTOGRAM_BUCKETS - 1) {
+        std::snprintf(bound, sizeof(bound), "le=\"%.12g\"",
+                      (double)(1ULL << j) * info.scale);
+      }
+      append_sample(out, info.name, "_bucket", info.labels, bound, count);
+    }
+    append_sample(out, info.name, "_sum", info.labels, "",
+                  snapshot.sums[i] * info.scale);
+    append_sample(out, info.name, "_count", info.labels, "", count);
+  }
+}
+
+bool dump_metrics(const std::string& path) {
+  std::string text;
+  darena::format_metrics(text);
+
+  std::string temporary = path + ".tmp";
+  FILE* file = std::fopen(temporary.c_str(), "w");
+  if (!file) {
+    darena::log << "Can't write metrics to " << temporary << "\n";
+    return false;
+  }
+  bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+  written = std::fclose(file) == 0 && written;
+  if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    darena::log << "Can't write metrics to " << path << "\n";
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace darena
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Histograms count values into power of two buckets, bucket i holds those up
+// to 2^i and the last one everything larger
+#define METRICS_HISTOGRAM_BUCKETS 32
+// How often the server rewrites its metrics file, see dump_metrics()
+#define METRICS_DUMP_INTERVAL 5000
+
+namespace darena {
+
+// Totals since the server started
+enum class Counter {
+  CONNECTIONS_ACCEPTED,
+  PLAYERS_DROPPED,
+  TURNS_RELAYED,
+  MESSAGES_RECEIVED,
+  BYTES_RECEIVED,
+  MESSAGES_SENT,
+  BYTES_SENT,
+  RECEIVE_ERRORS,
+  SEND_ERRORS,
+  DECODE_ERRORS,
+  // Well formed messages from the wrong sender or with an unexpected size
+  REJECTED_MESSAGES,
+  DESYNCS,
+  HANDSHAKE_TIMEOUTS,
+  SPECTATORS_DROPPED,
+  // Turned away by admission control
+  CONNECTIONS_SHED,
+  COUNT
+};
+
+// Values as of now, set by the server thread
+enum class Gauge {
+  PLAYERS_CONNECTED,
+  PENDING_CONNECTIONS,
+  SPECTATORS,
+  MATCHES_ACTIVE,
+  // Of each seat's connection, see LinkStats. Set with set_link_metrics(),
+  // one entry per seat.
+  LINK_SRTT_US,
+  LINK_SRTT_US_SEAT_1,
+  LINK_JITTER_US,
+  LINK_JITTER_US_SEAT_1,
+  LINK_MIN_RTT_US,
+  LINK_MIN_RTT_US_SEAT_1,
+  LINK_PONGS,
+  LINK_PONGS_SEAT_1,
+  COUNT
+};
+
+// Durations are recorded in microseconds and exported in seconds
+enum class Histogram {
+  MESSAGE_SIZE_BYTES,
+  DECODE_US,
+  ENCODE_US,
+  // The stages of RelayTimings, one turn each
+  RELAY_RECEIVE_US,
+  RELAY_TRIM_US,
+  RELAY_PACK_US,
+  RELAY_FORWARD_US,
+  RELAY_TOTAL_US,
+  // Messages queued for a spectator, including the one just pushed
+  SPECTATOR_QUEUE_DEPTH,
+  COUNT
+};
+
+// Recording only touches the calling thread's own storage with relaxed atomic
+// loads and stores, there are no locks or read-modify-write instructions. The
+// exporter sums the threads. A thread registers itself the first time it
+// records and folds its values into the totals when it exits.
+void add_metric(darena::Counter counter, uint64_t amount = 1);
+void set_metric(darena::Gauge gauge, int64_t value);
+void observe_metric(darena::Histogram histogram, uint64_t value);
+// Sets the LINK_* gauges of seat
+void set_link_metrics(int seat, double srtt_us, double jitter_us,
+                      uint64_t min_rtt_us, int n_of_pongs);
+
+// A message of size bytes, received or sent
+inline void record_received(size_t size) {
+  darena::add_metric(darena::Counter::MESSAGES_RECEIVED);
+  darena::add_metric(darena::Counter::BYTES_RECEIVED, size);
+  darena::observe_metric(darena::Histogram::MESSAGE_SIZE_BYTES, size);
+}
+
+inline void record_sent(size_t size) {
+  darena::add_metric(darena::Counter::MESSAGES_SENT);
+  darena::add_metric(darena::Counter::BYTES_SENT, size);
+}
+
+// Microseconds between two SDL_GetPerformanceCounter() values
+uint64_t ticks_to_us(uint64_t from, uint64_t to);
+
+// Appends every metric in the Prometheus text format to out
+void format_metrics(std::string& out);
+
+// Writes format_metrics() to path through a temporary file renamed over it,
+// so a reader such as node_exporter's textfile collector never sees half of
+// it. Returns false and logs on failure.
+bool dump_metrics(const std::string& path);
+
+}  // namespace darena
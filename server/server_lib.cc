@@ -1,35 +1,52 @@
 #include "server_lib.h"
 
+#include <random>
+
 #include "common.h"
+#include "keyframe.h"
+#include "state_hash.h"
 
 namespace darena {
 
-bool TCPServer::initialize() {
-  if (SDLNet_Init() == -1) {
-    darena::log << "SDLNet_Init Error: " << SDLNet_GetError() << "\n";
-    return false;
-  }
+namespace {
 
-  IPaddress server_ip;
-  if (SDLNet_ResolveHost(&server_ip, NULL, DARENA_PORT) == -1) {
-    darena::log << "SDLNet_ResolveHost Error: " << SDLNet_GetError() << "\n";
-    return false;
-  }
-
-  uint32_t client_ip = server_ip.host;
-  darena::log << "Listening from: " << unit32_t_address_to_string(client_ip)
-              << "\n";
-
-  server_listening_socket = SDLNet_TCP_Open(&server_ip);
+// Keeps at most MAX_N_OF_ZERO_IN_MOVEMENT zeros in a row, the client treats a
+// run of zeros as standing still no matter how long it is
+struct ZeroRunTrimmer {
+  int n_of_zero = 0;
 
-  if (!server_listening_socket) {
-    darena::log << "SDLNet_TCP_Open Error: " << SDLNet_GetError() << "\n";
-    return false;
+  bool keep(int movement) {
+    if (movement != 0) {
+      n_of_zero = 0;
+      return true;
+    }
+    if (n_of_zero >= MAX_N_OF_ZERO_IN_MOVEMENT) {
+      return false;
+    }
+    n_of_zero++;
+    return true;
+  }
+};
+
+// Random and never 0, which asks for a new seat
+uint64_t new_resume_token() {
+  std::random_device device;
+  uint64_t token = 0;
+  while (token == 0) {
+    token = ((uint64_t)device() << 32) | device();
   }
+  return token;
+}
 
-  socket_set = SDLNet_AllocSocketSet(MAX_CLIENTS);
+}  // namespace
 
-  return true;
+bool TCPServer::initialize(const std::string& address) {
+  listener = darena::listen(address);
+  if (!metrics_path.empty()) {
+    timers.schedule(metrics_dump,
+                    darena::monotonic_ms() + METRICS_DUMP_INTERVAL);
+  }
+  return listener != nullptr;
 }
 
 bool TCPServer::wait_for_connection(int id) {
@@ -39,164 +56,268 @@ bool TCPServer::wait_for_connection(int id) {
     return false;
   }
 
+  darena::log << "Waiting for connection...\n";
   while (!client_connected[id]) {
-    darena::log << "Waiting for connection...\n";
-    client_communication_socket[id] =
-        SDLNet_TCP_Accept(server_listening_socket);
-
-    // No connection received
-    if (!client_communication_socket[id]) {
-      // Wait for DARENA_CONNECTION_AWAIT ms before checking connection again
-      SDL_Delay(DARENA_CONNECTION_AWAIT);
+    // Nothing to time out before the match, so this blocks until a client
+    // connects
+    connections[id] = listener->accept(timers.next_timeout_ms());
+    timers.advance();
+    if (!connections[id]) {
       continue;
     }
 
-    // Log the client IP and port
-    IPaddress* client_ip_address =
-        SDLNet_TCP_GetPeerAddress(client_communication_socket[id]);
-
-    if (!client_ip_address) {
-      darena::log << "SDLNet_TCP_GetPeerAddress Error: " << SDLNet_GetError()
-                  << "\n";
-      return false;
-    }
-
     darena::log << "Accepted a connection from "
-                << darena::ipaddress_to_string(client_ip_address) << "\n";
+                << connections[id]->peer_name() << "\n";
+    darena::add_metric(darena::Counter::CONNECTIONS_ACCEPTED);
+    // Raised once its request arrived
+    connections[id]->set_receive_limit(DARENA_MAX_MESSAGE_LENGTH);
 
     client_connected[id] = true;
   }
 
   return true;
 }
-bool TCPServer::read_message(int id) {
-  SDLNet_TCP_AddSocket(socket_set, client_communication_socket[id]);
 
+void TCPServer::drop_client(int id) {
+  darena::log << "Dropped client " << id << "\n";
+  darena::add_metric(darena::Counter::PLAYERS_DROPPED);
+  connections[id].reset();
+  client_connected[id] = false;
+}
+
+bool TCPServer::has_dropped_players() const {
+  for (bool connected : client_connected) {
+    if (!connected) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TCPServer::keep_alive(int id) {
+  if (!client_connected[id]) {
+    return;
+  }
+
+  darena::Connection& connection = *connections[id];
+  // A message that arrived meanwhile is kept for the next receive
+  connection.wait_readable(0);
+  if (connection.is_broken()) {
+    darena::log << "Lost the connection to client " << id << "\n";
+    drop_client(id);
+    return;
+  }
+  if (connection.silent_ms() > DARENA_PEER_TIMEOUT) {
+    darena::log << "Client " << id << " went silent\n";
+    drop_client(id);
+    return;
+  }
+  if (!connection.send_ping()) {
+    darena::log << "Send error to client " << id << "\n";
+    drop_client(id);
+    return;
+  }
+  timers.schedule(keepalives[id],
+                  darena::monotonic_ms() + DARENA_PING_INTERVAL);
+}
+
+void TCPServer::dump_metrics() {
+  int n_of_players = 0;
+  for (bool connected : client_connected) {
+    n_of_players += connected;
+  }
+  int n_of_pending = pending_connections.size() + joining_spectators.size();
+  for (const auto& connection : joining_players) {
+    n_of_pending += connection != nullptr;
+  }
+  darena::set_metric(darena::Gauge::PLAYERS_CONNECTED, n_of_players);
+  darena::set_metric(darena::Gauge::PENDING_CONNECTIONS, n_of_pending);
+  darena::set_metric(darena::Gauge::SPECTATORS, spectators.size());
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    darena::LinkStats stats;
+    if (client_connected[i]) {
+      stats = connections[i]->link_stats();
+    }
+    darena::set_link_metrics(i, stats.srtt_us, stats.jitter_us,
+                             stats.min_rtt_us, stats.n_of_pongs);
+  }
+
+  darena::dump_metrics(metrics_path);
+  timers.schedule(metrics_dump,
+                  darena::monotonic_ms() + METRICS_DUMP_INTERVAL);
+}
+
+void TCPServer::log_link_stats(int id) const {
+  if (!client_connected[id]) {
+    return;
+  }
+  const darena::LinkStats& stats = connections[id]->link_stats();
+  if (stats.n_of_pongs == 0) {
+    return;
+  }
+  darena::log << "Client " << id << " rtt " << stats.srtt_us / 1000
+              << " ms, min " << stats.min_rtt_us / 1000.0 << " ms, jitter "
+              << stats.jitter_us / 1000 << " ms, " << stats.n_of_samples
+              << " samples from " << stats.n_of_pongs << " pongs\n";
+}
+
+bool TCPServer::wait_for_message(int id) {
   while (true) {
-    darena::log << "Waiting for turn data from id " << id << "...\n";
+    uint64_t now = darena::monotonic_ms();
+    timers.advance(now);
+    if (!client_connected[id]) {
+      return false;
+    }
+    int timeout_ms = timers.next_timeout_ms(now);
+    if (read_pongs(id) &&
+        (timeout_ms < 0 || timeout_ms > PONG_POLL_INTERVAL)) {
+      timeout_ms = PONG_POLL_INTERVAL;
+    }
+    if (connections[id]->wait_readable(timeout_ms)) {
+      return true;
+    }
+  }
+}
 
-    if (!SDLNet_CheckSockets(socket_set, DARENA_CONNECTION_AWAIT)) {
-      // Wait for DARENA_CONNECTION_AWAIT ms before checking connection again
+bool TCPServer::read_pongs(int id) {
+  bool pong_due = false;
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (i == id || !client_connected[i]) {
       continue;
     }
-    if (!SDLNet_SocketReady(client_communication_socket[id])) {
+    const darena::LinkStats& stats = connections[i]->link_stats();
+    if (stats.n_of_pongs >= stats.n_of_pings) {
       continue;
     }
-    break;
-  }
-
-  // Read the message length first
-  uint32_t message_size;
-  int len = SDLNet_TCP_Recv(client_communication_socket[id], &message_size,
-                            sizeof(message_size));
-  if (!len) {
-    darena::log << "SDLNet_TCP_Recv Error, len=" << len
-                << "\nError: " << SDLNet_GetError() << "\n ";
-    return {};
-  }
-  message_size = ntohl(message_size);
-  darena::log << "Next message size: " << message_size << "\n";
-
-  // Allocate buffer for the message
-  std::vector<char> message(message_size);
-  len = SDLNet_TCP_Recv(client_communication_socket[id], message.data(),
-                        message_size);
-  if (!len) {
-    darena::log << "SDLNet_Tcp_Recv Error, len=" << len
-                << "\nError: " << SDLNet_GetError() << "\n";
+    // A message that arrived meanwhile is kept for the next receive, a broken
+    // connection is dropped by its keepalive
+    connections[i]->wait_readable(0);
+    pong_due = pong_due || (stats.n_of_pongs < stats.n_of_pings &&
+                            !connections[i]->is_broken());
+  }
+  return pong_due;
+}
+
+bool TCPServer::read_message(int id) {
+  darena::log << "Waiting for the connection request of id " << id << "\n";
+  timers.schedule(seat_deadlines[id],
+                  darena::monotonic_ms() + DARENA_HANDSHAKE_TIMEOUT);
+  bool readable = wait_for_message(id);
+  timers.cancel(seat_deadlines[id]);
+  if (!readable) {
     return false;
   }
-  darena::log << "Received message from id: " << id << "\n";
 
-  msgpack::unpacked result;
-  msgpack::unpack(result, message.data(), message_size);
-  msgpack::object obj = result.get();
+  if (!connections[id]->receive(message)) {
+    darena::log << "Receive error from id: " << id << "\n";
+    darena::add_metric(darena::Counter::RECEIVE_ERRORS);
+    return false;
+  }
+  darena::log << "Received message from id: " << id << "\n";
+  darena::record_received(message.size());
 
   darena::ClientConnectionRequest tcp_message;
-  obj.convert(tcp_message);
+  if (!darena::decode_message(message.data(), message.size(), tcp_message,
+                              decode_zone)) {
+    darena::log << "Message decode error from id: " << id << "\n";
+    darena::add_metric(darena::Counter::DECODE_ERRORS);
+    return false;
+  }
 
   darena::log << "player_name: " << tcp_message.player_name << "\n";
 
   return true;
 }
 
-bool TCPServer::send_response(int id, msgpack::sbuffer data) {
-  uint32_t message_size = htonl(data.size());
-  int result = SDLNet_TCP_Send(client_communication_socket[id], &message_size,
-                               sizeof(message_size));
-  if (result < sizeof(message_size)) {
-    darena::log << "SDLNet_TCP_Send Error, len=" << result
-                << "\nError: " << SDLNet_GetError() << "\n";
+bool TCPServer::send_response(int id, const std::vector<uint8_t>& data) {
+  if (!client_connected[id]) {
     return false;
   }
-  darena::log << "Sent message length to client " << std::to_string(id)
-              << ".\n";
-
-  result = SDLNet_TCP_Send(client_communication_socket[id], data.data(),
-                           data.size());
-  if (result < data.size()) {
-    darena::log << "SDLNet_TCP_Send Error, len=" << result
-                << "\nError: " << SDLNet_GetError() << "\n";
+  if (!connections[id]->send(data)) {
+    darena::log << "Send error to client " << std::to_string(id) << "\n";
+    darena::add_metric(darena::Counter::SEND_ERRORS);
+    drop_client(id);
     return false;
   }
   darena::log << "Sent response to client " << std::to_string(id) << ".\n";
+  darena::record_sent(data.size());
 
   return true;
 }
 
-bool TCPServer::get_turn_data(int id) {
-  while (true) {
-    darena::log << "Waiting for turn data from id " << id << "...\n";
-
-    if (!SDLNet_CheckSockets(socket_set, DARENA_CONNECTION_AWAIT)) {
-      // Wait for DARENA_CONNECTION_AWAIT ms before checking connection again
-      continue;
-    }
-    if (!SDLNet_SocketReady(client_communication_socket[id])) {
-      continue;
-    }
-    break;
+bool TCPServer::receive_turn(int id) {
+  // Connections arriving meanwhile wait in the listener's backlog until the
+  // turn is relayed. A player whose old connection went quiet is dropped by
+  // its turn deadline.
+  if (!wait_for_message(id)) {
+    return false;
   }
 
-  // Read the message length first
-  uint32_t message_size;
-  int len = SDLNet_TCP_Recv(client_communication_socket[id], &message_size,
-                            sizeof(message_size));
-  if (!len) {
-    darena::log << "SDLNet_TCP_Recv Error, len=" << len
-                << "\nError: " << SDLNet_GetError() << "\n ";
+  if (!connections[id]->receive(message)) {
+    darena::log << "Receive error from id: " << id << "\n";
+    darena::add_metric(darena::Counter::RECEIVE_ERRORS);
+    drop_client(id);
     return false;
   }
-  message_size = ntohl(message_size);
-  darena::log << "next message size: " << message_size << "\n";
+  last_read_at = SDL_GetPerformanceCounter();
+  darena::record_received(message.size());
+  return true;
+}
 
-  // Allocate buffer for the message
-  std::vector<char> message(message_size);
-  len = SDLNet_TCP_Recv(client_communication_socket[id], message.data(),
-                        message_size);
-  if (!len) {
-    darena::log << "SDLNet_Tcp_Recv Error, len=" << len
-                << "\nError: " << SDLNet_GetError() << "\n";
+bool TCPServer::get_turn_data(int id) {
+  if (!receive_turn(id)) {
     return false;
   }
   darena::log << "Received message from id: " << id << "\n";
 
-  msgpack::unpacked result;
-  msgpack::unpack(result, message.data(), message_size);
-  msgpack::object obj = result.get();
-
-  turn_data = std::make_unique<darena::ClientTurn>();
-  obj.convert(*turn_data);
-
   std::string movements = "";
   std::string angles = "";
-  for (int i : turn_data->movements) {
+  auto append_movement = [&](int i) {
     movements.append(std::to_string(i));
     movements.append(" ");
-  }
-  for (int i : turn_data->angle_changes) {
+  };
+  auto append_angle = [&](int i) {
     angles.append(std::to_string(i));
     angles.append(" ");
+  };
+
+  uint64_t decode_started_at = SDL_GetPerformanceCounter();
+  if (!DARENA_MSGPACK_PROTOCOL) {
+    if (!turn_view.parse(message.data(), message.size())) {
+      darena::log << "Message decode error from id: " << id << "\n";
+      darena::add_metric(darena::Counter::DECODE_ERRORS);
+      return false;
+    }
+    darena::observe_metric(
+        darena::Histogram::DECODE_US,
+        darena::ticks_to_us(decode_started_at, SDL_GetPerformanceCounter()));
+    turn_view.movements.for_each(append_movement);
+    turn_view.angle_changes.for_each(append_angle);
+    darena::log << turn_view.id << "\tMovements: " << movements
+                << "\tAngles: " << angles << "\t" << turn_view.shot_angle
+                << "\t" << turn_view.shot_power << "\n";
+    return true;
+  }
+
+  // Decoded in place, so the vectors keep their capacity between turns
+  if (!turn_data) {
+    turn_data = std::make_unique<darena::ClientTurn>();
+  }
+  if (!darena::decode_message(message.data(), message.size(), *turn_data,
+                              decode_zone)) {
+    darena::log << "Message decode error from id: " << id << "\n";
+    darena::add_metric(darena::Counter::DECODE_ERRORS);
+    return false;
+  }
+  darena::observe_metric(
+      darena::Histogram::DECODE_US,
+      darena::ticks_to_us(decode_started_at, SDL_GetPerformanceCounter()));
+
+  for (int i : turn_data->movements) {
+    append_movement(i);
+  }
+  for (int i : turn_data->angle_changes) {
+    append_angle(i);
   }
 
   darena::log << turn_data->id << "\tMovements: " << movements
@@ -211,54 +332,638 @@ void TCPServer::trim_turn_data() {
     return;
   }
 
-  std::vector<int> trimmed_movements = {};
-  int previous_i = 0;
-  int n_of_zero = 0;
-  for (auto it = turn_data->movements.begin(); it != turn_data->movements.end();
-       it++) {
-    if (n_of_zero >= MAX_N_OF_ZERO_IN_MOVEMENT) {
-      if (*it == 0) {
-        continue;
-      }
-    }
-    if (*it == 0) {
-      n_of_zero++;
-    } else {
-      n_of_zero = 0;
-    }
-    trimmed_movements.emplace_back(*it);
-  }
-  for (int i = 0; i < MAX_N_OF_ZERO_IN_MOVEMENT; i++) {
-    trimmed_movements.emplace_back(0);
-  }
-
   std::string movements = "";
   for (int i : turn_data->movements) {
     movements.append(std::to_string(i));
     movements.append(" ");
   }
   darena::log << "Old movements: " << movements << "\n";
+
+  // Compacted in place, the vector keeps its capacity between turns
+  std::vector<int>& trimmed_movements = turn_data->movements;
+  size_t n_of_kept = 0;
+  ZeroRunTrimmer trimmer;
+  for (int movement : trimmed_movements) {
+    if (trimmer.keep(movement)) {
+      trimmed_movements[n_of_kept++] = movement;
+    }
+  }
+  trimmed_movements.resize(n_of_kept);
+  for (int i = 0; i < MAX_N_OF_ZERO_IN_MOVEMENT; i++) {
+    trimmed_movements.emplace_back(0);
+  }
+
   movements = "";
   for (int i : trimmed_movements) {
     movements.append(std::to_string(i));
     movements.append(" ");
   }
   darena::log << "New movements: " << movements << "\n";
-  turn_data->movements = trimmed_movements;
 }
 
-void TCPServer::cleanup() {
+void TCPServer::trim_turn_view() {
+  // Count first, the count goes before the movements
+  size_t n_of_movements = MAX_N_OF_ZERO_IN_MOVEMENT;
+  ZeroRunTrimmer counter;
+  turn_view.movements.for_each(
+      [&](int movement) { n_of_movements += counter.keep(movement); });
+
+  send_buffer.clear();
+  darena::Encoder encoder(send_buffer);
+  encoder.write(turn_view.id);
+  encoder.write_unsigned(n_of_movements);
+  ZeroRunTrimmer trimmer;
+  turn_view.movements.for_each([&](int movement) {
+    if (trimmer.keep(movement)) {
+      encoder.write(movement);
+    }
+  });
+  for (int i = 0; i < MAX_N_OF_ZERO_IN_MOVEMENT; i++) {
+    encoder.write(0);
+  }
+  encoder.write_bytes(turn_view.tail, turn_view.tail_size);
+}
+
+bool TCPServer::check_digests(int id, const darena::StateDigest& start,
+                              const darena::StateDigest& end) {
+  bool in_sync = true;
+  if (last_digest_id >= 0 && last_digest_id != id &&
+      start.turn == last_end_digest.turn) {
+    in_sync = darena::compare_digests(last_end_digest, last_digest_id, start,
+                                      id);
+  }
+  if (!in_sync) {
+    darena::add_metric(darena::Counter::DESYNCS);
+  }
+  last_end_digest = end;
+  last_digest_id = id;
+  // Turns without digests leave the part zero, so only an ending counts
+  uint64_t game_end = end.parts[DIGEST_GAME_END];
+  if (game_end == darena::hash_game_end(true, false) ||
+      game_end == darena::hash_game_end(false, true) ||
+      game_end == darena::hash_game_end(true, true)) {
+    darena::log << "Turn " << end.turn << " of id " << id
+                << " ended the match\n";
+    match_over = true;
+  }
+  return in_sync;
+}
+
+int TCPServer::id_playing() const {
+  return (keyframe.id_playing + n_of_logged_turns) % MAX_CLIENTS;
+}
+
+void TCPServer::log_turn(const char* data, size_t size) {
+  if (n_of_logged_turns == logged_turns.size()) {
+    logged_turns.emplace_back();
+  }
+  logged_turns[n_of_logged_turns++].assign(data, data + size);
+}
+
+bool TCPServer::refresh_keyframe() {
+  bool noerr = true;
+  for (size_t i = 0; i < n_of_logged_turns; i++) {
+    const std::vector<char>& turn = logged_turns[i];
+    if (!darena::decode_message(turn.data(), turn.size(), logged_turn,
+                                decode_zone) ||
+        !darena::advance_keyframe(keyframe, logged_turn)) {
+      darena::log << "Logged turn " << i << " left out of the keyframe\n";
+      noerr = false;
+    }
+  }
+  n_of_logged_turns = 0;
+  darena::log << "Keyframe at turn " << keyframe.n_of_turns << "\n";
+  return noerr;
+}
+
+void TCPServer::encode_match_so_far(int id, uint64_t resume_token) {
+  // Assigned over the last one, the heightmaps and turns keep their storage
+  match_so_far.client_id = id;
+  match_so_far.resume_token = resume_token;
+  match_so_far.keyframe = keyframe;
+  match_so_far.turns.resize(n_of_logged_turns);
+  for (size_t i = 0; i < n_of_logged_turns; i++) {
+    darena::decode_message(logged_turns[i].data(), logged_turns[i].size(),
+                           match_so_far.turns[i], decode_zone);
+  }
+  uint64_t encode_started_at = SDL_GetPerformanceCounter();
+  darena::encode_message(match_so_far, send_buffer);
+  darena::observe_metric(
+      darena::Histogram::ENCODE_US,
+      darena::ticks_to_us(encode_started_at, SDL_GetPerformanceCounter()));
+}
+
+void TCPServer::poll_connections(int timeout_ms) {
+  // Drains the backlog after the first one, up to the limit
+  while (pending_connections.size() < DARENA_MAX_PENDING_CONNECTIONS) {
+    std::unique_ptr<darena::Connection> connection =
+        listener->accept(timeout_ms);
+    if (!connection) {
+      break;
+    }
+    timeout_ms = 0;
+    darena::add_metric(darena::Counter::CONNECTIONS_ACCEPTED);
+    connection->set_receive_limit(DARENA_MAX_MESSAGE_LENGTH);
+    auto pending = std::make_unique<darena::PendingConnection>();
+    pending->connection = std::move(connection);
+    darena::PendingConnection* raw_pending = pending.get();
+    pending->handshake_deadline.on_expire = [raw_pending]() {
+      raw_pending->timed_out = true;
+    };
+    timers.schedule(pending->handshake_deadline,
+                    darena::monotonic_ms() + DARENA_HANDSHAKE_TIMEOUT);
+    pending_connections.push_back(std::move(pending));
+  }
+  // Full, the oldest request is waited for instead of the listener
+  if (timeout_ms > 0 &&
+      pending_connections.size() >= DARENA_MAX_PENDING_CONNECTIONS) {
+    pending_connections.front()->connection->wait_readable(timeout_ms);
+  }
+  timers.advance();
+
+  for (size_t i = 0; i < pending_connections.size();) {
+    darena::PendingConnection& pending = *pending_connections[i];
+    darena::ClientConnectionRequest request;
+    bool readable = pending.connection->wait_readable(0);
+    if (readable &&
+        (!pending.connection->receive(message) ||
+         !darena::decode_message(message.data(), message.size(), request,
+                                 decode_zone))) {
+      darena::log << "Bad connection request from "
+                  << pending.connection->peer_name() << "\n";
+      darena::add_metric(darena::Counter::DECODE_ERRORS);
+    } else if (readable) {
+      darena::record_received(message.size());
+      if (request.spectate &&
+          spectators.size() + joining_spectators.size() >=
+              DARENA_MAX_SPECTATORS) {
+        darena::log << "Turned spectator " << pending.connection->peer_name()
+                    << " away, " << spectators.size() << " watching\n";
+        darena::add_metric(darena::Counter::CONNECTIONS_SHED);
+      } else if (request.spectate) {
+        joining_spectators.push_back(std::move(pending.connection));
+      } else {
+        park_player(std::move(pending.connection), request);
+      }
+    } else if (!pending.timed_out) {
+      i++;
+      continue;
+    } else {
+      // A connection that never sends its request can't hold a slot
+      darena::log << "No connection request from "
+                  << pending.connection->peer_name() << "\n";
+      darena::add_metric(darena::Counter::HANDSHAKE_TIMEOUTS);
+    }
+    pending_connections[i] = std::move(pending_connections.back());
+    pending_connections.pop_back();
+  }
+}
+
+void TCPServer::park_player(std::unique_ptr<darena::Connection> connection,
+                            const darena::ClientConnectionRequest& request) {
+  // A token takes its own seat back, a player without one a seat nobody was
+  // given a token for. A dropped seat is only ever taken with its token.
+  int id = -1;
   for (int i = 0; i < MAX_CLIENTS; i++) {
-    if (client_connected[i]) {
-      SDLNet_TCP_DelSocket(socket_set, client_communication_socket[i]);
+    if (request.resume_token != 0 && request.resume_token == resume_tokens[i]) {
+      id = i;
+      break;
+    }
+    if (request.resume_token == 0 && resume_tokens[i] == 0 &&
+        !client_connected[i] && !joining_players[i]) {
+      id = i;
+      break;
     }
   }
-  if (socket_set) {
-    SDLNet_FreeSocketSet(socket_set);
-    socket_set = nullptr;
+  if (id < 0) {
+    darena::log << "Rejected " << request.player_name
+                << ", no free seat for its token\n";
+    return;
+  }
+
+  // The player is back before its broken connection was noticed
+  if (client_connected[id]) {
+    drop_client(id);
+  }
+  if (request.resume_token == 0) {
+    resume_tokens[id] = new_resume_token();
+    darena::log << request.player_name << " joins as id " << id << "\n";
+  } else {
+    darena::log << request.player_name << " resumes as id " << id << "\n";
+  }
+  connection->set_receive_limit(DARENA_MAX_TURN_LENGTH);
+  joining_players[id] = std::move(connection);
+}
+
+void TCPServer::admit_spectators() {
+  if (joining_spectators.empty()) {
+    return;
+  }
+
+  // The same setup for everyone joining now, they have no seat or token
+  encode_match_so_far(-1, 0);
+  darena::SharedMessage setup = std::make_shared<const std::vector<char>>(
+      send_buffer.begin(), send_buffer.end());
+  for (auto& connection : joining_spectators) {
+    spectators.add(std::move(connection), setup);
+  }
+  joining_spectators.clear();
+}
+
+bool TCPServer::resume_dropped_players() {
+  if (has_dropped_players() && !resumable) {
+    darena::log << "A streamed turn broke off, the match can't resume\n";
+    return false;
+  }
+
+  if (has_dropped_players()) {
+    darena::log << "Waiting for dropped players...\n";
+    resume_timed_out = false;
+    timers.schedule(resume_deadline,
+                    darena::monotonic_ms() + DARENA_RESUME_TIMEOUT);
+  }
+  while (has_dropped_players()) {
+    if (resume_timed_out) {
+      darena::log << "Gave up on the dropped players after "
+                  << DARENA_RESUME_TIMEOUT << " ms\n";
+      return false;
+    }
+    for (int id = 0; id < MAX_CLIENTS; id++) {
+      if (client_connected[id] || !joining_players[id]) {
+        continue;
+      }
+      encode_match_so_far(id, resume_tokens[id]);
+      connections[id] = std::move(joining_players[id]);
+      client_connected[id] = true;
+      if (send_response(id, send_buffer)) {
+        timers.schedule(keepalives[id],
+                        darena::monotonic_ms() + DARENA_PING_INTERVAL);
+      }
+    }
+
+    if (has_dropped_players()) {
+      // The transports can't wait on the listener and the pending
+      // connections together. Requests usually arrive with the connection,
+      // the rest are checked every DARENA_CONNECTION_AWAIT until their
+      // handshake deadline. With nothing pending this blocks in accept.
+      int timeout_ms = timers.next_timeout_ms();
+      if (!pending_connections.empty()) {
+        timeout_ms = DARENA_CONNECTION_AWAIT;
+      }
+      poll_connections(timeout_ms);
+    }
+  }
+  timers.cancel(resume_deadline);
+
+  admit_spectators();
+  return true;
+}
+
+bool TCPServer::accept_players(
+    const std::array<std::vector<darena::IslandPoint>, MAX_CLIENTS>&
+        heightmaps) {
+  // Stores the buffers containing heightmap information which are sent to the
+  // clients
+  std::vector<std::vector<uint8_t>> buffers;
+
+  keyframe = darena::initial_keyframe(heightmaps);
+  n_of_logged_turns = 0;
+  match_over = false;
+
+  darena::log << "Waiting for clients to try to connect.\n";
+  for (client_id = 0; client_id < MAX_CLIENTS; client_id++) {
+    // A connection without a valid request in time gives the seat up
+    while (true) {
+      if (!wait_for_connection(client_id)) {
+        return false;
+      }
+      if (read_message(client_id)) {
+        connections[client_id]->set_receive_limit(DARENA_MAX_TURN_LENGTH);
+        timers.schedule(keepalives[client_id],
+                        darena::monotonic_ms() + DARENA_PING_INTERVAL);
+        break;
+      }
+      if (client_connected[client_id]) {
+        drop_client(client_id);
+      }
+    }
+
+    // The match so far is only the heightmaps yet
+    resume_tokens[client_id] = new_resume_token();
+    encode_match_so_far(client_id, resume_tokens[client_id]);
+    buffers.emplace_back(send_buffer.begin(), send_buffer.end());
+  }
+
+  for (int i = 0; i < client_id; i++) {
+    if (!send_response(i, buffers[i])) {
+      return false;
+    }
+  }
+
+  darena::set_metric(darena::Gauge::MATCHES_ACTIVE, 1);
+  return true;
+}
+
+bool TCPServer::relay_turn(int id_playing, int id_waiting,
+                           darena::RelayTimings* timings) {
+  // Between turns, so folding them in adds nothing to a turn's latency and
+  // new spectators start with a whole turn
+  if (n_of_logged_turns >= KEYFRAME_INTERVAL_TURNS) {
+    refresh_keyframe();
+  }
+  // Spectators and players who connected during the last turn
+  poll_connections(0);
+  admit_spectators();
+
+  timers.schedule(seat_deadlines[id_playing],
+                  darena::monotonic_ms() + DARENA_TURN_TIMEOUT);
+  // Always taken for the metrics
+  darena::RelayTimings turn_timings;
+  if (!timings) {
+    timings = &turn_timings;
+  }
+  bool noerr;
+  if (DARENA_STREAM_TURNS) {
+    noerr = relay_turn_stream(id_playing, id_waiting, timings);
+  } else if (pass_through && !DARENA_MSGPACK_PROTOCOL) {
+    noerr = pass_through_turn(id_playing, {id_waiting}, timings);
+  } else {
+    noerr = relay_decoded_turn(id_playing, id_waiting, timings);
+  }
+  timers.cancel(seat_deadlines[id_playing]);
+
+  if (noerr) {
+    darena::add_metric(darena::Counter::TURNS_RELAYED);
+    darena::observe_metric(
+        darena::Histogram::RELAY_RECEIVE_US,
+        darena::ticks_to_us(timings->read_at, timings->received_at));
+    darena::observe_metric(
+        darena::Histogram::RELAY_TRIM_US,
+        darena::ticks_to_us(timings->received_at, timings->trimmed_at));
+    darena::observe_metric(
+        darena::Histogram::RELAY_PACK_US,
+        darena::ticks_to_us(timings->trimmed_at, timings->packed_at));
+    darena::observe_metric(
+        darena::Histogram::RELAY_FORWARD_US,
+        darena::ticks_to_us(timings->packed_at, timings->forwarded_at));
+    darena::observe_metric(
+        darena::Histogram::RELAY_TOTAL_US,
+        darena::ticks_to_us(timings->read_at, timings->forwarded_at));
+  }
+  for (int id = 0; id < MAX_CLIENTS; id++) {
+    log_link_stats(id);
+  }
+  return noerr;
+}
+
+bool TCPServer::relay_decoded_turn(int id_playing, int id_waiting,
+                                   darena::RelayTimings* timings) {
+  if (!get_turn_data(id_playing)) {
+    return false;
+  }
+  uint64_t received_at = SDL_GetPerformanceCounter();
+  int turn_id = DARENA_MSGPACK_PROTOCOL ? turn_data->id : turn_view.id;
+  if (turn_id != id_playing) {
+    darena::log << "Rejected turn of id " << turn_id << " from id "
+                << id_playing << "\n";
+    darena::add_metric(darena::Counter::REJECTED_MESSAGES);
+    return false;
+  }
+  if (DARENA_MSGPACK_PROTOCOL) {
+    check_digests(id_playing, turn_data->start_digest, turn_data->end_digest);
+  } else {
+    check_digests(id_playing, turn_view.start_digest, turn_view.end_digest);
+  }
+  // Logged as it arrived, before forwarding can fail
+  log_turn(message.data(), message.size());
+
+  uint64_t trimmed_at;
+  uint64_t packed_at;
+  if (DARENA_MSGPACK_PROTOCOL) {
+    trim_turn_data();
+    trimmed_at = SDL_GetPerformanceCounter();
+    darena::encode_message(*turn_data, send_buffer);
+    packed_at = SDL_GetPerformanceCounter();
+    darena::observe_metric(darena::Histogram::ENCODE_US,
+                           darena::ticks_to_us(trimmed_at, packed_at));
+  } else {
+    // Trimming writes the message to forward directly, it is the encode
+    uint64_t encode_started_at = SDL_GetPerformanceCounter();
+    trim_turn_view();
+    trimmed_at = SDL_GetPerformanceCounter();
+    packed_at = trimmed_at;
+    darena::observe_metric(darena::Histogram::ENCODE_US,
+                           darena::ticks_to_us(encode_started_at, trimmed_at));
+  }
+
+  // Spectators are served after the player waiting for the turn
+  bool sent = send_response(id_waiting, send_buffer);
+  spectators.broadcast(reinterpret_cast<const char*>(send_buffer.data()),
+                       send_buffer.size());
+  if (!sent) {
+    return false;
+  }
+
+  if (timings) {
+    timings->read_at = last_read_at;
+    timings->received_at = received_at;
+    timings->trimmed_at = trimmed_at;
+    timings->packed_at = packed_at;
+    timings->forwarded_at = SDL_GetPerformanceCounter();
+  }
+  return true;
+}
+
+bool TCPServer::relay_turn_stream(int id_playing, int id_waiting,
+                                  darena::RelayTimings* timings) {
+  int n_of_batches = 0;
+  uint64_t received_at;
+  do {
+    if (!receive_turn(id_playing)) {
+      resumable = n_of_batches == 0;
+      return false;
+    }
+
+    // Batches are small, decoding them only to check the sender and find the
+    // last one is cheap. The received bytes are forwarded.
+    if (!darena::decode_message(message.data(), message.size(), turn_batch,
+                                decode_zone) ||
+        turn_batch.id != id_playing) {
+      darena::log << "Rejected turn batch of " << message.size()
+                  << " bytes from id: " << id_playing << "\n";
+      darena::add_metric(darena::Counter::REJECTED_MESSAGES);
+      return false;
+    }
+    received_at = SDL_GetPerformanceCounter();
+    darena::observe_metric(darena::Histogram::DECODE_US,
+                           darena::ticks_to_us(last_read_at, received_at));
+
+    // The rest of the turn is still received if the other player dropped,
+    // it gets the whole turn when resuming
+    if (client_connected[id_waiting]) {
+      if (connections[id_waiting]->send(message.data(), message.size())) {
+        darena::record_sent(message.size());
+      } else {
+        darena::log << "Send error to client " << id_waiting << "\n";
+        darena::add_metric(darena::Counter::SEND_ERRORS);
+        drop_client(id_waiting);
+      }
+    }
+    spectators.broadcast(message.data(), message.size());
+    n_of_batches++;
+  } while (!turn_batch.last);
+  check_digests(id_playing, turn_batch.start_digest, turn_batch.end_digest);
+
+  // Only what the keyframe needs, the inputs are not kept
+  logged_turn.id = turn_batch.id;
+  logged_turn.movements.clear();
+  logged_turn.angle_changes.clear();
+  logged_turn.shot_angle = turn_batch.shot_angle;
+  logged_turn.shot_power = turn_batch.shot_power;
+  logged_turn.final_position = turn_batch.final_position;
+  logged_turn.start_digest = turn_batch.start_digest;
+  logged_turn.end_digest = turn_batch.end_digest;
+  logged_turn.terrain_deltas = turn_batch.terrain_deltas;
+  darena::encode_message(logged_turn, send_buffer);
+  log_turn(reinterpret_cast<const char*>(send_buffer.data()),
+           send_buffer.size());
+  darena::log << "Forwarded a turn of " << n_of_batches << " batches from id "
+              << id_playing << "\n";
+
+  // Timings cover the last batch, the one the other client waits for
+  if (timings) {
+    timings->read_at = last_read_at;
+    timings->received_at = received_at;
+    timings->trimmed_at = received_at;
+    timings->packed_at = received_at;
+    timings->forwarded_at = SDL_GetPerformanceCounter();
+  }
+  return true;
+}
+
+bool TCPServer::relay_realtime() {
+  darena::log << "Relaying real-time inputs\n";
+  realtime_state = darena::initial_sim_state();
+  darena::SimTerrain terrain = {&keyframe.heightmaps[0],
+                                &keyframe.heightmaps[1]};
+  while (true) {
+    // The waits below are short, the keepalives run between them
+    timers.advance();
+    if (has_dropped_players()) {
+      return false;
+    }
+    for (int id = 0; id < MAX_CLIENTS; id++) {
+      // Short waits, so an idle player never holds up the other one for long
+      if (!connections[id]->wait_readable(1)) {
+        continue;
+      }
+      if (!connections[id]->receive(message)) {
+        darena::log << "Receive error from id: " << id << "\n";
+        darena::add_metric(darena::Counter::RECEIVE_ERRORS);
+        return false;
+      }
+      darena::record_received(message.size());
+      if (!darena::decode_message(message.data(), message.size(),
+                                  realtime_input, decode_zone) ||
+          realtime_input.id != id ||
+          realtime_input.frame !=
+              realtime_state.frame + (int)realtime_inputs[id].size()) {
+        darena::log << "Rejected input of " << message.size()
+                    << " bytes from id: " << id << "\n";
+        darena::add_metric(darena::Counter::REJECTED_MESSAGES);
+        return false;
+      }
+      if (!connections[1 - id]->send(message.data(), message.size())) {
+        darena::log << "Send error to client " << 1 - id << "\n";
+        darena::add_metric(darena::Counter::SEND_ERRORS);
+        return false;
+      }
+      darena::record_sent(message.size());
+
+      realtime_inputs[id].push_back(realtime_input.input);
+      while (!realtime_inputs[0].empty() && !realtime_inputs[1].empty()) {
+        darena::simulate_frame(
+            realtime_state,
+            {realtime_inputs[0].front(), realtime_inputs[1].front()}, terrain);
+        realtime_inputs[0].pop_front();
+        realtime_inputs[1].pop_front();
+      }
+      if (darena::sim_game_over(realtime_state)) {
+        darena::log << "The real-time match ended at frame "
+                    << realtime_state.frame << "\n";
+        return true;
+      }
+    }
+  }
+}
+
+bool TCPServer::pass_through_turn(int id_playing,
+                                  const std::vector<int>& recipients,
+                                  darena::RelayTimings* timings) {
+  if (!receive_turn(id_playing)) {
+    return false;
+  }
+
+  // Parsed in place for the sender and the digests, nothing is copied
+  if (message.empty() || message.size() > DARENA_MAX_TURN_LENGTH ||
+      !turn_view.parse(message.data(), message.size()) ||
+      turn_view.id != id_playing) {
+    darena::log << "Rejected turn of " << message.size()
+                << " bytes from id: " << id_playing << "\n";
+    darena::add_metric(darena::Counter::REJECTED_MESSAGES);
+    return false;
+  }
+  uint64_t received_at = SDL_GetPerformanceCounter();
+  check_digests(id_playing, turn_view.start_digest, turn_view.end_digest);
+  log_turn(message.data(), message.size());
+
+  // Every recipient is sent the same receive buffer, nothing is copied. The
+  // sends are queued first so batching backends submit them together.
+  // Recipients that dropped get the turn when resuming.
+  bool noerr = true;
+  for (int recipient : recipients) {
+    if (client_connected[recipient] &&
+        !connections[recipient]->queue_send(message.data(), message.size())) {
+      darena::log << "Send error to client " << recipient << "\n";
+      darena::add_metric(darena::Counter::SEND_ERRORS);
+      drop_client(recipient);
+      noerr = false;
+    }
+  }
+  for (int recipient : recipients) {
+    if (!client_connected[recipient]) {
+      continue;
+    }
+    if (connections[recipient]->flush()) {
+      darena::record_sent(message.size());
+    } else {
+      darena::log << "Send error to client " << recipient << "\n";
+      darena::add_metric(darena::Counter::SEND_ERRORS);
+      drop_client(recipient);
+      noerr = false;
+    }
+  }
+  spectators.broadcast(message.data(), message.size());
+  darena::log << "Forwarded " << message.size() << " bytes from id "
+              << id_playing << "\n";
+
+  if (timings) {
+    timings->read_at = last_read_at;
+    timings->received_at = received_at;
+    timings->trimmed_at = received_at;
+    timings->packed_at = received_at;
+    timings->forwarded_at = SDL_GetPerformanceCounter();
+  }
+  return noerr;
+}
+
+void TCPServer::cleanup() {
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    connections[i].reset();
+    client_connected[i] = false;
   }
-  SDLNet_TCP_Close(client_communication_socket[client_id]);
-  SDLNet_Quit();
+  listener.reset();
+  darena::set_metric(darena::Gauge::MATCHES_ACTIVE, 0);
 }
 
 }  // namespace darena
@@ -3,33 +3,218 @@
 #include <SDL_net.h>
 
 #include <array>
+#include <deque>
+#include <memory>
+#include <vector>
 
+#include "codec.h"
 #include "common.h"
-#include "msgpack.hpp"
+#include "metrics.h"
+#include "realtime_sim.h"
+#include "spectators.h"
+#include "timer_wheel.h"
+#include "transport.h"
+#include "turn_view.h"
+
+// How often the seats not being waited for are read while a pong of theirs is
+// due, in ms. Keeps the time it sits unread well under PING_MAX_ERROR_US, so
+// the round trip sample counts.
+#define PONG_POLL_INTERVAL 2
 
 namespace darena {
 
+// SDL_GetPerformanceCounter() after each stage of relaying one turn, filled in
+// by TCPServer::relay_turn()
+struct RelayTimings {
+  uint64_t read_at = 0;
+  uint64_t received_at = 0;
+  uint64_t trimmed_at = 0;
+  uint64_t packed_at = 0;
+  uint64_t forwarded_at = 0;
+};
+
+// Connection accepted mid-match whose ClientConnectionRequest has not arrived
+struct PendingConnection {
+  std::unique_ptr<darena::Connection> connection;
+  // Sets timed_out after DARENA_HANDSHAKE_TIMEOUT
+  darena::Timer handshake_deadline;
+  bool timed_out = false;
+};
+
+// Named after its original backend, it serves any transport (see transport.h)
 struct TCPServer {
   std::array<bool, MAX_CLIENTS> client_connected;
-  std::array<TCPsocket, MAX_CLIENTS> client_communication_socket;
+  std::array<std::unique_ptr<darena::Connection>, MAX_CLIENTS> connections;
+  // The last turn. With the binary codec it is only viewed in place in
+  // message, turn_data is decoded when sending msgpack
+  darena::ClientTurnView turn_view;
   std::unique_ptr<darena::ClientTurn> turn_data;
-  TCPsocket server_listening_socket;
-  SDLNet_SocketSet socket_set;
+  // Last batch of a streamed turn, with DARENA_STREAM_TURNS
+  darena::TurnInputBatch turn_batch;
+  // Last input relayed in the real-time mode
+  darena::RealtimeInput realtime_input;
+  // The real-time match replayed from the relayed inputs, to see it end.
+  // Inputs wait in realtime_inputs until both players sent their frame.
+  darena::SimState realtime_state;
+  std::array<std::deque<uint8_t>, MAX_CLIENTS> realtime_inputs;
+  std::unique_ptr<darena::Listener> listener;
+  // Reused for every incoming and outgoing message
+  std::vector<char> message;
+  std::vector<uint8_t> send_buffer;
+  // Every msgpack message is unpacked into it, see decode_message()
+  msgpack::zone decode_zone;
   int client_id = 0;
+  // Forward turns as they arrived instead of decoding, trimming and encoding
+  // them. They are only parsed in place, for the sender id and the digests.
+  // Needs the binary codec.
+  bool pass_through = false;
+  // SDL_GetPerformanceCounter() when the last turn finished arriving, before
+  // it was decoded
+  uint64_t last_read_at = 0;
+  // State the last turn's shot left, as its player saw it
+  darena::StateDigest last_end_digest;
+  int last_digest_id = -1;
+  // Set by check_digests() once a relayed turn ended with a player lost
+  bool match_over = false;
+  // Match state for players resuming after a dropped connection or joining
+  // late. Relayed turns are logged as encoded ClientTurns and folded into the
+  // keyframe every KEYFRAME_INTERVAL_TURNS, buffers past n_of_logged_turns
+  // are kept for their storage.
+  darena::MatchKeyframe keyframe;
+  std::vector<std::vector<char>> logged_turns;
+  size_t n_of_logged_turns = 0;
+  std::array<uint64_t, MAX_CLIENTS> resume_tokens{};
+  // Cleared when a streamed turn breaks off after batches were forwarded, the
+  // other client can't take back inputs it already played
+  bool resumable = true;
+  // Decode scratch for the keyframe and the last batch of a streamed turn
+  darena::ClientTurn logged_turn;
+  // Last response of encode_match_so_far(), reused for the next one
+  darena::ServerIDHeightmapsResponse match_so_far;
+  // Connections that arrived while the match is played. Players get their
+  // seat back in resume_dropped_players(), spectators at the next turn.
+  std::vector<std::unique_ptr<darena::PendingConnection>> pending_connections;
+  std::array<std::unique_ptr<darena::Connection>, MAX_CLIENTS>
+      joining_players;
+  std::vector<std::unique_ptr<darena::Connection>> joining_spectators;
+  // Watch the match, every relayed message is fanned out to them
+  darena::SpectatorHub spectators;
+  // Every deadline of the server. It blocks in the transport until the next
+  // one instead of waking up to check them, see wait_for_message().
+  darena::TimerWheel timers;
+  // The handshake of a seat being taken, then the turn of the seat playing.
+  // The seat is dropped when it expires.
+  std::array<darena::Timer, MAX_CLIENTS> seat_deadlines;
+  // Pings every seated player each DARENA_PING_INTERVAL, see keep_alive()
+  std::array<darena::Timer, MAX_CLIENTS> keepalives;
+  // Sets resume_timed_out DARENA_RESUME_TIMEOUT after a seat was dropped
+  darena::Timer resume_deadline;
+  bool resume_timed_out = false;
+  // Where dump_metrics() writes every METRICS_DUMP_INTERVAL, set before
+  // initialize(). Nothing is written if it is empty.
+  std::string metrics_path;
+  darena::Timer metrics_dump;
 
-  TCPServer() : server_listening_socket(nullptr), socket_set(nullptr) {
+  TCPServer() {
     for (int i = 0; i < MAX_CLIENTS; i++) {
       client_connected[i] = false;
-      client_communication_socket[i] = NULL;
+      seat_deadlines[i].on_expire = [this, i]() {
+        darena::log << "Client " << i << " missed its deadline\n";
+        drop_client(i);
+      };
+      keepalives[i].on_expire = [this, i]() { keep_alive(i); };
     }
+    metrics_dump.on_expire = [this]() { dump_metrics(); };
+    resume_deadline.on_expire = [this]() { resume_timed_out = true; };
   }
 
-  bool initialize();
+  // Starts listening on address, TCP on DARENA_PORT by default
+  bool initialize(const std::string& address = "");
   bool wait_for_connection(int id);
+  // Closes the connection to id after a receive or send error, the seat waits
+  // for resume_dropped_players()
+  void drop_client(int id);
+  bool has_dropped_players() const;
+  // Answers the pings of id and reads its pongs, drops it if it went silent
+  // for DARENA_PEER_TIMEOUT and pings it again. Runs every
+  // DARENA_PING_INTERVAL while id is connected, the player being waited for
+  // and the other one alike.
+  void keep_alive(int id);
+  // Logs the round trip estimates of id's connection
+  void log_link_stats(int id) const;
+  // Sets the connection gauges and writes every metric to metrics_path
+  void dump_metrics();
+  // Waits until a message from id can be received, running the timers
+  // meanwhile. Returns false if they dropped id.
+  bool wait_for_message(int id);
+  // Reads the pongs the seats other than id sent. Returns true if one of them
+  // still owes a pong.
+  bool read_pongs(int id);
   bool read_message(int id);
-  bool send_response(int id, msgpack::sbuffer data);
+  bool send_response(int id, const std::vector<uint8_t>& data);
+  // Waits for the next message from id and receives it into message
+  bool receive_turn(int id);
   bool get_turn_data(int id);
   void trim_turn_data();
+  // Encodes turn_view with trimmed movements into send_buffer, copying the
+  // rest of the message as it is
+  void trim_turn_view();
+  // Compares the state a turn of id started from with the one the previous
+  // turn of the other player ended in, and logs the parts that differ.
+  // Returns false on a desync, the turn is still relayed. Sets match_over if
+  // end has a player lost.
+  bool check_digests(int id, const darena::StateDigest& start,
+                     const darena::StateDigest& end);
+  // Whose turn is next, the keyframe's player moved past the logged turns
+  int id_playing() const;
+  // Appends an encoded ClientTurn to the turns since the keyframe
+  void log_turn(const char* data, size_t size);
+  // Folds the logged turns into the keyframe
+  bool refresh_keyframe();
+  // Encodes a ServerIDHeightmapsResponse with the keyframe and the turns
+  // since into send_buffer
+  void encode_match_so_far(int id, uint64_t resume_token);
+  // Accepts the connections arriving within timeout_ms, negative for no
+  // limit, and sorts those whose request arrived into joining players and
+  // spectators, never waiting for a request
+  void poll_connections(int timeout_ms);
+  // Picks the seat of a player's request, by its resume token or any seat
+  // without a token yet. A seat whose player came back is dropped.
+  void park_player(std::unique_ptr<darena::Connection> connection,
+                   const darena::ClientConnectionRequest& request);
+  // Sends the match so far to the joining spectators and starts fanning out
+  // to them
+  void admit_spectators();
+  // Waits until every dropped seat is taken again and sends each returning
+  // player the match so far. Returns true at once if nobody dropped, false if
+  // they are not all back within DARENA_RESUME_TIMEOUT.
+  bool resume_dropped_players();
+  // Accepts MAX_CLIENTS players and sends each its id and the heightmaps
+  bool accept_players(
+      const std::array<std::vector<darena::IslandPoint>, MAX_CLIENTS>&
+          heightmaps);
+  // Reads a turn from id_playing and forwards it to id_waiting, dropping
+  // id_playing if the turn takes longer than DARENA_TURN_TIMEOUT
+  bool relay_turn(int id_playing, int id_waiting,
+                  darena::RelayTimings* timings = nullptr);
+  // relay_turn() without DARENA_STREAM_TURNS or pass_through, decodes the
+  // turn, trims it and encodes it again
+  bool relay_decoded_turn(int id_playing, int id_waiting,
+                          darena::RelayTimings* timings = nullptr);
+  // relay_turn() with DARENA_STREAM_TURNS, forwards every batch of the turn
+  // as it arrives until the last one
+  bool relay_turn_stream(int id_playing, int id_waiting,
+                         darena::RelayTimings* timings = nullptr);
+  // Forwards every frame input of the real-time mode to the other player.
+  // Returns true once the inputs of both players end the match, false if a
+  // connection breaks first.
+  bool relay_realtime();
+  // relay_turn() in pass_through mode, the received bytes are sent on as they
+  // are to every id in recipients. The digests are still checked, so the end
+  // of the match is seen.
+  bool pass_through_turn(int id_playing, const std::vector<int>& recipients,
+                         darena::RelayTimings* timings = nullptr);
+  // Ends the match, closing every connection
   void cleanup();
 };
 
@@ -0,0 +1,168 @@
+#include "spectators.h"
+
+#include <chrono>
+
+#include "common.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+
+namespace darena {
+
+SpectatorHub::~SpectatorHub() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  queued.notify_one();
+  if (sender.joinable()) {
+    sender.join();
+  }
+}
+
+bool SpectatorHub::push(darena::Spectator& spectator,
+                        const darena::SharedMessage& message) {
+  bool over_budget =
+      spectator.n_of_queued_bytes > 0 &&
+      spectator.n_of_queued_bytes + message->size() > SPECTATOR_SEND_BUDGET;
+  if (spectator.broken || spectator.n_of_queued == SPECTATOR_QUEUE_CAPACITY ||
+      over_budget) {
+    disconnect(spectator);
+    return false;
+  }
+  size_t tail = (spectator.head + spectator.n_of_queued) %
+                SPECTATOR_QUEUE_CAPACITY;
+  spectator.queue[tail] = message;
+  spectator.n_of_queued++;
+  spectator.n_of_queued_bytes += message->size();
+  n_of_queued++;
+  n_of_pushes++;
+  darena::observe_metric(darena::Histogram::SPECTATOR_QUEUE_DEPTH,
+                         spectator.n_of_queued);
+  return true;
+}
+
+void SpectatorHub::disconnect(darena::Spectator& spectator) {
+  spectator.broken = true;
+  n_of_queued -= spectator.n_of_queued;
+  for (; spectator.n_of_queued > 0; spectator.n_of_queued--) {
+    spectator.queue[spectator.head].reset();
+    spectator.head = (spectator.head + 1) % SPECTATOR_QUEUE_CAPACITY;
+  }
+}
+
+void SpectatorHub::send_loop() {
+  std::vector<std::pair<std::shared_ptr<darena::Spectator>,
+                        darena::SharedMessage>>
+      pass;
+  bool blocked = false;
+  uint64_t n_of_pushes_seen = 0;
+  while (true) {
+    {
+      std::unique_lock lock(mutex);
+      if (blocked) {
+        // Every queued message is held back, waits for room or a new one
+        queued.wait_for(lock,
+                        std::chrono::milliseconds(SPECTATOR_POLL_INTERVAL),
+                        [this, n_of_pushes_seen]() {
+                          return stopping || n_of_pushes != n_of_pushes_seen;
+                        });
+      }
+      queued.wait(lock, [this]() { return stopping || n_of_queued > 0; });
+      if (stopping) {
+        return;
+      }
+      blocked = false;
+      n_of_pushes_seen = n_of_pushes;
+      uint64_t now = darena::monotonic_ms();
+      for (const auto& spectator : spectators) {
+        if (spectator->n_of_queued == 0) {
+          continue;
+        }
+        if (!spectator->connection->can_send()) {
+          if (spectator->blocked_since == 0) {
+            spectator->blocked_since = now;
+          } else if (now - spectator->blocked_since > SPECTATOR_SEND_TIMEOUT) {
+            darena::log << "Spectator took nothing for "
+                        << SPECTATOR_SEND_TIMEOUT << " ms\n";
+            disconnect(*spectator);
+            continue;
+          }
+          blocked = true;
+          continue;
+        }
+        spectator->blocked_since = 0;
+        // Moved out, whichever spectator sends a message last frees it
+        pass.emplace_back(spectator,
+                          std::move(spectator->queue[spectator->head]));
+        spectator->head = (spectator->head + 1) % SPECTATOR_QUEUE_CAPACITY;
+        spectator->n_of_queued--;
+        n_of_queued--;
+      }
+      // Only waits when nothing could be sent
+      blocked = blocked && pass.empty();
+    }
+
+    // Sent without the lock, a slow connection only delays the others
+    for (auto& [spectator, message] : pass) {
+      bool sent = spectator->connection->send(message->data(), message->size());
+      if (sent) {
+        darena::record_sent(message->size());
+      } else {
+        darena::add_metric(darena::Counter::SEND_ERRORS);
+      }
+      std::lock_guard lock(mutex);
+      spectator->n_of_queued_bytes -= message->size();
+      if (!sent) {
+        disconnect(*spectator);
+      }
+    }
+    pass.clear();
+  }
+}
+
+void SpectatorHub::add(std::unique_ptr<darena::Connection> connection,
+                       const darena::SharedMessage& setup) {
+  darena::log << "Spectator " << connection->peer_name() << " joined, "
+              << spectators.size() + 1 << " watching\n";
+  // A spectator that stops reading in the middle of a send only holds the
+  // sending thread for SPECTATOR_SEND_STALL
+  connection->set_send_timeout(SPECTATOR_SEND_STALL);
+  auto spectator = std::make_shared<darena::Spectator>();
+  spectator->connection = std::move(connection);
+  {
+    std::lock_guard lock(mutex);
+    spectators.push_back(std::move(spectator));
+    push(*spectators.back(), setup);
+  }
+  queued.notify_one();
+
+  if (!sender.joinable()) {
+    sender = std::thread([this]() { send_loop(); });
+  }
+}
+
+void SpectatorHub::broadcast(const char* data, size_t size) {
+  if (spectators.empty()) {
+    return;
+  }
+
+  darena::SharedMessage message =
+      std::make_shared<const std::vector<char>>(data, data + size);
+  {
+    std::lock_guard lock(mutex);
+    for (size_t i = 0; i < spectators.size();) {
+      if (push(*spectators[i], message)) {
+        i++;
+        continue;
+      }
+      // Order doesn't matter, the last one takes the dropped one's place
+      darena::log << "Spectator fell behind, disconnecting it\n";
+      darena::add_metric(darena::Counter::SPECTATORS_DROPPED);
+      spectators[i] = std::move(spectators.back());
+      spectators.pop_back();
+    }
+  }
+  queued.notify_one();
+}
+
+}  // namespace darena
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "transport.h"
+
+// Messages, and bytes of them, a spectator may fall behind by before it is
+// disconnected. A message is always queued for a spectator that is caught up,
+// so the match so far goes out whatever its size.
+#define SPECTATOR_QUEUE_CAPACITY 32
+#define SPECTATOR_SEND_BUDGET (4 << 20)
+// A spectator whose connection takes no message for this long is disconnected,
+// meanwhile the sending thread checks it every SPECTATOR_POLL_INTERVAL, in ms
+#define SPECTATOR_SEND_TIMEOUT 5000
+#define SPECTATOR_POLL_INTERVAL 10
+// A send that started holds up the other spectators, it fails once the
+// spectator takes none of it for this long, see Connection::set_send_timeout()
+#define SPECTATOR_SEND_STALL 500
+
+namespace darena {
+
+// An encoded message, shared by the queues of every spectator it is sent to
+using SharedMessage = std::shared_ptr<const std::vector<char>>;
+
+// Connection to one spectator and the messages waiting for it. The server only
+// queues messages, so a slow spectator never holds up the players. Once its
+// queue is full it is broken, it can join again and gets a fresh keyframe.
+// Guarded by the mutex of its SpectatorHub.
+struct Spectator {
+  std::unique_ptr<darena::Connection> connection;
+  // Ring buffer, the queue never allocates
+  std::array<darena::SharedMessage, SPECTATOR_QUEUE_CAPACITY> queue;
+  size_t head = 0;
+  size_t n_of_queued = 0;
+  // Of the queued messages and the one being sent
+  size_t n_of_queued_bytes = 0;
+  // monotonic_ms() when a queued message was first held back by can_send()
+  uint64_t blocked_since = 0;
+  bool broken = false;
+};
+
+// Every spectator of the match. Each event is encoded once and the same
+// buffer is queued for all of them. One thread sends to all spectators, it
+// starts with the first one and is joined when the hub is destroyed.
+class SpectatorHub {
+ private:
+  // Shared with the sending thread, which holds a spectator while sending so
+  // it may be dropped from here meanwhile
+  std::mutex mutex;
+  std::condition_variable queued;
+  std::vector<std::shared_ptr<darena::Spectator>> spectators;
+  // Messages queued over all spectators, and ever pushed
+  size_t n_of_queued = 0;
+  uint64_t n_of_pushes = 0;
+  bool stopping = false;
+  std::thread sender;
+
+  // Queues message for spectator, returns false and breaks it if the queue
+  // is full or it is over SPECTATOR_SEND_BUDGET
+  bool push(darena::Spectator& spectator, const darena::SharedMessage& message);
+  // Marks spectator broken and drops its queue
+  void disconnect(darena::Spectator& spectator);
+  // Sends one queued message of every spectator per pass, skipping those
+  // whose connection can't take it yet, so no spectator holds up the others
+  void send_loop();
+
+ public:
+  SpectatorHub() = default;
+  ~SpectatorHub();
+
+  SpectatorHub(const SpectatorHub&) = delete;
+  SpectatorHub& operator=(const SpectatorHub&) = delete;
+
+  // Starts sending to connection with setup, the match so far
+  void add(std::unique_ptr<darena::Connection> connection,
+           const darena::SharedMessage& setup);
+
+  // Queues a copy of data for every spectator and disconnects the ones that
+  // fell behind or whose send failed
+  void broadcast(const char* data, size_t size);
+
+  size_t size() const { return spectators.size(); }
+};
+
+}  // namespace darena